@@ -4,28 +4,93 @@ CONFIG += c++21
 CONFIG -= console
 CONFIG += windows
 
-INCLUDEPATH += D:/opencv_install/include
+tracing: DEFINES += CAMERA_TRACING
 
-LIBS += -LD:/opencv_install/x64/mingw/bin
+LIBS += -lavformat -lavcodec -lavutil -lswscale
 
-LIBS += -lopencv_core4100 -lopencv_imgcodecs4100 -lopencv_highgui4100 -lopencv_videoio4100
+win32 {
+    INCLUDEPATH += D:/opencv_install/include
+    INCLUDEPATH += D:/ffmpeg_install/include
 
-LIBS += -luuid -lstrmiids -lMfplat -lMf -lMfreadwrite -lDwrite -lole32 -lmfuuid
+    LIBS += -LD:/opencv_install/x64/mingw/bin
+
+    LIBS += -LD:/ffmpeg_install/lib
+
+    LIBS += -lopencv_core4100 -lopencv_imgproc4100 -lopencv_imgcodecs4100 -lopencv_highgui4100 -lopencv_videoio4100
+
+    LIBS += -luuid -lstrmiids -lMfplat -lMf -lMfreadwrite -lDwrite -lole32 -lmfuuid
+
+    SOURCES += service/cameraprocessing.cpp
+}
 
 SOURCES += \
     controller/mediacontroller.cpp \
+    controller/previewencoder.cpp \
     main.cpp \
+    server/clientconnection.cpp \
+    server/clientsession.cpp \
     server/mediaserver.cpp \
-    service/cameraprocessing.cpp \
+    server/mediatcpserver.cpp \
+    server/rtpsender.cpp \
+    service/blockwriter.cpp \
     service/cameraprocessingsv.cpp \
-    service/mediaservice.cpp
+    service/devicediscovery.cpp \
+    service/deviceregistry.cpp \
+    service/framepool.cpp \
+    service/framesync.cpp \
+    service/h264writer.cpp \
+    service/livecapture.cpp \
+    service/mediaservice.cpp \
+    service/pcmring.cpp \
+    service/pipelinescheduler.cpp \
+    service/rawframe.cpp \
+    service/recordingindex.cpp \
+    service/recordingregistry.cpp \
+    service/serviceconfig.cpp \
+    service/storagemanager.cpp \
+    service/tararchive.cpp \
+    service/timelapse.cpp \
+    service/tracing.cpp \
+    service/usbids.cpp
 
 HEADERS += \
     controller/mediacontroller.h \
+    controller/previewencoder.h \
+    server/clientconnection.h \
+    server/clientsession.h \
+    server/commandserver.h \
     server/mediaserver.h \
+    server/mediatcpserver.h \
+    server/rtpsender.h \
+    service/blockwriter.h \
     service/cameraprocessing.h \
     service/cameraprocessingsv.h \
-    service/mediaservice.h
+    service/devicediscovery.h \
+    service/deviceregistry.h \
+    service/framepool.h \
+    service/framesync.h \
+    service/h264writer.h \
+    service/livecapture.h \
+    service/mediaservice.h \
+    service/pcmring.h \
+    service/pipelinescheduler.h \
+    service/rawframe.h \
+    service/recordingindex.h \
+    service/recordingregistry.h \
+    service/serviceconfig.h \
+    service/storagemanager.h \
+    service/tararchive.h \
+    service/timelapse.h \
+    service/tracing.h \
+    service/usbids.h
+
+linux {
+    CONFIG += link_pkgconfig
+    PKGCONFIG += opencv4
+
+    SOURCES += server/epollserver.cpp service/v4l2capture.cpp
+    HEADERS += server/epollserver.h service/v4l2capture.h
+}
 
 qnx: target.path = /tmp/$${TARGET}/bin
 else: unix:!android: target.path = /opt/$${TARGET}/bin
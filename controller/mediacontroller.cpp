@@ -1,78 +1,861 @@
 #include <QDir>
 #include <QFile>
 #include <QDebug>
+#include <QDateTime>
+#include <QTimer>
+#include <QThread>
 
 #include "mediacontroller.h"
+#include "previewencoder.h"
+#include "service/blockwriter.h"
+#include "service/framesync.h"
+#include "service/recordingindex.h"
+#include "service/pipelinescheduler.h"
+#include "service/recordingregistry.h"
+#include "service/serviceconfig.h"
+#include "service/storagemanager.h"
+#include "service/tararchive.h"
+#include "service/tracing.h"
 
-MediaController::MediaController(MediaServer* server, MediaService* service, QObject* parent)
-    : QObject(parent), server(server), service(service) {
-    connect(server, &MediaServer::commandReceived, this, &MediaController::handleCommand);
+static const int listenerRestartDelayMs = 200;
+
+MediaController::MediaController(CommandServer* server, MediaService* service, QObject* parent)
+    : QObject(parent), server(server), service(service), config(serviceConfig()) {
+    connect(server, &CommandServer::commandReceived, this, &MediaController::handleCommand);
+    connect(server, &CommandServer::sessionClosed, this, &MediaController::onSessionClosed);
+    connect(service->deviceRegistry(), &DeviceRegistry::deviceAdded, this, &MediaController::onDeviceAdded);
+    connect(service->deviceRegistry(), &DeviceRegistry::deviceRemoved, this, &MediaController::onDeviceRemoved);
+}
+
+MediaController::~MediaController() {
+    for (PreviewEncoder* encoder : std::as_const(rtpEncoders)) {
+        delete encoder;
+    }
+    for (const QVector<PreviewEncoder*>& encoders : std::as_const(previewEncoders)) {
+        qDeleteAll(encoders);
+    }
 }
 
-void MediaController::handleCommand(const QString& command, QTcpSocket* clientSocket) {
+void MediaController::handleCommand(const QString& command, ClientConnection* session) {
+    TRACE_SCOPE("handle_command");
     qDebug() << "Received command:" << command;
 
     QStringList parts = command.split(' ');
     QString cmd = parts.first();
     QStringList args = parts.mid(1);
 
-    if (cmd == "get_info_from_all") {
+    if (cmd == "get_status") {
+        sendTextResponse(session, service->statusText().trimmed() + ":listener=" + listenerState + "\n");
+    } else if (cmd == "get_devices" || cmd == "subscribe_devices") {
+        QString response;
+        for (const CameraDevice& device : service->deviceRegistry()->devices()) {
+            response += deviceLine("DEVICE", device);
+        }
+        if (cmd == "subscribe_devices") {
+            deviceSubscribers.insert(session);
+            response += "SUBSCRIBED\n";
+        } else if (response.isEmpty()) {
+            response = "NO_DEVICES\n";
+        }
+        sendTextResponse(session, response);
+    } else if (cmd == "unsubscribe_devices") {
+        deviceSubscribers.remove(session);
+        sendTextResponse(session, "UNSUBSCRIBED\n");
+    } else if (cmd == "get_info_from_all") {
         QString info = service->getAllCamerasInfo();
-        sendTextResponse(clientSocket, info);
+        sendTextResponse(session, info);
+    } else if (cmd == "get_info_json") {
+        session->write(service->cameraInfoJsonResponse());
     } else if (cmd == "get_photo_from_all") {
         auto photos = service->capturePhotoFromAllCameras();
         for (const auto& photo : photos) {
-            sendFileResponse(clientSocket, photo.first, photo.second);
+            sendFileResponse(session, photo.first, photo.second);
         }
     } else if (cmd == "get_video_from_all") {
-        QString basePath = args.isEmpty() ? QDir::currentPath() : args.first();
-        auto videos = service->recordVideoWithAudioFromAllCameras(basePath, 5, 30);
+        QString basePath = args.isEmpty() ? QString() : args.first();
+        auto videos = service->recordVideoWithAudioFromAllCameras(basePath, config.recordDurationSeconds,
+                                                                  config.recordFps);
         for (const auto& videoPath : videos) {
-            sendFileResponse(clientSocket, QFileInfo(videoPath).fileName(), videoPath);
+            sendFileResponse(session, QFileInfo(videoPath).fileName(), videoPath);
         }
     } else if (cmd == "get_svideo_from_all") {
-        QString basePath = args.isEmpty() ? QDir::currentPath() : args.first();
-        auto videos = service->recordVideoFromAllCameras(basePath, 5, 30);
+        QString basePath = args.isEmpty() ? QString() : args.first();
+        auto videos = service->recordVideoFromAllCameras(basePath, config.recordDurationSeconds, config.recordFps);
         for (const auto& videoPath : videos) {
-            sendFileResponse(clientSocket, QFileInfo(videoPath).fileName(), videoPath);
+            sendFileResponse(session, QFileInfo(videoPath).fileName(), videoPath);
+        }
+    } else if (cmd == "start_svideo_from_all") {
+        QString basePath = args.isEmpty() ? QString() : args.first();
+        int durationSeconds = args.size() > 1 ? args.at(1).toInt() : config.recordDurationSeconds;
+        if (durationSeconds <= 0) {
+            sendTextResponse(session, "ERROR: Usage: start_svideo_from_all [path] [seconds]");
+            return;
+        }
+        service->startVideoRecordingFromAllCameras(basePath, durationSeconds, config.recordFps);
+        sendTextResponse(session, "RECORDING_STARTED\n");
+    } else if (cmd == "get_recordings") {
+        QString response;
+        for (const auto& recording : activeRecordings()) {
+            response += QString("ACTIVE:%1:%2\n").arg(QFileInfo(recording.first).fileName()).arg(recording.second);
+        }
+        sendTextResponse(session, response.isEmpty() ? "NO_ACTIVE_RECORDINGS\n" : response);
+    } else if (cmd == "get_pipeline_stats") {
+        QString response = "CORES:" + pipelineCoreLayout() + "\n";
+        for (const PipelineStageStats& stats : pipelineStageStats()) {
+            response += QString("PIPELINE:%1:%2:%3:%4:%5:%6\n")
+                            .arg(stats.cameraIndex)
+                            .arg(pipelineStageName(stats.stage))
+                            .arg(stats.samples)
+                            .arg(stats.cpuTimeNs / 1000000)
+                            .arg(stats.wallTimeNs / 1000000)
+                            .arg(stats.samples > 0 ? stats.cpuTimeNs / stats.samples / 1000 : 0);
+        }
+        if (args.value(0) == "reset") {
+            resetPipelineStageStats();
+        }
+        sendTextResponse(session, response);
+    } else if (cmd == "trace_start") {
+        if (!startTracing()) {
+            sendTextResponse(session, "ERROR: Tracing is not compiled in, rebuild with CONFIG+=tracing.");
+            return;
+        }
+        sendTextResponse(session, "TRACE_STARTED\n");
+    } else if (cmd == "trace_stop") {
+        QString traceName = args.value(0);
+        if (traceName.isEmpty()) {
+            traceName = QString("trace_%1.json").arg(QDateTime::currentDateTime().toString("yyyy-MM-dd_hh-mm-ss"));
+        }
+        QString tracePath = allocateRecordingPath(QString(), QFileInfo(traceName).fileName());
+        qint64 events = stopTracing(tracePath);
+        releaseRecordingPath(tracePath, false);
+        if (events < 0) {
+            sendTextResponse(session, "ERROR: Tracing is not active.");
+            return;
+        }
+        sendFileResponse(session, QFileInfo(tracePath).fileName(), tracePath);
+    } else if (cmd == "get_sync_stats") {
+        QString response;
+        for (const CameraSyncStats& stats : cameraSyncStats()) {
+            response += QString("SYNC:%1:%2:%3:%4:%5:%6\n")
+                            .arg(stats.cameraIndex)
+                            .arg(stats.frames)
+                            .arg(stats.offsetUs)
+                            .arg(stats.averageJitterUs)
+                            .arg(stats.maxJitterUs)
+                            .arg(stats.deviceClock ? "device" : "arrival");
+        }
+        sendTextResponse(session, response.isEmpty() ? QString("NO_SYNC_STATS\n") : response);
+    } else if (cmd == "set_sync_offset") {
+        bool cameraOk = false;
+        bool offsetOk = false;
+        int cameraIndex = -1;
+        cameraOk = resolveCameraIndex(args.value(0), cameraIndex);
+        qint64 offsetUs = args.value(1).toLongLong(&offsetOk);
+        if (!cameraOk || !offsetOk) {
+            sendTextResponse(session, "ERROR: Usage: set_sync_offset <camera> <latency_us>");
+            return;
+        }
+        setCameraLatencyOffset(cameraIndex, offsetUs);
+        sendTextResponse(session, QString("SYNC_OFFSET:%1:%2\n").arg(cameraIndex).arg(offsetUs));
+    } else if (cmd == "storage_stats") {
+        QString response;
+        for (const StorageStreamStats& stats : storageStreamStats()) {
+            qint64 averageLatencyUs = stats.writeCount > 0 ? stats.totalLatencyUs / stats.writeCount : 0;
+            response += QString("STORAGE:%1:%2:%3:%4:%5:%6:%7\n")
+                            .arg(QFileInfo(stats.filePath).fileName())
+                            .arg(stats.active ? "active" : "closed")
+                            .arg(stats.directIo ? "direct" : "buffered")
+                            .arg(stats.bytesWritten)
+                            .arg(stats.writeCount)
+                            .arg(averageLatencyUs)
+                            .arg(stats.maxLatencyUs);
+        }
+        for (const StorageVolumeStatus& volume : storageVolumes()) {
+            response += QString("VOLUME:%1:%2:%3:%4\n")
+                            .arg(volume.tier == StorageTier::Scratch ? "scratch" : "bulk")
+                            .arg(volume.bytesAvailable)
+                            .arg(volume.activeRecordings)
+                            .arg(QDir::toNativeSeparators(volume.path));
+        }
+        if (!response.isEmpty()) {
+            response += QString("PENDING_MOVES:%1\n").arg(pendingStorageMoves());
+        }
+        sendTextResponse(session, response.isEmpty() ? "NO_STORAGE_STREAMS\n" : response);
+    } else if (cmd == "get_hvideo_from_all") {
+        QString basePath = args.isEmpty() ? QString() : args.first();
+        H264Settings settings;
+        settings.bitrate = config.h264Bitrate;
+        settings.gopSize = config.h264Gop;
+        settings.preset = config.h264Preset;
+        settings.threads = config.h264Threads;
+        settings.directIo = config.directIo;
+        if (args.size() > 1) {
+            settings.bitrate = args.at(1).toInt() * 1000;
+        }
+        if (args.size() > 2) {
+            settings.gopSize = args.at(2).toInt();
+        }
+        if (args.size() > 3) {
+            settings.directIo = args.at(3) == "direct";
+        }
+        if (settings.bitrate <= 0 || settings.gopSize <= 0 ||
+            (args.size() > 3 && !settings.directIo && args.at(3) != "buffered")) {
+            sendTextResponse(session, "ERROR: Usage: get_hvideo_from_all [path] [bitrate_kbps] [gop] [direct|buffered]");
+            return;
+        }
+        auto videos = service->recordH264VideoFromAllCameras(basePath, config.recordDurationSeconds, config.recordFps,
+                                                             settings);
+        for (const auto& videoPath : videos) {
+            sendFileResponse(session, QFileInfo(videoPath).fileName(), videoPath);
+        }
+    } else if (cmd == "get_file") {
+        if (args.isEmpty()) {
+            sendTextResponse(session, "ERROR: Usage: get_file <name> [offset] [length]");
+            return;
+        }
+        bool offsetOk = true;
+        bool lengthOk = true;
+        qint64 offset = args.size() > 1 ? args.at(1).toLongLong(&offsetOk) : 0;
+        qint64 length = args.size() > 2 ? args.at(2).toLongLong(&lengthOk) : 0;
+        if (!offsetOk || !lengthOk || offset < 0 || length < 0) {
+            sendTextResponse(session, "ERROR: Invalid range for file: " + args.first());
+            return;
+        }
+        QString filePath = resolveFilePath(args.first());
+        if (filePath.isEmpty()) {
+            sendTextResponse(session, "ERROR: File not found: " + args.first());
+            return;
+        }
+        sendFileRangeResponse(session, args.first(), filePath, offset, length);
+    } else if (cmd == "get_file_time") {
+        if (args.size() < 3) {
+            sendTextResponse(session, "ERROR: Usage: get_file_time <name> <from> <to>");
+            return;
+        }
+        qint64 fromUs = parseTimestampUs(args.at(1));
+        qint64 toUs = parseTimestampUs(args.at(2));
+        if (fromUs < 0 || toUs < fromUs) {
+            sendTextResponse(session, "ERROR: Invalid time range for file: " + args.first());
+            return;
+        }
+        QString filePath = resolveFilePath(args.first());
+        if (filePath.isEmpty()) {
+            sendTextResponse(session, "ERROR: File not found: " + args.first());
+            return;
+        }
+        RecordingIndex index;
+        if (!index.open(filePath) || index.count() == 0) {
+            sendTextResponse(session, "ERROR: No index available for file: " + args.first());
+            return;
+        }
+        qint64 first = index.findKeyframeAtOrBefore(index.findByTimestamp(fromUs));
+        qint64 last = index.findByTimestamp(toUs);
+        if (!index.hasByteOffsets()) {
+            sendTextResponse(session, QString("FRAMES:%1:%2:%3\n")
+                                          .arg(args.first())
+                                          .arg(index.at(first).frameNumber)
+                                          .arg(index.at(last).frameNumber));
+            return;
+        }
+        qint64 offset = static_cast<qint64>(index.at(first).byteOffset);
+        qint64 end = index.rangeEndAfter(last);
+        qint64 length = end > offset ? end - offset : 0;
+        sendFileRangeResponse(session, args.first(), filePath, offset, length,
+                              static_cast<qint64>(index.initSegmentSize()));
+    } else if (cmd == "start_preview") {
+        bool cameraOk = false;
+        bool fpsOk = true;
+        int cameraIndex = -1;
+        cameraOk = resolveCameraIndex(args.value(0), cameraIndex);
+        int fps = args.size() > 1 ? args.at(1).toInt(&fpsOk) : config.previewFps;
+        if (!cameraOk || !fpsOk || cameraIndex < 0 || fps <= 0) {
+            sendTextResponse(session, "ERROR: Usage: start_preview <camera> [fps]");
+            return;
+        }
+        stopPreview(session);
+        LiveCapture* capture = service->acquireLiveCapture(cameraIndex, fps, args.size() <= 1);
+        connect(capture, &LiveCapture::frameCaptured, this, &MediaController::onPreviewFrame, Qt::UniqueConnection);
+        previewSessions.insert(session, cameraIndex);
+        sendTextResponse(session, QString("PREVIEW:%1:%2\n").arg(cameraIndex).arg(capture->fps()));
+    } else if (cmd == "stop_preview") {
+        stopPreview(session);
+        sendTextResponse(session, "PREVIEW_STOPPED\n");
+    } else if (cmd == "record_video") {
+        QMap<int, CaptureParameters> cameras;
+        QString error;
+        if (!parseCaptureParameters(args, cameras, error)) {
+            sendTextResponse(session, "ERROR: " + error);
+            return;
+        }
+        auto videos = service->recordVideoWithAudioFromCameras(QString(), cameras);
+        if (videos.isEmpty()) {
+            sendTextResponse(session, "ERROR: No camera could record with the requested parameters.");
+            return;
+        }
+        for (const auto& videoPath : videos) {
+            sendFileResponse(session, QFileInfo(videoPath).fileName(), videoPath);
+        }
+    } else if (cmd == "get_batch") {
+        QList<CaptureRequest> requests;
+        QSet<int> requestedCameras;
+        for (const QString& spec : args) {
+            CaptureRequest request;
+            if (!parseCaptureRequest(spec, request)) {
+                requests.clear();
+                break;
+            }
+            if (requestedCameras.contains(request.cameraIndex)) {
+                sendTextResponse(session, QString("ERROR: Camera %1 is requested more than once.").arg(request.cameraIndex));
+                return;
+            }
+            requestedCameras.insert(request.cameraIndex);
+            requests.append(request);
         }
+        if (requests.isEmpty()) {
+            sendTextResponse(session, "ERROR: Usage: get_batch <camera>:photo[:quality] <camera>:video[:seconds[:fps]] ...");
+            return;
+        }
+        sendBatchResponse(session, service->captureBatch(requests, QString()));
+    } else if (cmd == "start_rtp") {
+        bool cameraOk = false;
+        bool portOk = false;
+        bool fpsOk = true;
+        bool mtuOk = true;
+        int cameraIndex = -1;
+        cameraOk = args.size() > 2 && resolveCameraIndex(args.at(0), cameraIndex);
+        QHostAddress address(args.value(1));
+        int port = args.size() > 2 ? args.at(2).toInt(&portOk) : 0;
+        int fps = args.size() > 3 ? args.at(3).toInt(&fpsOk) : config.previewFps;
+        int mtu = args.size() > 4 ? args.at(4).toInt(&mtuOk) : config.rtpMtu;
+        if (!cameraOk || !portOk || !fpsOk || !mtuOk || cameraIndex < 0 || address.isNull() ||
+            port <= 0 || port > 65535 || fps <= 0 || mtu < 256) {
+            sendTextResponse(session, "ERROR: Usage: start_rtp <camera> <address> <port> [fps] [mtu]");
+            return;
+        }
+        stopRtp(cameraIndex);
+        LiveCapture* capture = service->acquireLiveCapture(cameraIndex, fps, args.size() <= 3);
+        connect(capture, &LiveCapture::frameCaptured, this, &MediaController::onPreviewFrame, Qt::UniqueConnection);
+        RtpJpegSender* sender = new RtpJpegSender(address, static_cast<quint16>(port), mtu, this);
+        PreviewEncoder* encoder = new PreviewEncoder(cameraIndex, sender, this);
+        rtpSenders.insert(cameraIndex, sender);
+        rtpEncoders.insert(cameraIndex, encoder);
+        encoder->start();
+        sendTextResponse(session, QString("RTP:%1:%2:%3\n").arg(cameraIndex).arg(address.toString()).arg(port));
+    } else if (cmd == "stop_rtp") {
+        bool cameraOk = false;
+        int cameraIndex = -1;
+        cameraOk = resolveCameraIndex(args.value(0), cameraIndex);
+        if (!cameraOk || !stopRtp(cameraIndex)) {
+            sendTextResponse(session, "ERROR: Usage: stop_rtp <camera>");
+            return;
+        }
+        sendTextResponse(session, QString("RTP_STOPPED:%1\n").arg(cameraIndex));
+    } else if (cmd == "start_timelapse") {
+        bool cameraOk = false;
+        bool intervalOk = false;
+        bool qualityOk = true;
+        int cameraIndex = -1;
+        cameraOk = resolveCameraIndex(args.value(0), cameraIndex);
+        TimeLapseSettings settings;
+        settings.intervalMs = args.value(1).toInt(&intervalOk);
+        settings.format = args.value(2, "mjpeg");
+        if (args.size() > 3) {
+            int value = args.at(3).toInt(&qualityOk);
+            if (settings.format == "h264") {
+                settings.bitrate = value * 1000;
+            } else {
+                settings.jpegQuality = value;
+                qualityOk = qualityOk && value > 0;
+            }
+        }
+        if (!cameraOk || !intervalOk || !qualityOk || cameraIndex < 0 || settings.intervalMs < 100 ||
+            (settings.format != "mjpeg" && settings.format != "h264") || settings.bitrate <= 0 ||
+            settings.jpegQuality < 0 || settings.jpegQuality > 100) {
+            sendTextResponse(session, "ERROR: Usage: start_timelapse <camera> <interval_ms> [mjpeg|h264] [quality|bitrate_kbps]");
+            return;
+        }
+        QString filePath = service->startTimeLapse(cameraIndex, QString(), settings);
+        if (filePath.isEmpty()) {
+            sendTextResponse(session, QString("ERROR: Time-lapse already running for camera %1").arg(cameraIndex));
+            return;
+        }
+        sendTextResponse(session, QString("TIMELAPSE:%1:%2:%3\n")
+                                      .arg(cameraIndex)
+                                      .arg(QFileInfo(filePath).fileName())
+                                      .arg(settings.intervalMs));
+    } else if (cmd == "stop_timelapse") {
+        bool cameraOk = false;
+        int cameraIndex = -1;
+        cameraOk = resolveCameraIndex(args.value(0), cameraIndex);
+        if (!cameraOk) {
+            sendTextResponse(session, "ERROR: Usage: stop_timelapse <camera>");
+            return;
+        }
+        QString filePath = service->stopTimeLapse(cameraIndex);
+        if (filePath.isEmpty()) {
+            sendTextResponse(session, QString("ERROR: No time-lapse frames recorded for camera %1").arg(cameraIndex));
+            return;
+        }
+        sendFileResponse(session, QFileInfo(filePath).fileName(), filePath);
+    } else if (cmd == "get_timelapses") {
+        QString response;
+        for (const TimeLapseCapture* capture : service->timeLapses()) {
+            response += QString("TIMELAPSE:%1:%2:%3:%4\n")
+                            .arg(capture->cameraIndex())
+                            .arg(QFileInfo(capture->filePath()).fileName())
+                            .arg(capture->settings().intervalMs)
+                            .arg(capture->frameCount());
+        }
+        sendTextResponse(session, response.isEmpty() ? QString("NO_TIMELAPSES\n") : response);
+    } else if (cmd == "get_config") {
+        QString response;
+        for (const QString& key : args.isEmpty() ? serviceConfigKeys() : args) {
+            response += QString("CONFIG:%1=%2\n").arg(key, serviceConfigValue(key));
+        }
+        sendTextResponse(session, response);
+    } else if (cmd == "set_config") {
+        QString key = args.value(0);
+        QString value = args.mid(1).join(' ');
+        QString error;
+        if (key.isEmpty()) {
+            sendTextResponse(session, "ERROR: Usage: set_config <key> [value]");
+            return;
+        }
+        ConfigApply apply = ConfigApply::Live;
+        if (!setServiceConfigValue(key, value, apply, error)) {
+            sendTextResponse(session, "ERROR: " + error);
+            return;
+        }
+        ServiceConfig previous = config;
+        config = serviceConfig();
+        applyConfigChanges(previous);
+        static const char* applyNames[] = { "live", "next_capture", "restart", "startup" };
+        sendTextResponse(session, QString("CONFIG:%1=%2:%3\n")
+                                      .arg(key, serviceConfigValue(key), applyNames[static_cast<int>(apply)]));
+    } else if (cmd == "save_config") {
+        QString error;
+        if (!args.isEmpty()) {
+            sendTextResponse(session, "ERROR: Usage: save_config");
+            return;
+        }
+        if (!saveServiceConfig(QString(), error)) {
+            sendTextResponse(session, "ERROR: " + error);
+            return;
+        }
+        sendTextResponse(session, "CONFIG_SAVED:" + serviceConfigPath() + "\n");
+    } else if (cmd == "reload_config") {
+        if (!args.isEmpty()) {
+            sendTextResponse(session, "ERROR: Usage: reload_config");
+            return;
+        }
+        QString configPath = serviceConfigPath();
+        QString error;
+        if (configPath.isEmpty() || !loadServiceConfig(configPath, error)) {
+            sendTextResponse(session, "ERROR: " + (error.isEmpty() ? QString("No config file path is known.") : error));
+            return;
+        }
+        ServiceConfig previous = config;
+        config = serviceConfig();
+        applyConfigChanges(previous);
+        sendTextResponse(session, "CONFIG_LOADED:" + configPath + "\n");
     } else {
-        sendTextResponse(clientSocket, "Unknown command.");
+        sendTextResponse(session, "Unknown command.");
+    }
+}
+
+void MediaController::applyConfigChanges(const ServiceConfig& previous) {
+    if (config.maxConnections != previous.maxConnections && config.maxConnections > 0) {
+        server->setMaxConnections(config.maxConnections);
+    }
+    if (config.idleTimeoutMs != previous.idleTimeoutMs) {
+        server->setIdleTimeout(config.idleTimeoutMs);
+    }
+    if (config.previewFps != previous.previewFps) {
+        service->setLiveCaptureFps(config.previewFps);
+    }
+    if (config.pipelineAffinity != previous.pipelineAffinity) {
+        setPipelineAffinityEnabled(config.pipelineAffinity);
+    }
+    if (config.scratchVolumes != previous.scratchVolumes || config.bulkVolumes != previous.bulkVolumes) {
+        setStorageVolumes(StorageTier::Scratch, config.scratchVolumes);
+        setStorageVolumes(StorageTier::Bulk, config.bulkVolumes);
+        startStorageMover();
+    }
+    if (config.usbIdsPath != previous.usbIdsPath) {
+        service->reloadUsbIds(serviceUsbIdsPath(config));
+    }
+    if (config.listenAddress != previous.listenAddress || config.port != previous.port ||
+        config.ioThreads != previous.ioThreads) {
+        QString address = config.listenAddress;
+        quint16 port = config.port;
+        QString previousAddress = previous.listenAddress;
+        quint16 previousPort = previous.port;
+        int ioThreads = config.ioThreads > 0 ? config.ioThreads : qMax(1, QThread::idealThreadCount() / 2);
+        QTimer::singleShot(listenerRestartDelayMs, this, [this, address, port, previousAddress, previousPort, ioThreads]() {
+            qDebug() << "Restarting listener on" << address << port;
+            server->stop();
+            server->setIoThreadCount(ioThreads);
+            if (server->start(address, port)) {
+                listenerState = "ok";
+                return;
+            }
+            qCritical() << "Listener restart failed, restoring" << previousAddress << previousPort;
+            ConfigApply apply;
+            QString error;
+            setServiceConfigValue("listen_address", previousAddress, apply, error);
+            setServiceConfigValue("port", QString::number(previousPort), apply, error);
+            config = serviceConfig();
+            if (server->start(previousAddress, previousPort)) {
+                listenerState = "restored";
+            } else {
+                qCritical() << "Failed to restore the previous listener, no client can connect.";
+                listenerState = "down";
+            }
+        });
     }
 }
 
-void MediaController::sendTextResponse(QTcpSocket* clientSocket, const QString& response) {
-    clientSocket->write(response.toUtf8());
-    clientSocket->flush();
+void MediaController::onPreviewFrame(int cameraIndex, quint64 frameNumber, const cv::Mat& frame) {
+    PreviewEncoder* rtpEncoder = rtpEncoders.value(cameraIndex, nullptr);
+    if (rtpEncoder) {
+        rtpEncoder->submit(frameNumber, frame, StreamQuality{ 1.0, config.rtpJpegQuality, 1 });
+    }
+
+    if (frameTargets.isEmpty()) {
+        frameTargets.resize(ClientConnection::qualityLevelCount());
+    }
+    for (QVector<ClientConnection*>& targets : frameTargets) {
+        targets.resize(0);
+    }
+    for (auto it = previewSessions.cbegin(); it != previewSessions.cend(); ++it) {
+        if (it.value() != cameraIndex) {
+            continue;
+        }
+        ClientConnection* session = it.key();
+        const StreamQuality& quality = session->quality();
+        if (frameNumber % quality.frameDecimation != 0 || !session->offerFrame()) {
+            continue;
+        }
+        frameTargets[session->qualityLevel()].append(session);
+    }
+    for (int level = 0; level < frameTargets.size(); ++level) {
+        if (!frameTargets.at(level).isEmpty()) {
+            previewEncoder(cameraIndex, level)->submit(frameNumber, frame, ClientConnection::qualityForLevel(level),
+                                                       frameTargets.at(level));
+        }
+    }
+}
+
+PreviewEncoder* MediaController::previewEncoder(int cameraIndex, int level) {
+    QVector<PreviewEncoder*>& encoders = previewEncoders[cameraIndex];
+    if (encoders.isEmpty()) {
+        encoders.fill(nullptr, ClientConnection::qualityLevelCount());
+    }
+    if (!encoders.at(level)) {
+        encoders[level] = new PreviewEncoder(cameraIndex, nullptr, this);
+        encoders[level]->start();
+    }
+    return encoders.at(level);
 }
 
-void MediaController::sendFileResponse(QTcpSocket* clientSocket, const QString& fileName, const QByteArray& fileData) {
+void MediaController::stopPreview(ClientConnection* session) {
+    auto it = previewSessions.find(session);
+    if (it == previewSessions.end()) {
+        return;
+    }
+    int cameraIndex = it.value();
+    previewSessions.erase(it);
+    if (previewSessions.values().contains(cameraIndex)) {
+        for (PreviewEncoder* encoder : std::as_const(previewEncoders[cameraIndex])) {
+            if (encoder) {
+                encoder->removeSession(session);
+            }
+        }
+    } else {
+        qDeleteAll(previewEncoders.take(cameraIndex));
+    }
+    service->releaseLiveCapture(cameraIndex);
+}
+
+void MediaController::onSessionClosed(ClientConnection* session) {
+    stopPreview(session);
+    deviceSubscribers.remove(session);
+}
+
+void MediaController::onDeviceAdded(const CameraDevice& device) {
+    QByteArray line = deviceLine("DEVICE_ADDED", device).toUtf8();
+    for (ClientConnection* session : std::as_const(deviceSubscribers)) {
+        session->write(line);
+    }
+}
+
+void MediaController::onDeviceRemoved(const CameraDevice& device) {
+    QByteArray line = deviceLine("DEVICE_REMOVED", device).toUtf8();
+    for (ClientConnection* session : std::as_const(deviceSubscribers)) {
+        session->write(line);
+    }
+}
+
+QString MediaController::deviceLine(const QString& event, const CameraDevice& device) const {
+    return QString("%1:%2:%3:%4\n").arg(event, device.id).arg(device.cameraIndex).arg(device.name);
+}
+
+bool MediaController::stopRtp(int cameraIndex) {
+    RtpJpegSender* sender = rtpSenders.take(cameraIndex);
+    if (!sender) {
+        return false;
+    }
+    delete rtpEncoders.take(cameraIndex);
+    delete sender;
+    service->releaseLiveCapture(cameraIndex);
+    return true;
+}
+
+bool MediaController::applyCameraMode(CaptureParameters& target, const QString& camera, QString& error) const {
+    const QMap<QString, QString> mode = config.cameraModes.value(camera);
+    for (auto it = mode.constBegin(); it != mode.constEnd(); ++it) {
+        if (!applyCaptureParameter(target, it.key(), it.value(), error)) {
+            error = QString("camera.%1: %2").arg(camera, error);
+            return false;
+        }
+    }
+    return true;
+}
+
+bool MediaController::parseCaptureParameters(const QStringList& args, QMap<int, CaptureParameters>& cameras,
+                                             QString& error) const {
+    CaptureParameters defaults;
+    if (!applyCameraMode(defaults, "default", error)) {
+        return false;
+    }
+    QList<int> selected;
+    QMap<int, CaptureParameters> overrides;
+    QList<QPair<QString, QString>> defaultArguments;
+    for (const QString& arg : args) {
+        int separator = arg.indexOf('=');
+        QString key = arg.left(separator);
+        QString value = arg.mid(separator + 1);
+        if (separator <= 0 || value.isEmpty()) {
+            error = "Invalid parameter: " + arg;
+            return false;
+        }
+        if (key == "camera") {
+            if (value == "all") {
+                selected = { -1 };
+                continue;
+            }
+            selected.clear();
+            for (const QString& item : value.split(',')) {
+                int cameraIndex = -1;
+                if (!resolveCameraIndex(item, cameraIndex)) {
+                    error = "Invalid camera selector: " + value;
+                    return false;
+                }
+                selected.append(cameraIndex);
+                if (!overrides.contains(cameraIndex)) {
+                    CaptureParameters parameters = defaults;
+                    if (!applyCameraMode(parameters, QString::number(cameraIndex), error)) {
+                        return false;
+                    }
+                    overrides.insert(cameraIndex, parameters);
+                }
+            }
+            continue;
+        }
+        QList<CaptureParameters*> targets;
+        if (selected.isEmpty() || selected == QList<int>{ -1 }) {
+            targets.append(&defaults);
+            defaultArguments.append(qMakePair(key, value));
+        } else {
+            for (int cameraIndex : selected) {
+                targets.append(&overrides[cameraIndex]);
+            }
+        }
+        for (CaptureParameters* target : targets) {
+            if (!applyCaptureParameter(*target, key, value, error)) {
+                return false;
+            }
+        }
+    }
+    cameras = overrides;
+    if (overrides.isEmpty() || selected == QList<int>{ -1 }) {
+        cameras.insert(-1, defaults);
+        for (const QString& camera : config.cameraModes.keys()) {
+            bool ok = false;
+            int cameraIndex = camera.toInt(&ok);
+            if (!ok || cameras.contains(cameraIndex)) {
+                continue;
+            }
+            CaptureParameters parameters;
+            if (!applyCameraMode(parameters, "default", error) || !applyCameraMode(parameters, camera, error)) {
+                return false;
+            }
+            for (const auto& argument : defaultArguments) {
+                if (!applyCaptureParameter(parameters, argument.first, argument.second, error)) {
+                    return false;
+                }
+            }
+            cameras.insert(cameraIndex, parameters);
+        }
+    }
+    for (const CaptureParameters& parameters : cameras) {
+        if ((parameters.audioCodec == "aac" && parameters.container == "avi") ||
+            (parameters.audioCodec == "pcm" && parameters.container == "mp4")) {
+            error = QString("%1 audio is not supported in %2 container").arg(parameters.audioCodec, parameters.container);
+            return false;
+        }
+    }
+    return true;
+}
+
+bool MediaController::resolveCameraIndex(const QString& selector, int& cameraIndex) const {
+    if (selector.startsWith("id:")) {
+        cameraIndex = service->deviceRegistry()->cameraIndexForId(selector.mid(3));
+        return cameraIndex >= 0;
+    }
+    bool ok = false;
+    cameraIndex = selector.toInt(&ok);
+    return ok && cameraIndex >= 0;
+}
+
+bool MediaController::parseCaptureRequest(const QString& spec, CaptureRequest& request) const {
+    QStringList fields = spec.split(':');
+    if (fields.size() > 1 && fields.first() == "id") {
+        fields[1].prepend("id:");
+        fields.removeFirst();
+    }
+    if (fields.size() < 2 || !resolveCameraIndex(fields.at(0), request.cameraIndex)) {
+        return false;
+    }
+    bool ok = false;
+    if (fields.at(1) == "photo" && fields.size() <= 3) {
+        request.video = false;
+        if (fields.size() > 2) {
+            request.jpegQuality = fields.at(2).toInt(&ok);
+            return ok && request.jpegQuality > 0 && request.jpegQuality <= 100;
+        }
+        return true;
+    }
+    if (fields.at(1) == "video" && fields.size() <= 4) {
+        request.video = true;
+        if (fields.size() > 2) {
+            request.durationSeconds = fields.at(2).toInt(&ok);
+            if (!ok || request.durationSeconds <= 0) {
+                return false;
+            }
+        }
+        if (fields.size() > 3) {
+            request.fps = fields.at(3).toInt(&ok);
+            if (!ok || request.fps <= 0) {
+                return false;
+            }
+        }
+        return true;
+    }
+    return false;
+}
+
+void MediaController::sendBatchResponse(ClientConnection* session, const QList<CaptureResult>& results) {
+    if (results.isEmpty()) {
+        sendTextResponse(session, "ERROR: Batch capture produced no files.");
+        return;
+    }
+    QVector<qint64> sizes;
+    qint64 archiveSize = tarTrailer().size();
+    for (const CaptureResult& result : results) {
+        qint64 size = result.filePath.isEmpty() ? result.data.size() : QFileInfo(result.filePath).size();
+        sizes.append(size);
+        archiveSize += tarEntrySize(size);
+    }
+    qint64 modified = QDateTime::currentSecsSinceEpoch();
+    QString archiveName = QString("batch_%1.tar").arg(QDateTime::currentDateTime().toString("yyyy-MM-dd_hh-mm-ss"));
+    session->write(QString("FILE:%1:%2\n").arg(archiveName).arg(archiveSize).toUtf8());
+    for (int i = 0; i < results.size(); ++i) {
+        const CaptureResult& result = results.at(i);
+        QByteArray header = tarEntryHeader(result.fileName, sizes.at(i), modified);
+        if (result.filePath.isEmpty()) {
+            session->write(header + result.data + tarEntryPadding(sizes.at(i)));
+        } else {
+            session->write(header);
+            session->writeFile(result.filePath, 0, sizes.at(i));
+            session->write(tarEntryPadding(sizes.at(i)));
+        }
+    }
+    session->write(tarTrailer());
+    qDebug() << "Batch archive queued for sending:" << archiveName;
+}
+
+void MediaController::sendTextResponse(ClientConnection* session, const QString& response) {
+    session->write(response.toUtf8());
+}
+
+void MediaController::sendFileResponse(ClientConnection* session, const QString& fileName, const QByteArray& fileData) {
+    TRACE_SCOPE("send_file_response");
     QString header = QString("FILE:%1:%2\n").arg(fileName).arg(fileData.size());
-    clientSocket->write(header.toUtf8());
-    clientSocket->write(fileData);
-    clientSocket->flush();
+    session->write(header.toUtf8() + fileData);
 }
 
-void MediaController::sendFileResponse(QTcpSocket* clientSocket, const QString& fileName, const QString& filePath) {
+void MediaController::sendFileResponse(ClientConnection* session, const QString& fileName, const QString& filePath) {
+    TRACE_SCOPE("send_file_response");
     QFile file(filePath);
     if (!file.open(QIODevice::ReadOnly)) {
-        sendTextResponse(clientSocket, "ERROR: Unable to open file: " + filePath);
+        sendTextResponse(session, "ERROR: Unable to open file: " + filePath);
         return;
     }
-    QByteArray fileData = file.readAll();
-    file.close();
-    QString header = QString("FILE:%1:%2\n").arg(fileName).arg(fileData.size());
-    clientSocket->write(header.toUtf8());
-    clientSocket->flush();
-    qint64 bytesSent = 0;
-    while (bytesSent < fileData.size()) {
-        qint64 chunkSize = clientSocket->write(fileData.mid(bytesSent));
-        if (chunkSize == -1) {
-            qWarning() << "Error writing file data to socket";
-            break;
-        }
-        bytesSent += chunkSize;
-        clientSocket->flush();
-    }
-    qDebug() << "File sent successfully: " << fileName;
+    qint64 committed = activeRecordingCommittedBytes(filePath);
+    qint64 fileSize = committed >= 0 ? committed : file.size();
+    QString header = QString("FILE:%1:%2\n").arg(fileName).arg(fileSize);
+    session->write(header.toUtf8());
+    session->writeFile(filePath, 0, fileSize);
+    qDebug() << "File queued for sending: " << fileName;
+}
+
+void MediaController::sendFileRangeResponse(ClientConnection* session, const QString& fileName, const QString& filePath,
+                                            qint64 offset, qint64 length, qint64 initLength) {
+    QFile file(filePath);
+    if (!file.open(QIODevice::ReadOnly)) {
+        sendTextResponse(session, "ERROR: Unable to open file: " + fileName);
+        return;
+    }
+    qint64 committed = activeRecordingCommittedBytes(filePath);
+    qint64 totalSize = committed >= 0 ? committed : file.size();
+    if (offset > totalSize || initLength > offset) {
+        sendTextResponse(session, QString("ERROR: Range not satisfiable: %1 has %2 bytes").arg(fileName).arg(totalSize));
+        return;
+    }
+    qint64 available = totalSize - offset;
+    if (length == 0 || length > available) {
+        length = available;
+    }
+    if (initLength > 0) {
+        QString header = QString("SEGMENT:%1:%2:%3:%4:%5\n")
+                             .arg(fileName).arg(initLength).arg(offset).arg(length).arg(totalSize);
+        session->write(header.toUtf8());
+        session->writeFile(filePath, 0, initLength);
+    } else {
+        QString header = QString("RANGE:%1:%2:%3:%4\n").arg(fileName).arg(offset).arg(length).arg(totalSize);
+        session->write(header.toUtf8());
+    }
+    session->writeFile(filePath, offset, length);
+    qDebug() << "File range queued for sending: " << fileName << offset << length;
+}
+
+qint64 MediaController::parseTimestampUs(const QString& value) const {
+    bool ok = false;
+    qint64 milliseconds = value.toLongLong(&ok);
+    if (ok) {
+        return milliseconds * 1000;
+    }
+    QDateTime dateTime = QDateTime::fromString(value, Qt::ISODateWithMs);
+    if (!dateTime.isValid()) {
+        return -1;
+    }
+    return dateTime.toMSecsSinceEpoch() * 1000;
+}
+
+QString MediaController::resolveFilePath(const QString& fileName) const {
+    if (fileName.isEmpty() || fileName != QFileInfo(fileName).fileName() || fileName == "..") {
+        return QString();
+    }
+    return locateRecording(fileName);
 }
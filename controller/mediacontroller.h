@@ -1,24 +1,58 @@
 #pragma once
 
+#include <QMap>
+#include <QSet>
+#include <QVector>
 #include <QObject>
-#include <QTcpSocket>
-#include "server/mediaserver.h"
+#include "server/commandserver.h"
+#include "server/clientconnection.h"
+#include "server/rtpsender.h"
 #include "service/mediaservice.h"
+#include "service/serviceconfig.h"
+
+class PreviewEncoder;
 
 class MediaController : public QObject {
     Q_OBJECT
 
 public:
-    explicit MediaController(MediaServer* server, MediaService* service, QObject* parent = nullptr);
+    explicit MediaController(CommandServer* server, MediaService* service, QObject* parent = nullptr);
+    ~MediaController();
 
 private slots:
-    void handleCommand(const QString& command, QTcpSocket* clientSocket);
+    void handleCommand(const QString& command, ClientConnection* session);
+    void onPreviewFrame(int cameraIndex, quint64 frameNumber, const cv::Mat& frame);
+    void stopPreview(ClientConnection* session);
+    void onSessionClosed(ClientConnection* session);
+    void onDeviceAdded(const CameraDevice& device);
+    void onDeviceRemoved(const CameraDevice& device);
+    bool stopRtp(int cameraIndex);
 
 private:
-    MediaServer* server;
+    CommandServer* server;
     MediaService* service;
+    QMap<ClientConnection*, int> previewSessions;
+    QMap<int, RtpJpegSender*> rtpSenders;
+    QMap<int, PreviewEncoder*> rtpEncoders;
+    QMap<int, QVector<PreviewEncoder*>> previewEncoders;
+    QVector<QVector<ClientConnection*>> frameTargets;
+    QSet<ClientConnection*> deviceSubscribers;
+    ServiceConfig config;
+    QString listenerState = "ok";
 
-    void sendTextResponse(QTcpSocket* clientSocket, const QString& response);
-    void sendFileResponse(QTcpSocket* clientSocket, const QString& fileName, const QByteArray& fileData);
-    void sendFileResponse(QTcpSocket* clientSocket, const QString& fileName, const QString& filePath);
+    PreviewEncoder* previewEncoder(int cameraIndex, int level);
+    void applyConfigChanges(const ServiceConfig& previous);
+    bool applyCameraMode(CaptureParameters& target, const QString& camera, QString& error) const;
+    bool parseCaptureParameters(const QStringList& args, QMap<int, CaptureParameters>& cameras, QString& error) const;
+    bool resolveCameraIndex(const QString& selector, int& cameraIndex) const;
+    bool parseCaptureRequest(const QString& spec, CaptureRequest& request) const;
+    void sendBatchResponse(ClientConnection* session, const QList<CaptureResult>& results);
+    QString deviceLine(const QString& event, const CameraDevice& device) const;
+    void sendTextResponse(ClientConnection* session, const QString& response);
+    void sendFileResponse(ClientConnection* session, const QString& fileName, const QByteArray& fileData);
+    void sendFileResponse(ClientConnection* session, const QString& fileName, const QString& filePath);
+    void sendFileRangeResponse(ClientConnection* session, const QString& fileName, const QString& filePath,
+                               qint64 offset, qint64 length, qint64 initLength = 0);
+    qint64 parseTimestampUs(const QString& value) const;
+    QString resolveFilePath(const QString& fileName) const;
 };
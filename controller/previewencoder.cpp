@@ -0,0 +1,123 @@
+#include <QDebug>
+
+#include "previewencoder.h"
+#include "service/livecapture.h"
+#include "service/pipelinescheduler.h"
+
+#include <cstring>
+#include <vector>
+
+static void fillFrameBuffer(QByteArray& buffer, const char* header, int headerSize, const std::vector<uchar>& jpeg) {
+    int size = headerSize + static_cast<int>(jpeg.size());
+    if (!buffer.isDetached()) {
+        buffer = QByteArray();
+    }
+    buffer.reserve(size);
+    buffer.resize(size);
+    if (headerSize > 0) {
+        memcpy(buffer.data(), header, headerSize);
+    }
+    memcpy(buffer.data() + headerSize, jpeg.data(), jpeg.size());
+}
+
+PreviewEncoder::PreviewEncoder(int cameraIndex, RtpJpegSender* rtpSender, QObject* parent)
+    : QThread(parent), deviceIndex(cameraIndex), sender(rtpSender) {
+}
+
+PreviewEncoder::~PreviewEncoder() {
+    stop();
+}
+
+void PreviewEncoder::submit(quint64 frameNumber, const cv::Mat& frame, const StreamQuality& quality,
+                            const QVector<ClientConnection*>& sessions) {
+    QMutexLocker locker(&mutex);
+    if (framePending) {
+        replacedFrames++;
+    }
+    pendingFrameNumber = frameNumber;
+    pendingFrame = frame;
+    pendingQuality = quality;
+    pendingSessions.resize(0);
+    for (ClientConnection* session : sessions) {
+        pendingSessions.append(session);
+    }
+    framePending = true;
+    frameReady.wakeOne();
+}
+
+void PreviewEncoder::removeSession(ClientConnection* session) {
+    QMutexLocker locker(&mutex);
+    pendingSessions.removeAll(session);
+    activeSessions.removeAll(session);
+}
+
+void PreviewEncoder::stop() {
+    {
+        QMutexLocker locker(&mutex);
+        stopRequested = true;
+        frameReady.wakeAll();
+    }
+    wait();
+    if (replacedFrames > 0) {
+        qDebug() << "Preview encoder for camera" << deviceIndex << "skipped" << replacedFrames
+                 << "frames that arrived while it was busy";
+        replacedFrames = 0;
+    }
+}
+
+void PreviewEncoder::run() {
+    PipelineThreadPlacement placement(PipelineStage::Encode, deviceIndex);
+    std::vector<uchar> jpeg;
+    QByteArray message;
+    cv::Mat frame;
+    while (true) {
+        quint64 frameNumber = 0;
+        StreamQuality quality;
+        {
+            QMutexLocker locker(&mutex);
+            while (!framePending && !stopRequested) {
+                frameReady.wait(&mutex);
+            }
+            if (stopRequested) {
+                break;
+            }
+            frameNumber = pendingFrameNumber;
+            frame = pendingFrame;
+            pendingFrame.release();
+            quality = pendingQuality;
+            activeSessions.swap(pendingSessions);
+            pendingSessions.resize(0);
+            framePending = false;
+        }
+        bool encoded = false;
+        {
+            PipelineStageTimer encodeTimer(PipelineStage::Encode, deviceIndex);
+            encoded = encodeJpegFrame(frame, quality.scale, quality.jpegQuality, jpeg);
+        }
+        frame.release();
+        if (encoded && sender) {
+            fillFrameBuffer(message, nullptr, 0, jpeg);
+            RtpJpegSender* rtpSender = sender;
+            QByteArray frameData = message;
+            QMetaObject::invokeMethod(rtpSender, [rtpSender, frameData]() {
+                rtpSender->sendJpegFrame(frameData);
+            }, Qt::QueuedConnection);
+        } else if (encoded) {
+            char header[64];
+            int headerSize = qsnprintf(header, sizeof(header), "FRAME:%d:%llu:%d\n", deviceIndex,
+                                       static_cast<unsigned long long>(frameNumber), static_cast<int>(jpeg.size()));
+            fillFrameBuffer(message, header, headerSize, jpeg);
+        }
+        QMutexLocker locker(&mutex);
+        if (encoded && !sender) {
+            for (ClientConnection* session : std::as_const(activeSessions)) {
+                session->write(message);
+            }
+        }
+        activeSessions.resize(0);
+    }
+    QMutexLocker locker(&mutex);
+    pendingFrame.release();
+    pendingSessions.resize(0);
+    activeSessions.resize(0);
+}
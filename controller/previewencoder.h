@@ -0,0 +1,41 @@
+#pragma once
+
+#include <QMutex>
+#include <QThread>
+#include <QVector>
+#include <QByteArray>
+#include <QWaitCondition>
+#include <opencv2/core.hpp>
+
+#include "server/clientconnection.h"
+#include "server/rtpsender.h"
+
+class PreviewEncoder : public QThread {
+    Q_OBJECT
+
+public:
+    explicit PreviewEncoder(int cameraIndex, RtpJpegSender* rtpSender = nullptr, QObject* parent = nullptr);
+    ~PreviewEncoder();
+
+    void submit(quint64 frameNumber, const cv::Mat& frame, const StreamQuality& quality,
+                const QVector<ClientConnection*>& sessions = QVector<ClientConnection*>());
+    void removeSession(ClientConnection* session);
+    void stop();
+
+protected:
+    void run() override;
+
+private:
+    int deviceIndex;
+    RtpJpegSender* sender;
+    QMutex mutex;
+    QWaitCondition frameReady;
+    bool stopRequested = false;
+    bool framePending = false;
+    quint64 pendingFrameNumber = 0;
+    cv::Mat pendingFrame;
+    StreamQuality pendingQuality = { 1.0, 90, 1 };
+    QVector<ClientConnection*> pendingSessions;
+    QVector<ClientConnection*> activeSessions;
+    int replacedFrames = 0;
+};
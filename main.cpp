@@ -1,9 +1,17 @@
 
+#include <QFile>
+#include <QThread>
 #include <QCoreApplication>
 
 #include "server/mediaserver.h"
+#ifdef Q_OS_LINUX
+#include "server/epollserver.h"
+#endif
 #include "controller/mediacontroller.h"
 #include "service/mediaservice.h"
+#include "service/pipelinescheduler.h"
+#include "service/serviceconfig.h"
+#include "service/storagemanager.h"
 
 #ifdef Q_OS_WIN
 #include <windows.h>
@@ -17,19 +25,72 @@ int main(int argc, char* argv[]) {
 
     QCoreApplication app(argc, argv);
 
-    QString usbIdsFilePath = "D:\\PROGRAMMING\\C++\\QT\\Camera-backend\\usb.ids";
-    if (!loadUsbIds(usbIdsFilePath)) {
-        qCritical() << "Could not load USB IDs.";
-        app.exit(EXIT_FAILURE);
+    QString configPath = QCoreApplication::applicationDirPath() + "/camera-backend.json";
+    bool explicitConfig = false;
+    for (const QString& argument : app.arguments()) {
+        if (argument.startsWith("--config=")) {
+            configPath = argument.mid(9);
+            explicitConfig = true;
+        }
+    }
+    if (explicitConfig || QFile::exists(configPath)) {
+        QString error;
+        if (!loadServiceConfig(configPath, error)) {
+            qCritical() << "Could not load config" << configPath << ":" << error;
+            if (explicitConfig) {
+                return 1;
+            }
+        }
+    }
+    for (const QString& argument : app.arguments()) {
+        ConfigApply apply;
+        QString error;
+        bool applied = true;
+        if (argument == "--epoll") {
+            applied = setServiceConfigValue("epoll", "true", apply, error);
+        } else if (argument.startsWith("--scratch=")) {
+            QStringList volumes = serviceConfig().scratchVolumes << argument.mid(10);
+            applied = setServiceConfigValue("scratch_volumes", volumes.join(','), apply, error);
+        } else if (argument.startsWith("--volume=")) {
+            QStringList volumes = serviceConfig().bulkVolumes << argument.mid(9);
+            applied = setServiceConfigValue("volumes", volumes.join(','), apply, error);
+        } else if (argument == "--no-affinity") {
+            applied = setServiceConfigValue("pipeline_affinity", "false", apply, error);
+        }
+        if (!applied) {
+            qWarning() << "Ignoring argument" << argument << ":" << error;
+        }
+    }
+    ServiceConfig config = serviceConfig();
+
+    CommandServer* server = nullptr;
+#ifdef Q_OS_LINUX
+    if (config.epoll) {
+        server = new EpollServer(&app);
+        server->setMaxConnections(4096);
     }
+#endif
+    if (!server) {
+        server = new MediaServer(&app);
+        server->setMaxConnections(256);
+    }
+    server->setIoThreadCount(config.ioThreads > 0 ? config.ioThreads : qMax(1, QThread::idealThreadCount() / 2));
+    if (config.maxConnections > 0) {
+        server->setMaxConnections(config.maxConnections);
+    }
+    server->setIdleTimeout(config.idleTimeoutMs);
+    setStorageVolumes(StorageTier::Scratch, config.scratchVolumes);
+    setStorageVolumes(StorageTier::Bulk, config.bulkVolumes);
+    setPipelineAffinityEnabled(config.pipelineAffinity);
 
-    MediaServer server;
     MediaService service;
-    MediaController controller(&server, &service);
+    MediaController controller(server, &service);
+
+    if (!server->start(config.listenAddress, config.port)) {
+        return 1;
+    }
 
-    QString address = "127.0.0.1";
-    quint16 port = 12345;
-    server.start(address, port);
+    service.initializeInBackground(serviceUsbIdsPath(config));
 
     qDebug() << "Server is running. Waiting for client connections...";
 
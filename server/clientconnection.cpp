@@ -0,0 +1,62 @@
+#include <QDebug>
+
+#include "clientconnection.h"
+
+static const int stableWindowsBeforeStepUp = 3;
+
+static const StreamQuality qualityLadder[] = {
+    { 1.0, 90, 1 },
+    { 0.75, 80, 1 },
+    { 0.5, 70, 2 },
+    { 0.5, 60, 3 },
+    { 0.25, 50, 6 },
+};
+
+ClientConnection::ClientConnection(QObject* parent)
+    : QObject(parent) {
+}
+
+int ClientConnection::qualityLevel() const {
+    return level;
+}
+
+const StreamQuality& ClientConnection::quality() const {
+    return qualityLadder[level];
+}
+
+qint64 ClientConnection::estimatedRate() const {
+    return rate;
+}
+
+int ClientConnection::qualityLevelCount() {
+    return static_cast<int>(sizeof(qualityLadder) / sizeof(qualityLadder[0]));
+}
+
+const StreamQuality& ClientConnection::qualityForLevel(int level) {
+    return qualityLadder[qBound(0, level, qualityLevelCount() - 1)];
+}
+
+void ClientConnection::updateLinkEstimate(qint64 backlog, qint64 drainedBytes, qint64 elapsedMs) {
+    if (elapsedMs <= 0) {
+        return;
+    }
+    rate = drainedBytes * 1000 / elapsedMs;
+    bool backlogGrowing = backlog > lastBacklog && backlog > frameBacklogLimit / 2;
+    int dropped = droppedFrames.exchange(0);
+    if (dropped > 0 || backlogGrowing) {
+        stableWindows = 0;
+        if (level < qualityLevelCount() - 1) {
+            level++;
+            qDebug() << "Client link congested, stepping down to quality level" << level.load()
+                     << "rate:" << rate.load() << "backlog:" << backlog;
+        }
+    } else if (backlog < frameBacklogLimit / 8) {
+        stableWindows++;
+        if (stableWindows >= stableWindowsBeforeStepUp && level > 0) {
+            stableWindows = 0;
+            level--;
+            qDebug() << "Client link recovered, stepping up to quality level" << level.load() << "rate:" << rate.load();
+        }
+    }
+    lastBacklog = backlog;
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <QObject>
+#include <QString>
+#include <QByteArray>
+#include <atomic>
+
+struct StreamQuality {
+    double scale;
+    int jpegQuality;
+    int frameDecimation;
+};
+
+class ClientConnection : public QObject {
+    Q_OBJECT
+
+public:
+    explicit ClientConnection(QObject* parent = nullptr);
+
+    virtual void write(const QByteArray& data) = 0;
+    virtual void writeFile(const QString& filePath, qint64 offset, qint64 length) = 0;
+    virtual void close() = 0;
+    virtual bool offerFrame() = 0;
+
+    int qualityLevel() const;
+    const StreamQuality& quality() const;
+    qint64 estimatedRate() const;
+
+    static int qualityLevelCount();
+    static const StreamQuality& qualityForLevel(int level);
+
+signals:
+    void commandReceived(const QString& command);
+    void closed();
+
+protected:
+    static const qint64 frameBacklogLimit = 256 * 1024;
+
+    void updateLinkEstimate(qint64 backlog, qint64 drainedBytes, qint64 elapsedMs);
+
+    std::atomic<int> droppedFrames { 0 };
+
+private:
+    std::atomic<int> level { 0 };
+    std::atomic<qint64> rate { 0 };
+    qint64 lastBacklog = 0;
+    int stableWindows = 0;
+};
@@ -0,0 +1,161 @@
+#include <QDebug>
+#include <QThread>
+
+#include "clientsession.h"
+#include "service/tracing.h"
+
+static const qint64 socketHighWaterMark = 512 * 1024;
+static const qint64 fileChunkSize = 64 * 1024;
+static const qint64 rateWindowMs = 1000;
+
+ClientSession::ClientSession(QTcpSocket* socket, int idleTimeoutMs, QObject* parent)
+    : ClientConnection(parent), clientSocket(socket), idleTimer(this), estimateTimer(this) {
+    clientSocket->setParent(this);
+    connect(clientSocket, &QTcpSocket::readyRead, this, &ClientSession::onReadyRead);
+    connect(clientSocket, &QTcpSocket::bytesWritten, this, &ClientSession::onBytesWritten);
+    connect(clientSocket, &QTcpSocket::disconnected, this, &ClientSession::onDisconnected);
+    if (idleTimeoutMs > 0) {
+        idleTimer.setSingleShot(true);
+        idleTimer.setInterval(idleTimeoutMs);
+        connect(&idleTimer, &QTimer::timeout, this, &ClientSession::onIdleTimeout);
+        idleTimer.start();
+    }
+    estimateTimer.setInterval(rateWindowMs);
+    connect(&estimateTimer, &QTimer::timeout, this, &ClientSession::onEstimateTimeout);
+    estimateTimer.start();
+    rateWindow.start();
+}
+
+void ClientSession::write(const QByteArray& data) {
+    if (!isOwnerThread()) {
+        writesPending = true;
+        QMetaObject::invokeMethod(this, [this, data]() { write(data); }, Qt::QueuedConnection);
+        return;
+    }
+    PendingWrite next;
+    next.data = data;
+    pending.enqueue(next);
+    pump();
+}
+
+void ClientSession::writeFile(const QString& filePath, qint64 offset, qint64 length) {
+    if (length <= 0) {
+        return;
+    }
+    if (!isOwnerThread()) {
+        writesPending = true;
+        QMetaObject::invokeMethod(this, [this, filePath, offset, length]() { writeFile(filePath, offset, length); },
+                                  Qt::QueuedConnection);
+        return;
+    }
+    PendingWrite next;
+    next.filePath = filePath;
+    next.offset = offset;
+    next.remaining = length;
+    pending.enqueue(next);
+    pump();
+}
+
+void ClientSession::close() {
+    if (!isOwnerThread()) {
+        QMetaObject::invokeMethod(this, [this]() { close(); }, Qt::QueuedConnection);
+        return;
+    }
+    clientSocket->disconnectFromHost();
+}
+
+bool ClientSession::offerFrame() {
+    if (writesPending || backlog > frameBacklogLimit) {
+        droppedFrames++;
+        return false;
+    }
+    return true;
+}
+
+void ClientSession::onReadyRead() {
+    if (idleTimer.interval() > 0) {
+        idleTimer.start();
+    }
+    QString command = QString::fromUtf8(clientSocket->readAll()).trimmed();
+    emit commandReceived(command);
+}
+
+void ClientSession::onBytesWritten(qint64 bytes) {
+    TRACE_SCOPE("session_bytes_written");
+    if (idleTimer.interval() > 0) {
+        idleTimer.start();
+    }
+    windowBytes += bytes;
+    pump();
+}
+
+void ClientSession::onDisconnected() {
+    idleTimer.stop();
+    estimateTimer.stop();
+    pending.clear();
+    currentFile.close();
+    emit closed();
+}
+
+void ClientSession::onIdleTimeout() {
+    if (!pending.isEmpty() || clientSocket->bytesToWrite() > 0) {
+        idleTimer.start();
+        return;
+    }
+    qDebug() << "Closing idle client connection.";
+    clientSocket->disconnectFromHost();
+}
+
+bool ClientSession::isOwnerThread() const {
+    return QThread::currentThread() == thread();
+}
+
+void ClientSession::pump() {
+    TRACE_SCOPE("session_pump");
+    while (!pending.isEmpty() && clientSocket->bytesToWrite() < socketHighWaterMark) {
+        PendingWrite& next = pending.head();
+        if (next.filePath.isEmpty()) {
+            clientSocket->write(next.data);
+            pending.dequeue();
+            continue;
+        }
+        if (!currentFile.isOpen()) {
+            currentFile.setFileName(next.filePath);
+            if (!currentFile.open(QIODevice::ReadOnly) || !currentFile.seek(next.offset)) {
+                qWarning() << "Failed to read file for client:" << next.filePath;
+                currentFile.close();
+                pending.clear();
+                clientSocket->disconnectFromHost();
+                return;
+            }
+        }
+        QByteArray chunk;
+        {
+            TRACE_SCOPE("session_file_read");
+            chunk = currentFile.read(qMin(fileChunkSize, next.remaining));
+        }
+        if (chunk.isEmpty()) {
+            qWarning() << "Error reading file data from" << next.filePath;
+            currentFile.close();
+            pending.clear();
+            clientSocket->disconnectFromHost();
+            return;
+        }
+        clientSocket->write(chunk);
+        next.remaining -= chunk.size();
+        if (next.remaining == 0) {
+            currentFile.close();
+            pending.dequeue();
+        }
+    }
+    backlog = clientSocket->bytesToWrite();
+    writesPending = !pending.isEmpty();
+}
+
+void ClientSession::onEstimateTimeout() {
+    qint64 currentBacklog = clientSocket->bytesToWrite();
+    backlog = currentBacklog;
+    updateLinkEstimate(currentBacklog, windowBytes, rateWindow.elapsed());
+    windowBytes = 0;
+    rateWindow.restart();
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <QFile>
+#include <QQueue>
+#include <QTimer>
+#include <QTcpSocket>
+#include <QElapsedTimer>
+#include <atomic>
+
+#include "clientconnection.h"
+
+class ClientSession : public ClientConnection {
+    Q_OBJECT
+
+public:
+    explicit ClientSession(QTcpSocket* socket, int idleTimeoutMs = 0, QObject* parent = nullptr);
+
+    void write(const QByteArray& data) override;
+    void writeFile(const QString& filePath, qint64 offset, qint64 length) override;
+    void close() override;
+    bool offerFrame() override;
+
+private slots:
+    void onReadyRead();
+    void onBytesWritten(qint64 bytes);
+    void onDisconnected();
+    void onIdleTimeout();
+    void onEstimateTimeout();
+
+private:
+    struct PendingWrite {
+        QByteArray data;
+        QString filePath;
+        qint64 offset = 0;
+        qint64 remaining = 0;
+    };
+
+    QTcpSocket* clientSocket;
+    QQueue<PendingWrite> pending;
+    QFile currentFile;
+    QTimer idleTimer;
+    QTimer estimateTimer;
+
+    QElapsedTimer rateWindow;
+    qint64 windowBytes = 0;
+    std::atomic<qint64> backlog { 0 };
+    std::atomic<bool> writesPending { false };
+
+    bool isOwnerThread() const;
+    void pump();
+};
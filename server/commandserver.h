@@ -0,0 +1,24 @@
+#pragma once
+
+#include <QObject>
+#include <QString>
+
+#include "clientconnection.h"
+
+class CommandServer : public QObject {
+    Q_OBJECT
+
+public:
+    explicit CommandServer(QObject* parent = nullptr) : QObject(parent) {}
+
+    virtual bool start(const QString& address, quint16 port) = 0;
+    virtual void stop() = 0;
+
+    virtual void setIoThreadCount(int count) { Q_UNUSED(count); }
+    virtual void setMaxConnections(int count) = 0;
+    virtual void setIdleTimeout(int milliseconds) { Q_UNUSED(milliseconds); }
+
+signals:
+    void commandReceived(const QString& command, ClientConnection* connection);
+    void sessionClosed(ClientConnection* connection);
+};
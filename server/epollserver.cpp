@@ -0,0 +1,540 @@
+#include <QFile>
+#include <QDebug>
+
+#include "epollserver.h"
+#include "service/pipelinescheduler.h"
+#include "service/tracing.h"
+
+#include <cerrno>
+#include <cctype>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/uio.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+
+static const int maxEpollEvents = 256;
+static const int maxIovecs = 64;
+static const qint64 blockSize = 64 * 1024;
+static const int blockCount = 256;
+
+EpollConnection::EpollConnection(EpollServer* server, int socketDescriptor)
+    : owner(server), descriptor(socketDescriptor) {
+    command.reserve(inputCapacity);
+}
+
+EpollConnection::~EpollConnection() {
+    {
+        QMutexLocker locker(&owner->wakeMutex);
+        owner->wakeList.removeAll(this);
+    }
+    QMutexLocker locker(&outboundMutex);
+    while (outboundCount > 0) {
+        popOutbound();
+    }
+}
+
+void EpollConnection::write(const QByteArray& data) {
+    if (data.isEmpty()) {
+        return;
+    }
+    OutboundSlice slice;
+    slice.data = data;
+    enqueue(slice, data.size());
+}
+
+void EpollConnection::writeFile(const QString& filePath, qint64 offset, qint64 length) {
+    if (length <= 0) {
+        return;
+    }
+    int fileDescriptor = ::open(QFile::encodeName(filePath).constData(), O_RDONLY | O_CLOEXEC);
+    if (fileDescriptor < 0) {
+        qWarning() << "Failed to read file for client:" << filePath;
+        close();
+        return;
+    }
+    OutboundSlice slice;
+    slice.fileDescriptor = fileDescriptor;
+    slice.fileOffset = offset;
+    slice.remaining = length;
+    if (!enqueue(slice, length)) {
+        ::close(fileDescriptor);
+    }
+}
+
+void EpollConnection::close() {
+    closing = true;
+    owner->wake(this);
+}
+
+bool EpollConnection::offerFrame() {
+    if (disconnected || queuedBytes > frameBacklogLimit) {
+        droppedFrames++;
+        return false;
+    }
+    return true;
+}
+
+bool EpollConnection::enqueue(const OutboundSlice& slice, qint64 bytes) {
+    if (disconnected) {
+        return false;
+    }
+    {
+        QMutexLocker locker(&outboundMutex);
+        if (disconnected) {
+            return false;
+        }
+        if (outboundCount == outboundCapacity) {
+            locker.unlock();
+            qWarning() << "Client outbound queue overflow, closing connection.";
+            close();
+            return false;
+        }
+        outbound[(outboundHead + outboundCount) % outboundCapacity] = slice;
+        outboundCount++;
+    }
+    queuedBytes += bytes;
+    owner->wake(this);
+    return true;
+}
+
+void EpollConnection::dispatchInput() {
+    int begin = 0;
+    int end = inputLength;
+    inputLength = 0;
+    while (begin < end && std::isspace(static_cast<uchar>(input[begin]))) {
+        begin++;
+    }
+    while (end > begin && std::isspace(static_cast<uchar>(input[end - 1]))) {
+        end--;
+    }
+    bool ascii = true;
+    for (int i = begin; i < end && ascii; ++i) {
+        ascii = static_cast<uchar>(input[i]) < 0x80;
+    }
+    if (ascii) {
+        command.resize(end - begin);
+        QChar* characters = command.data();
+        for (int i = begin; i < end; ++i) {
+            characters[i - begin] = QLatin1Char(input[i]);
+        }
+    } else {
+        command = QString::fromUtf8(input + begin, end - begin);
+    }
+    emit owner->commandReceived(command, this);
+}
+
+void EpollConnection::popOutbound() {
+    OutboundSlice& slice = outbound[outboundHead];
+    if (slice.fileDescriptor >= 0) {
+        ::close(slice.fileDescriptor);
+    }
+    slice = OutboundSlice();
+    outboundHead = (outboundHead + 1) % outboundCapacity;
+    outboundCount--;
+}
+
+EpollServer::EpollServer(QObject* parent)
+    : CommandServer(parent) {
+}
+
+EpollServer::~EpollServer() {
+    stop();
+}
+
+void EpollServer::setMaxConnections(int count) {
+    maxConnections = qMax(1, count);
+}
+
+bool EpollServer::start(const QString& address, quint16 port) {
+    if (running) {
+        return true;
+    }
+    sockaddr_in listenAddress = {};
+    listenAddress.sin_family = AF_INET;
+    listenAddress.sin_port = htons(port);
+    if (inet_pton(AF_INET, address.toLatin1().constData(), &listenAddress.sin_addr) != 1) {
+        qCritical() << "Invalid listen address:" << address;
+        return false;
+    }
+    listenDescriptor = ::socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    int reuse = 1;
+    if (listenDescriptor < 0 ||
+        ::setsockopt(listenDescriptor, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse)) < 0 ||
+        ::bind(listenDescriptor, reinterpret_cast<sockaddr*>(&listenAddress), sizeof(listenAddress)) < 0 ||
+        ::listen(listenDescriptor, SOMAXCONN) < 0) {
+        qCritical() << "Failed to start epoll server:" << strerror(errno);
+        closeDescriptors();
+        return false;
+    }
+    epollDescriptor = epoll_create1(EPOLL_CLOEXEC);
+    wakeDescriptor = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    timerDescriptor = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (epollDescriptor < 0 || wakeDescriptor < 0 || timerDescriptor < 0) {
+        qCritical() << "Failed to create epoll descriptors:" << strerror(errno);
+        closeDescriptors();
+        return false;
+    }
+    itimerspec interval = {};
+    interval.it_interval.tv_sec = 1;
+    interval.it_value.tv_sec = 1;
+    timerfd_settime(timerDescriptor, 0, &interval, nullptr);
+    int controlDescriptors[] = { listenDescriptor, wakeDescriptor, timerDescriptor };
+    for (int controlDescriptor : controlDescriptors) {
+        epoll_event event = {};
+        event.events = EPOLLIN | EPOLLET;
+        event.data.fd = controlDescriptor;
+        epoll_ctl(epollDescriptor, EPOLL_CTL_ADD, controlDescriptor, &event);
+    }
+    blockStorage.resize(blockSize * blockCount);
+    freeBlocks.clear();
+    freeBlocks.reserve(blockCount);
+    blockWaiters.clear();
+    blockWaiters.reserve(maxConnections);
+    for (int i = 0; i < blockCount; ++i) {
+        freeBlocks.append(blockStorage.data() + i * blockSize);
+    }
+    connections.reserve(maxConnections);
+    wakeList.reserve(maxConnections);
+    closedConnections.reserve(maxConnections);
+    estimateWindow.start();
+    running = true;
+    loopThread = std::thread(&EpollServer::run, this);
+    qDebug() << "The epoll server is running on the port" << port;
+    return true;
+}
+
+void EpollServer::stop() {
+    if (!running) {
+        return;
+    }
+    running = false;
+    quint64 signal = 1;
+    ::write(wakeDescriptor, &signal, sizeof(signal));
+    if (loopThread.joinable()) {
+        loopThread.join();
+    }
+    const QList<EpollConnection*> remaining = connections.values();
+    for (EpollConnection* connection : remaining) {
+        closeConnection(connection);
+    }
+    for (EpollConnection* connection : std::as_const(closedConnections)) {
+        emit sessionClosed(connection);
+        delete connection;
+    }
+    closedConnections.clear();
+    closeDescriptors();
+    qDebug() << "The epoll server has stopped.";
+}
+
+void EpollServer::run() {
+    PipelineThreadPlacement placement(PipelineStage::Network, -1);
+    epoll_event events[maxEpollEvents];
+    while (running) {
+        int count = epoll_wait(epollDescriptor, events, maxEpollEvents, -1);
+        if (count < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            qCritical() << "epoll_wait failed:" << strerror(errno);
+            break;
+        }
+        for (int i = 0; i < count && running; ++i) {
+            int eventDescriptor = events[i].data.fd;
+            if (eventDescriptor == listenDescriptor) {
+                acceptConnections();
+            } else if (eventDescriptor == wakeDescriptor) {
+                quint64 counter = 0;
+                while (::read(wakeDescriptor, &counter, sizeof(counter)) > 0) {
+                }
+                processWakeups();
+            } else if (eventDescriptor == timerDescriptor) {
+                quint64 expirations = 0;
+                while (::read(timerDescriptor, &expirations, sizeof(expirations)) > 0) {
+                }
+                updateEstimates();
+            } else {
+                EpollConnection* connection = connections.value(eventDescriptor, nullptr);
+                if (!connection || connection->closed) {
+                    continue;
+                }
+                if (events[i].events & EPOLLIN) {
+                    readConnection(connection);
+                }
+                if (!connection->closed && (events[i].events & EPOLLOUT)) {
+                    flushConnection(connection);
+                }
+                if (!connection->closed && (events[i].events & (EPOLLHUP | EPOLLERR | EPOLLRDHUP))) {
+                    closeConnection(connection);
+                }
+            }
+        }
+        resumeBlockWaiters();
+        publishClosedConnections();
+    }
+}
+
+void EpollServer::acceptConnections() {
+    while (true) {
+        int clientDescriptor = ::accept4(listenDescriptor, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (clientDescriptor < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+                qWarning() << "accept failed:" << strerror(errno);
+            }
+            if (errno == EINTR) {
+                continue;
+            }
+            return;
+        }
+        if (connections.size() >= maxConnections) {
+            static const char rejection[] = "ERROR: Too many connections.\n";
+            ::send(clientDescriptor, rejection, sizeof(rejection) - 1, MSG_NOSIGNAL);
+            ::close(clientDescriptor);
+            continue;
+        }
+        int noDelay = 1;
+        ::setsockopt(clientDescriptor, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+        EpollConnection* connection = new EpollConnection(this, clientDescriptor);
+        connection->moveToThread(thread());
+        epoll_event event = {};
+        event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+        event.data.fd = clientDescriptor;
+        if (epoll_ctl(epollDescriptor, EPOLL_CTL_ADD, clientDescriptor, &event) < 0) {
+            qWarning() << "Failed to register client socket:" << strerror(errno);
+            ::close(clientDescriptor);
+            connection->deleteLater();
+            continue;
+        }
+        connections.insert(clientDescriptor, connection);
+    }
+}
+
+void EpollServer::readConnection(EpollConnection* connection) {
+    while (true) {
+        ssize_t received = ::recv(connection->descriptor, connection->input + connection->inputLength,
+                                  EpollConnection::inputCapacity - connection->inputLength, 0);
+        bool endOfStream = received == 0 || (received < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR);
+        if (received > 0) {
+            connection->inputLength += static_cast<int>(received);
+            if (connection->inputLength < EpollConnection::inputCapacity) {
+                continue;
+            }
+        } else if (received < 0 && errno == EINTR) {
+            continue;
+        }
+        if (connection->inputLength > 0) {
+            connection->dispatchInput();
+        }
+        if (endOfStream) {
+            closeConnection(connection);
+            return;
+        }
+        if (received < 0) {
+            return;
+        }
+    }
+}
+
+void EpollServer::flushConnection(EpollConnection* connection) {
+    TRACE_SCOPE("socket_flush");
+    QMutexLocker locker(&connection->outboundMutex);
+    while (connection->outboundCount > 0) {
+        iovec iov[maxIovecs];
+        int iovCount = 0;
+        for (int i = 0; i < connection->outboundCount && iovCount < maxIovecs; ++i) {
+            EpollConnection::OutboundSlice& slice =
+                connection->outbound[(connection->outboundHead + i) % EpollConnection::outboundCapacity];
+            if (slice.fileDescriptor < 0) {
+                iov[iovCount].iov_base = const_cast<char*>(slice.data.constData()) + slice.sent;
+                iov[iovCount].iov_len = static_cast<size_t>(slice.data.size() - slice.sent);
+                iovCount++;
+                continue;
+            }
+            if (i == 0) {
+                if (connection->chunkSent == connection->chunkLength) {
+                    if (!connection->chunk) {
+                        connection->chunk = acquireBlock();
+                    }
+                    if (!connection->chunk) {
+                        if (!connection->waitingForBlock) {
+                            connection->waitingForBlock = true;
+                            blockWaiters.append(connection);
+                        }
+                        break;
+                    }
+                    ssize_t loaded = ::pread(slice.fileDescriptor, connection->chunk,
+                                             static_cast<size_t>(qMin(blockSize, slice.remaining)), slice.fileOffset);
+                    if (loaded <= 0) {
+                        qWarning() << "Error reading file data for client";
+                        locker.unlock();
+                        closeConnection(connection);
+                        return;
+                    }
+                    connection->chunkLength = loaded;
+                    connection->chunkSent = 0;
+                    slice.fileOffset += loaded;
+                }
+                iov[iovCount].iov_base = connection->chunk + connection->chunkSent;
+                iov[iovCount].iov_len = static_cast<size_t>(connection->chunkLength - connection->chunkSent);
+                iovCount++;
+            }
+            break;
+        }
+        if (iovCount == 0) {
+            return;
+        }
+        ssize_t written = ::writev(connection->descriptor, iov, iovCount);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                locker.unlock();
+                closeConnection(connection);
+            }
+            return;
+        }
+        connection->drainedBytes += written;
+        connection->queuedBytes -= written;
+        consumeOutbound(connection, written);
+    }
+}
+
+void EpollServer::consumeOutbound(EpollConnection* connection, qint64 written) {
+    while (written > 0 && connection->outboundCount > 0) {
+        EpollConnection::OutboundSlice& slice = connection->outbound[connection->outboundHead];
+        if (slice.fileDescriptor < 0) {
+            qint64 used = qMin(static_cast<qint64>(slice.data.size()) - slice.sent, written);
+            slice.sent += used;
+            written -= used;
+            if (slice.sent == slice.data.size()) {
+                connection->popOutbound();
+            }
+            continue;
+        }
+        qint64 used = qMin(connection->chunkLength - connection->chunkSent, written);
+        connection->chunkSent += used;
+        slice.remaining -= used;
+        written -= used;
+        if (slice.remaining == 0) {
+            connection->popOutbound();
+            connection->chunkLength = 0;
+            connection->chunkSent = 0;
+            releaseBlock(connection->chunk);
+            connection->chunk = nullptr;
+        }
+    }
+}
+
+void EpollServer::closeConnection(EpollConnection* connection) {
+    if (connection->closed) {
+        return;
+    }
+    connection->closed = true;
+    connection->disconnected = true;
+    epoll_ctl(epollDescriptor, EPOLL_CTL_DEL, connection->descriptor, nullptr);
+    ::close(connection->descriptor);
+    connections.remove(connection->descriptor);
+    if (connection->waitingForBlock) {
+        connection->waitingForBlock = false;
+        blockWaiters.removeOne(connection);
+    }
+    {
+        QMutexLocker locker(&connection->outboundMutex);
+        while (connection->outboundCount > 0) {
+            connection->popOutbound();
+        }
+        releaseBlock(connection->chunk);
+        connection->chunk = nullptr;
+    }
+    closedConnections.append(connection);
+}
+
+void EpollServer::publishClosedConnections() {
+    for (EpollConnection* connection : std::as_const(closedConnections)) {
+        QMetaObject::invokeMethod(this, [this, connection]() {
+            emit sessionClosed(connection);
+            connection->deleteLater();
+        }, Qt::QueuedConnection);
+    }
+    closedConnections.clear();
+}
+
+void EpollServer::processWakeups() {
+    QMutexLocker locker(&wakeMutex);
+    for (EpollConnection* connection : std::as_const(wakeList)) {
+        connection->pendingWake = false;
+        if (connection->closed) {
+            continue;
+        }
+        if (connection->closing) {
+            closeConnection(connection);
+        } else {
+            flushConnection(connection);
+        }
+    }
+    wakeList.clear();
+}
+
+void EpollServer::resumeBlockWaiters() {
+    while (!freeBlocks.isEmpty() && !blockWaiters.isEmpty()) {
+        EpollConnection* connection = blockWaiters.takeFirst();
+        connection->waitingForBlock = false;
+        flushConnection(connection);
+    }
+}
+
+void EpollServer::updateEstimates() {
+    qint64 elapsed = estimateWindow.restart();
+    for (EpollConnection* connection : std::as_const(connections)) {
+        connection->updateLinkEstimate(connection->queuedBytes, connection->drainedBytes, elapsed);
+        connection->drainedBytes = 0;
+    }
+    for (EpollConnection* connection : std::as_const(connections)) {
+        if (!connection->closed) {
+            flushConnection(connection);
+        }
+    }
+}
+
+void EpollServer::wake(EpollConnection* connection) {
+    {
+        QMutexLocker locker(&wakeMutex);
+        if (connection->pendingWake) {
+            return;
+        }
+        connection->pendingWake = true;
+        wakeList.append(connection);
+    }
+    quint64 signal = 1;
+    ::write(wakeDescriptor, &signal, sizeof(signal));
+}
+
+char* EpollServer::acquireBlock() {
+    if (freeBlocks.isEmpty()) {
+        return nullptr;
+    }
+    return freeBlocks.takeLast();
+}
+
+void EpollServer::releaseBlock(char* block) {
+    if (block) {
+        freeBlocks.append(block);
+    }
+}
+
+void EpollServer::closeDescriptors() {
+    int* descriptors[] = { &listenDescriptor, &epollDescriptor, &wakeDescriptor, &timerDescriptor };
+    for (int* descriptor : descriptors) {
+        if (*descriptor >= 0) {
+            ::close(*descriptor);
+            *descriptor = -1;
+        }
+    }
+}
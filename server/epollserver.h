@@ -0,0 +1,112 @@
+#pragma once
+
+#include <QHash>
+#include <QMutex>
+#include <QVector>
+#include <QString>
+#include <QElapsedTimer>
+#include <atomic>
+#include <thread>
+
+#include "commandserver.h"
+
+class EpollServer;
+
+class EpollConnection : public ClientConnection {
+    Q_OBJECT
+
+public:
+    EpollConnection(EpollServer* server, int socketDescriptor);
+    ~EpollConnection() override;
+
+    void write(const QByteArray& data) override;
+    void writeFile(const QString& filePath, qint64 offset, qint64 length) override;
+    void close() override;
+    bool offerFrame() override;
+
+private:
+    friend class EpollServer;
+
+    struct OutboundSlice {
+        QByteArray data;
+        qint64 sent = 0;
+        int fileDescriptor = -1;
+        qint64 fileOffset = 0;
+        qint64 remaining = 0;
+    };
+
+    static const int outboundCapacity = 256;
+    static const int inputCapacity = 4096;
+
+    EpollServer* owner;
+    int descriptor;
+    QMutex outboundMutex;
+    OutboundSlice outbound[outboundCapacity];
+    int outboundHead = 0;
+    int outboundCount = 0;
+    char* chunk = nullptr;
+    qint64 chunkLength = 0;
+    qint64 chunkSent = 0;
+    char input[inputCapacity];
+    int inputLength = 0;
+    QString command;
+    qint64 drainedBytes = 0;
+    bool pendingWake = false;
+    bool waitingForBlock = false;
+    bool closed = false;
+    std::atomic<qint64> queuedBytes { 0 };
+    std::atomic<bool> closing { false };
+    std::atomic<bool> disconnected { false };
+
+    bool enqueue(const OutboundSlice& slice, qint64 bytes);
+    void dispatchInput();
+    void popOutbound();
+};
+
+class EpollServer : public CommandServer {
+    Q_OBJECT
+
+public:
+    explicit EpollServer(QObject* parent = nullptr);
+    ~EpollServer() override;
+
+    void setMaxConnections(int count) override;
+
+    bool start(const QString& address, quint16 port) override;
+    void stop() override;
+
+private:
+    friend class EpollConnection;
+
+    int listenDescriptor = -1;
+    int epollDescriptor = -1;
+    int wakeDescriptor = -1;
+    int timerDescriptor = -1;
+    std::atomic<int> maxConnections { 1024 };
+    std::thread loopThread;
+    std::atomic<bool> running { false };
+
+    QHash<int, EpollConnection*> connections;
+    QVector<EpollConnection*> closedConnections;
+    QMutex wakeMutex;
+    QVector<EpollConnection*> wakeList;
+    QVector<char> blockStorage;
+    QVector<char*> freeBlocks;
+    QVector<EpollConnection*> blockWaiters;
+    QElapsedTimer estimateWindow;
+
+    void run();
+    void acceptConnections();
+    void readConnection(EpollConnection* connection);
+    void flushConnection(EpollConnection* connection);
+    void consumeOutbound(EpollConnection* connection, qint64 written);
+    void closeConnection(EpollConnection* connection);
+    void publishClosedConnections();
+    void processWakeups();
+    void resumeBlockWaiters();
+    void updateEstimates();
+    void wake(EpollConnection* connection);
+    char* acquireBlock();
+    void releaseBlock(char* block);
+    void closeDescriptors();
+};
@@ -1,62 +1,160 @@
-
 #include <QDebug>
 #include <QHostAddress>
 
 #include "mediaserver.h"
+#include "service/pipelinescheduler.h"
 
 MediaServer::MediaServer(QObject* parent)
-    : QObject(parent), tcpServer(new QTcpServer(this)) {
-    connect(tcpServer, &QTcpServer::newConnection, this, &MediaServer::onNewConnection);
+    : CommandServer(parent), tcpServer(new MediaTcpServer(this)) {
+    connect(tcpServer, &MediaTcpServer::connectionAccepted, this, &MediaServer::onConnectionAccepted);
 }
 
 MediaServer::~MediaServer() {
     stop();
 }
 
-void MediaServer::start(const QString& address, quint16 port) {
+void MediaServer::setIoThreadCount(int count) {
+    ioThreadCount = qMax(0, count);
+}
+
+void MediaServer::setMaxConnections(int count) {
+    maxConnections = qMax(0, count);
+}
+
+void MediaServer::setIdleTimeout(int milliseconds) {
+    idleTimeoutMs = qMax(0, milliseconds);
+}
+
+int MediaServer::connectionCount() const {
+    return sessions.size() + pendingConnections;
+}
+
+bool MediaServer::start(const QString& address, quint16 port) {
     QHostAddress hostAddress(address);
-    if (tcpServer->listen(hostAddress, port)) {
-        qDebug() << "The server is running on the port" << port;
-    } else {
+    startIoThreads();
+    if (!tcpServer->listen(hostAddress, port)) {
         qCritical() << "Failed to start server:" << tcpServer->errorString();
+        stopIoThreads();
+        return false;
     }
+    qDebug() << "The server is running on the port" << port << "with" << ioThreads.size() << "I/O threads";
+    return true;
 }
 
 void MediaServer::stop() {
     if (tcpServer->isListening()) {
         tcpServer->close();
     }
-    for (QTcpSocket* client : std::as_const(clients)) {
-        client->disconnectFromHost();
-        client->deleteLater();
+    const QList<ClientSession*> closing = sessions;
+    sessions.clear();
+    for (ClientSession* session : closing) {
+        emit sessionClosed(session);
+        session->close();
+        session->deleteLater();
     }
-    clients.clear();
+    stopIoThreads();
     qDebug() << "The server has stopped.";
 }
 
-void MediaServer::onNewConnection() {
-    QTcpSocket* clientSocket = tcpServer->nextPendingConnection();
-    clients.append(clientSocket);
-    connect(clientSocket, &QTcpSocket::readyRead, this, &MediaServer::onReadyRead);
-    connect(clientSocket, &QTcpSocket::disconnected, this, &MediaServer::onClientDisconnected);
-    qDebug() << "The new client has connected.";
+void MediaServer::onConnectionAccepted(qintptr socketDescriptor) {
+    if (maxConnections > 0 && connectionCount() >= maxConnections) {
+        qWarning() << "Connection limit reached, rejecting client.";
+        rejectConnection(socketDescriptor);
+        return;
+    }
+    if (ioContexts.isEmpty()) {
+        QTcpSocket* clientSocket = new QTcpSocket;
+        if (!clientSocket->setSocketDescriptor(socketDescriptor)) {
+            qWarning() << "Failed to accept client socket:" << clientSocket->errorString();
+            delete clientSocket;
+            return;
+        }
+        ClientSession* session = new ClientSession(clientSocket, idleTimeoutMs);
+        attachSession(session);
+        registerSession(session);
+        return;
+    }
+    QObject* context = ioContexts.at(nextIoThread);
+    nextIoThread = (nextIoThread + 1) % ioContexts.size();
+    pendingConnections++;
+    int timeout = idleTimeoutMs;
+    QMetaObject::invokeMethod(context, [this, socketDescriptor, timeout]() {
+        QTcpSocket* clientSocket = new QTcpSocket;
+        if (!clientSocket->setSocketDescriptor(socketDescriptor)) {
+            qWarning() << "Failed to accept client socket:" << clientSocket->errorString();
+            delete clientSocket;
+            QMetaObject::invokeMethod(this, [this]() { pendingConnections--; }, Qt::QueuedConnection);
+            return;
+        }
+        ClientSession* session = new ClientSession(clientSocket, timeout);
+        attachSession(session);
+        QMetaObject::invokeMethod(this, [this, session]() {
+            pendingConnections--;
+            registerSession(session);
+        }, Qt::QueuedConnection);
+    }, Qt::QueuedConnection);
 }
 
-void MediaServer::onReadyRead() {
-    QTcpSocket* clientSocket = qobject_cast<QTcpSocket*>(sender());
-    if (!clientSocket) {
-        qWarning() << "Invalid client socket.";
+void MediaServer::attachSession(ClientSession* session) {
+    connect(session, &ClientSession::commandReceived, this, [this, session](const QString& command) {
+        if (sessions.contains(session)) {
+            emit commandReceived(command, session);
+        }
+    });
+    connect(session, &ClientSession::closed, this, [this, session]() {
+        closeSession(session);
+    });
+}
+
+void MediaServer::registerSession(ClientSession* session) {
+    sessions.append(session);
+    qDebug() << "The new client has connected. Active connections:" << sessions.size();
+}
+
+void MediaServer::closeSession(ClientSession* session) {
+    if (sessions.removeAll(session) > 0) {
+        emit sessionClosed(session);
+        session->deleteLater();
+        qDebug() << "The client has disconnected.";
+    }
+}
+
+void MediaServer::rejectConnection(qintptr socketDescriptor) {
+    QTcpSocket* clientSocket = new QTcpSocket(this);
+    if (!clientSocket->setSocketDescriptor(socketDescriptor)) {
+        delete clientSocket;
         return;
     }
-    QString command = QString::fromUtf8(clientSocket->readAll()).trimmed();
-    emit commandReceived(command, clientSocket);
+    connect(clientSocket, &QTcpSocket::disconnected, clientSocket, &QObject::deleteLater);
+    clientSocket->write("ERROR: Too many connections.\n");
+    clientSocket->disconnectFromHost();
 }
 
-void MediaServer::onClientDisconnected() {
-    QTcpSocket* clientSocket = qobject_cast<QTcpSocket*>(sender());
-    if (clientSocket) {
-        clients.removeAll(clientSocket);
-        clientSocket->deleteLater();
-        qDebug() << "The client has disconnected.";
+void MediaServer::startIoThreads() {
+    if (!ioThreads.isEmpty()) {
+        return;
+    }
+    for (int i = 0; i < ioThreadCount; ++i) {
+        QThread* thread = new QThread(this);
+        QObject* context = new QObject;
+        context->moveToThread(thread);
+        connect(thread, &QThread::finished, context, &QObject::deleteLater);
+        thread->start();
+        QMetaObject::invokeMethod(context, []() {
+            static thread_local PipelineThreadPlacement placement(PipelineStage::Network, -1);
+        }, Qt::QueuedConnection);
+        ioThreads.append(thread);
+        ioContexts.append(context);
+    }
+}
+
+void MediaServer::stopIoThreads() {
+    for (QThread* thread : std::as_const(ioThreads)) {
+        thread->quit();
+        thread->wait();
+        delete thread;
     }
+    ioThreads.clear();
+    ioContexts.clear();
+    nextIoThread = 0;
 }
@@ -1,28 +1,48 @@
 #pragma once
 
+#include <QList>
 #include <QObject>
-#include <QTcpServer>
+#include <QThread>
 #include <QTcpSocket>
 
-class MediaServer : public QObject {
+#include "clientsession.h"
+#include "commandserver.h"
+#include "mediatcpserver.h"
+
+class MediaServer : public CommandServer {
     Q_OBJECT
 
 private:
-    QTcpServer* tcpServer;
-    QList<QTcpSocket*> clients;
+    MediaTcpServer* tcpServer;
+    QList<ClientSession*> sessions;
+    QList<QThread*> ioThreads;
+    QList<QObject*> ioContexts;
+    int ioThreadCount = 0;
+    int nextIoThread = 0;
+    int pendingConnections = 0;
+    int maxConnections = 0;
+    int idleTimeoutMs = 0;
 
 public:
     explicit MediaServer(QObject* parent = nullptr);
-    ~MediaServer();
+    ~MediaServer() override;
+
+    void setIoThreadCount(int count) override;
+    void setMaxConnections(int count) override;
+    void setIdleTimeout(int milliseconds) override;
+    int connectionCount() const;
 
-    void start(const QString& address, quint16 port);
-    void stop();
+    bool start(const QString& address, quint16 port) override;
+    void stop() override;
 
 private slots:
-    void onNewConnection();
-    void onReadyRead();
-    void onClientDisconnected();
+    void onConnectionAccepted(qintptr socketDescriptor);
 
-signals:
-    void commandReceived(const QString& command, QTcpSocket* clientSocket);
+private:
+    void attachSession(ClientSession* session);
+    void registerSession(ClientSession* session);
+    void closeSession(ClientSession* session);
+    void rejectConnection(qintptr socketDescriptor);
+    void startIoThreads();
+    void stopIoThreads();
 };
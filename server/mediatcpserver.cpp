@@ -0,0 +1,9 @@
+#include "mediatcpserver.h"
+
+MediaTcpServer::MediaTcpServer(QObject* parent)
+    : QTcpServer(parent) {
+}
+
+void MediaTcpServer::incomingConnection(qintptr socketDescriptor) {
+    emit connectionAccepted(socketDescriptor);
+}
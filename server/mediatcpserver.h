@@ -0,0 +1,16 @@
+#pragma once
+
+#include <QTcpServer>
+
+class MediaTcpServer : public QTcpServer {
+    Q_OBJECT
+
+public:
+    explicit MediaTcpServer(QObject* parent = nullptr);
+
+signals:
+    void connectionAccepted(qintptr socketDescriptor);
+
+protected:
+    void incomingConnection(qintptr socketDescriptor) override;
+};
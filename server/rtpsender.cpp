@@ -0,0 +1,183 @@
+#include <QDebug>
+#include <QRandomGenerator>
+
+#include "rtpsender.h"
+
+#include <cstring>
+
+static const int udpIpHeaderSize = 28;
+static const int rtpHeaderSize = 12;
+static const int jpegHeaderSize = 8;
+static const int quantizationHeaderSize = 4;
+static const int jpegPayloadType = 26;
+static const int dynamicQuantization = 255;
+
+static void writeBigEndian(uchar* out, quint32 value, int bytes) {
+    for (int i = bytes - 1; i >= 0; --i) {
+        out[i] = static_cast<uchar>(value & 0xFF);
+        value >>= 8;
+    }
+}
+
+RtpJpegSender::RtpJpegSender(const QHostAddress& address, quint16 port, int mtu, QObject* parent)
+    : QObject(parent), socket(this), destination(address), destinationPort(port),
+      maxPacketSize(qMax(256, mtu) - udpIpHeaderSize),
+      sequenceNumber(static_cast<quint16>(QRandomGenerator::global()->generate())),
+      ssrc(QRandomGenerator::global()->generate()) {
+    if (destination.isMulticast()) {
+        socket.bind(QHostAddress(destination.protocol() == QAbstractSocket::IPv6Protocol ? QHostAddress::AnyIPv6
+                                                                                         : QHostAddress::AnyIPv4));
+        socket.setSocketOption(QAbstractSocket::MulticastTtlOption, 1);
+        socket.setSocketOption(QAbstractSocket::MulticastLoopbackOption, 1);
+    }
+    packet.resize(maxPacketSize);
+    clock.start();
+}
+
+QHostAddress RtpJpegSender::address() const {
+    return destination;
+}
+
+quint16 RtpJpegSender::port() const {
+    return destinationPort;
+}
+
+int RtpJpegSender::mtu() const {
+    return maxPacketSize + udpIpHeaderSize;
+}
+
+bool RtpJpegSender::sendJpegFrame(const QByteArray& jpeg) {
+    JpegScan scan;
+    if (!parseJpeg(jpeg, scan)) {
+        qWarning() << "Unsupported JPEG frame for RTP payload.";
+        return false;
+    }
+
+    quint32 timestamp = static_cast<quint32>(clock.nsecsElapsed() / 1000 * 9 / 100);
+    int offset = 0;
+    while (offset < scan.size) {
+        uchar* out = reinterpret_cast<uchar*>(packet.data());
+        int headerSize = rtpHeaderSize + jpegHeaderSize;
+        if (offset == 0) {
+            headerSize += quantizationHeaderSize + scan.quantizationTables.size();
+        }
+        int chunk = qMin(scan.size - offset, maxPacketSize - headerSize);
+        bool lastPacket = offset + chunk == scan.size;
+
+        out[0] = 0x80;
+        out[1] = static_cast<uchar>(jpegPayloadType | (lastPacket ? 0x80 : 0));
+        writeBigEndian(out + 2, sequenceNumber, 2);
+        writeBigEndian(out + 4, timestamp, 4);
+        writeBigEndian(out + 8, ssrc, 4);
+
+        uchar* jpegHeader = out + rtpHeaderSize;
+        jpegHeader[0] = 0;
+        writeBigEndian(jpegHeader + 1, static_cast<quint32>(offset), 3);
+        jpegHeader[4] = scan.type;
+        jpegHeader[5] = dynamicQuantization;
+        jpegHeader[6] = static_cast<uchar>(scan.width / 8);
+        jpegHeader[7] = static_cast<uchar>(scan.height / 8);
+
+        uchar* payload = jpegHeader + jpegHeaderSize;
+        if (offset == 0) {
+            payload[0] = 0;
+            payload[1] = 0;
+            writeBigEndian(payload + 2, static_cast<quint32>(scan.quantizationTables.size()), 2);
+            memcpy(payload + quantizationHeaderSize, scan.quantizationTables.constData(), scan.quantizationTables.size());
+            payload += quantizationHeaderSize + scan.quantizationTables.size();
+        }
+        memcpy(payload, scan.data + offset, chunk);
+
+        if (socket.writeDatagram(packet.constData(), headerSize + chunk, destination, destinationPort) < 0) {
+            qWarning() << "Failed to send RTP packet:" << socket.errorString();
+            return false;
+        }
+        sequenceNumber++;
+        offset += chunk;
+    }
+    return true;
+}
+
+bool RtpJpegSender::parseJpeg(const QByteArray& jpeg, JpegScan& scan) const {
+    const uchar* data = reinterpret_cast<const uchar*>(jpeg.constData());
+    int size = jpeg.size();
+    if (size < 4 || data[0] != 0xFF || data[1] != 0xD8) {
+        return false;
+    }
+
+    QByteArray tables[2];
+    bool haveFrame = false;
+    int pos = 2;
+    while (pos + 4 <= size) {
+        if (data[pos] != 0xFF) {
+            return false;
+        }
+        uchar marker = data[pos + 1];
+        if (marker == 0xFF) {
+            pos++;
+            continue;
+        }
+        int segment = pos + 4;
+        int end = pos + 2 + ((data[pos + 2] << 8) | data[pos + 3]);
+        if (end > size || end < segment) {
+            return false;
+        }
+        switch (marker) {
+        case 0xDB:
+            for (int q = segment; q + 65 <= end; q += 65) {
+                if ((data[q] >> 4) != 0) {
+                    return false;
+                }
+                int table = data[q] & 0x0F;
+                if (table < 2) {
+                    tables[table] = QByteArray(reinterpret_cast<const char*>(data + q + 1), 64);
+                }
+            }
+            break;
+        case 0xC0:
+            if (end - segment < 15 || data[segment + 5] != 3) {
+                return false;
+            }
+            scan.height = (data[segment + 1] << 8) | data[segment + 2];
+            scan.width = (data[segment + 3] << 8) | data[segment + 4];
+            if (data[segment + 10] != 0x11 || data[segment + 13] != 0x11) {
+                return false;
+            }
+            if (data[segment + 7] == 0x21) {
+                scan.type = 0;
+            } else if (data[segment + 7] == 0x22) {
+                scan.type = 1;
+            } else {
+                return false;
+            }
+            if (scan.width > 2040 || scan.height > 2040 || scan.width % 8 != 0 || scan.height % 8 != 0) {
+                return false;
+            }
+            haveFrame = true;
+            break;
+        case 0xDD:
+            if (end - segment >= 2 && ((data[segment] << 8) | data[segment + 1]) != 0) {
+                return false;
+            }
+            break;
+        case 0xDA:
+            if (!haveFrame || tables[0].isEmpty() || tables[1].isEmpty()) {
+                return false;
+            }
+            scan.quantizationTables = tables[0] + tables[1];
+            scan.data = jpeg.constData() + end;
+            scan.size = size - end;
+            if (scan.size >= 2 && data[size - 2] == 0xFF && data[size - 1] == 0xD9) {
+                scan.size -= 2;
+            }
+            return scan.size > 0;
+        default:
+            if (marker >= 0xC1 && marker <= 0xCF && marker != 0xC4 && marker != 0xC8 && marker != 0xCC) {
+                return false;
+            }
+            break;
+        }
+        pos = end;
+    }
+    return false;
+}
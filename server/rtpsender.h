@@ -0,0 +1,41 @@
+#pragma once
+
+#include <QObject>
+#include <QByteArray>
+#include <QUdpSocket>
+#include <QHostAddress>
+#include <QElapsedTimer>
+
+class RtpJpegSender : public QObject {
+    Q_OBJECT
+
+public:
+    RtpJpegSender(const QHostAddress& address, quint16 port, int mtu = 1400, QObject* parent = nullptr);
+
+    QHostAddress address() const;
+    quint16 port() const;
+    int mtu() const;
+
+    bool sendJpegFrame(const QByteArray& jpeg);
+
+private:
+    struct JpegScan {
+        quint8 type = 0;
+        int width = 0;
+        int height = 0;
+        QByteArray quantizationTables;
+        const char* data = nullptr;
+        int size = 0;
+    };
+
+    QUdpSocket socket;
+    QHostAddress destination;
+    quint16 destinationPort;
+    int maxPacketSize;
+    quint16 sequenceNumber;
+    quint32 ssrc;
+    QElapsedTimer clock;
+    QByteArray packet;
+
+    bool parseJpeg(const QByteArray& jpeg, JpegScan& scan) const;
+};
@@ -0,0 +1,537 @@
+#include "blockwriter.h"
+#include "recordingregistry.h"
+
+#include <QDebug>
+#include <QFile>
+#include <QFileInfo>
+#include <QDir>
+#include <QMutex>
+#include <QThread>
+#include <QWaitCondition>
+#include <QElapsedTimer>
+#include <QMap>
+#include <QStorageInfo>
+#include <algorithm>
+#include <cstring>
+#include <limits>
+
+#ifdef Q_OS_WIN
+#include <windows.h>
+#else
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+static const int maxStorageStreams = 64;
+
+static QMutex storageStatsMutex;
+static QList<StorageStreamStats> storageStats;
+
+static void beginStorageStream(const QString& filePath, bool directIo) {
+    QMutexLocker locker(&storageStatsMutex);
+    for (int i = storageStats.size() - 1; i >= 0; --i) {
+        if (storageStats.at(i).filePath == filePath) {
+            storageStats.removeAt(i);
+        }
+    }
+    for (int i = 0; i < storageStats.size() && storageStats.size() >= maxStorageStreams;) {
+        if (storageStats.at(i).active) {
+            ++i;
+        } else {
+            storageStats.removeAt(i);
+        }
+    }
+    StorageStreamStats stats;
+    stats.filePath = filePath;
+    stats.directIo = directIo;
+    stats.active = true;
+    storageStats.append(stats);
+}
+
+static void recordStorageWrite(const QString& filePath, qint64 bytes, qint64 latencyUs) {
+    QMutexLocker locker(&storageStatsMutex);
+    for (StorageStreamStats& stats : storageStats) {
+        if (stats.filePath == filePath && stats.active) {
+            stats.bytesWritten += bytes;
+            stats.writeCount++;
+            stats.totalLatencyUs += latencyUs;
+            stats.maxLatencyUs = qMax(stats.maxLatencyUs, latencyUs);
+            return;
+        }
+    }
+}
+
+static void endStorageStream(const QString& filePath) {
+    QMutexLocker locker(&storageStatsMutex);
+    for (StorageStreamStats& stats : storageStats) {
+        if (stats.filePath == filePath) {
+            stats.active = false;
+        }
+    }
+}
+
+QList<StorageStreamStats> storageStreamStats() {
+    QMutexLocker locker(&storageStatsMutex);
+    return storageStats;
+}
+
+struct BlockWriteRequest {
+    BlockWriter* writer = nullptr;
+    qint64 offset = 0;
+    char* block = nullptr;
+    const char* data = nullptr;
+    qint64 length = 0;
+    qint64 commitEnd = -1;
+};
+
+struct BlockWriteQueue {
+    QMutex mutex;
+    QWaitCondition ready;
+    QWaitCondition done;
+    QList<BlockWriteRequest> requests;
+    QThread* thread = nullptr;
+    bool stopping = false;
+};
+
+static QMutex blockWriteQueuesMutex;
+static QMap<QByteArray, BlockWriteQueue*> blockWriteQueues;
+
+static void runBlockWriteQueue(BlockWriteQueue* queue) {
+    QMutexLocker locker(&queue->mutex);
+    while (true) {
+        while (queue->requests.isEmpty() && !queue->stopping) {
+            queue->ready.wait(&queue->mutex);
+        }
+        if (queue->requests.isEmpty()) {
+            return;
+        }
+        QList<BlockWriteRequest> batch;
+        batch.swap(queue->requests);
+        locker.unlock();
+        std::stable_sort(batch.begin(), batch.end(), [](const BlockWriteRequest& a, const BlockWriteRequest& b) {
+            return a.writer < b.writer;
+        });
+        for (const BlockWriteRequest& request : std::as_const(batch)) {
+            bool written = request.writer->writeBlock(request.offset, request.data, request.length, request.commitEnd);
+            locker.relock();
+            request.writer->completeBlock(request.block, written);
+            queue->done.wakeAll();
+            locker.unlock();
+        }
+        locker.relock();
+    }
+}
+
+static BlockWriteQueue* blockWriteQueueFor(const QString& filePath) {
+    QByteArray device = QStorageInfo(QFileInfo(filePath).absolutePath()).device();
+    QMutexLocker locker(&blockWriteQueuesMutex);
+    BlockWriteQueue* queue = blockWriteQueues.value(device);
+    if (!queue) {
+        queue = new BlockWriteQueue();
+        queue->thread = QThread::create(runBlockWriteQueue, queue);
+        queue->thread->setObjectName("BlockWriteQueue " + QString::fromLocal8Bit(device));
+        queue->thread->start(QThread::HighPriority);
+        blockWriteQueues.insert(device, queue);
+    }
+    return queue;
+}
+
+void stopBlockWriteQueues() {
+    QMutexLocker locker(&blockWriteQueuesMutex);
+    for (BlockWriteQueue* queue : std::as_const(blockWriteQueues)) {
+        {
+            QMutexLocker queueLocker(&queue->mutex);
+            queue->stopping = true;
+            queue->ready.wakeAll();
+        }
+        queue->thread->wait();
+        delete queue->thread;
+        delete queue;
+    }
+    blockWriteQueues.clear();
+}
+
+static qint64 alignUp(qint64 value, qint64 alignment) {
+    return (value + alignment - 1) / alignment * alignment;
+}
+
+static qint64 alignDown(qint64 value, qint64 alignment) {
+    return value - value % alignment;
+}
+
+BlockWriter::~BlockWriter() {
+    close();
+}
+
+bool BlockWriter::open(const QString& path, qint64 preallocateBytes, bool directIo, qint64 blockSize) {
+    close();
+    filePath = QFileInfo(path).absoluteFilePath();
+    direct = directIo;
+#ifdef Q_OS_WIN
+    DWORD flags = direct ? FILE_FLAG_NO_BUFFERING | FILE_FLAG_WRITE_THROUGH : FILE_FLAG_SEQUENTIAL_SCAN;
+    HANDLE file = CreateFileW(reinterpret_cast<const wchar_t*>(QDir::toNativeSeparators(filePath).utf16()),
+                              GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_DELETE, nullptr,
+                              CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL | flags, nullptr);
+    handle = file == INVALID_HANDLE_VALUE ? -1 : reinterpret_cast<qintptr>(file);
+#else
+    QByteArray nativePath = QFile::encodeName(filePath);
+    int openFlags = O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC;
+#ifdef Q_OS_LINUX
+    if (direct) {
+        handle = ::open(nativePath.constData(), openFlags | O_DIRECT, 0644);
+        if (handle < 0 && errno == EINVAL) {
+            qWarning() << "Direct I/O is not supported for" << filePath << "- using buffered writes.";
+            direct = false;
+        }
+    }
+#else
+    direct = false;
+#endif
+    if (!direct) {
+        handle = ::open(nativePath.constData(), openFlags, 0644);
+    }
+#endif
+    if (handle == -1) {
+        qWarning() << "Failed to open block writer output" << filePath;
+        return false;
+    }
+    capacity = alignUp(qMax(blockSize, alignment), alignment);
+    buffer = static_cast<char*>(qMallocAligned(static_cast<size_t>(capacity), static_cast<size_t>(alignment)));
+    if (!buffer) {
+        qWarning() << "Failed to allocate block writer buffer for" << filePath;
+        closeHandle();
+        return false;
+    }
+    bufferCount = 1;
+    queue = blockWriteQueueFor(filePath);
+    windowStart = 0;
+    windowLength = 0;
+    submittedLength = 0;
+    writePosition = 0;
+    fileSize = 0;
+    allocatedBytes = 0;
+    dirty = false;
+    pendingWrites = 0;
+    writeFailed = false;
+    if (preallocateBytes > 0) {
+        reserve(preallocateBytes);
+    }
+    beginStorageStream(filePath, direct);
+    return true;
+}
+
+bool BlockWriter::write(const char* data, qint64 length) {
+    if (handle == -1) {
+        return false;
+    }
+    while (length > 0) {
+        qint64 offset = writePosition - windowStart;
+        if (offset < 0 || offset > windowLength || offset >= capacity) {
+            if (!moveWindow(writePosition)) {
+                return false;
+            }
+            offset = writePosition - windowStart;
+        }
+        qint64 chunk = qMin(length, capacity - offset);
+        memcpy(buffer + offset, data, static_cast<size_t>(chunk));
+        submittedLength = qMin(submittedLength, offset);
+        data += chunk;
+        length -= chunk;
+        writePosition += chunk;
+        windowLength = qMax(windowLength, offset + chunk);
+        fileSize = qMax(fileSize, writePosition);
+        dirty = true;
+        if (offset + chunk == capacity && !submitWindow()) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool BlockWriter::seek(qint64 offset) {
+    if (handle == -1 || offset < 0) {
+        return false;
+    }
+    writePosition = offset;
+    return true;
+}
+
+bool BlockWriter::flush() {
+    return handle != -1 && submitPartialWindow(fileSize);
+}
+
+bool BlockWriter::close() {
+    if (handle == -1) {
+        return true;
+    }
+    bool result = flushWindow();
+    if (!truncate(fileSize)) {
+        qWarning() << "Failed to trim preallocated space of" << filePath;
+        result = false;
+    }
+    closeHandle();
+    qFreeAligned(buffer);
+    buffer = nullptr;
+    for (char* spare : std::as_const(freeBuffers)) {
+        qFreeAligned(spare);
+    }
+    freeBuffers.clear();
+    bufferCount = 0;
+    endStorageStream(filePath);
+    return result;
+}
+
+qint64 BlockWriter::position() const {
+    return writePosition;
+}
+
+qint64 BlockWriter::size() const {
+    return fileSize;
+}
+
+bool BlockWriter::moveWindow(qint64 offset) {
+    if (!flushWindow()) {
+        return false;
+    }
+    windowStart = alignDown(offset, alignment);
+    windowLength = 0;
+    if (windowStart < fileSize) {
+        qint64 wanted = qMin(capacity, fileSize - windowStart);
+        qint64 received = readAt(windowStart, buffer, direct ? alignUp(wanted, alignment) : wanted);
+        if (received < wanted) {
+            qWarning() << "Failed to read back block of" << filePath << "at" << windowStart;
+            return false;
+        }
+        windowLength = wanted;
+    }
+    submittedLength = windowLength;
+    if (offset - windowStart > windowLength) {
+        memset(buffer + windowLength, 0, static_cast<size_t>(offset - windowStart - windowLength));
+        windowLength = offset - windowStart;
+    }
+    return true;
+}
+
+char* BlockWriter::acquireBuffer() {
+    {
+        QMutexLocker locker(&queue->mutex);
+        while (freeBuffers.isEmpty() && bufferCount >= maxBuffers && !writeFailed) {
+            queue->done.wait(&queue->mutex);
+        }
+        if (writeFailed) {
+            return nullptr;
+        }
+        if (!freeBuffers.isEmpty()) {
+            return freeBuffers.takeLast();
+        }
+    }
+    char* next = static_cast<char*>(qMallocAligned(static_cast<size_t>(capacity), static_cast<size_t>(alignment)));
+    if (!next) {
+        qWarning() << "Failed to allocate block writer buffer for" << filePath;
+        return nullptr;
+    }
+    bufferCount++;
+    return next;
+}
+
+bool BlockWriter::submitBlock(char* block, qint64 offset, qint64 length, qint64 commitEnd) {
+    BlockWriteRequest request;
+    request.writer = this;
+    request.offset = windowStart + offset;
+    request.block = block;
+    request.data = block ? block + offset : nullptr;
+    request.length = length;
+    request.commitEnd = commitEnd;
+    QMutexLocker locker(&queue->mutex);
+    pendingWrites++;
+    queue->requests.append(request);
+    queue->ready.wakeOne();
+    return !writeFailed;
+}
+
+bool BlockWriter::submitWindow() {
+    reserve(windowStart + capacity);
+    char* next = acquireBuffer();
+    if (!next) {
+        return false;
+    }
+    qint64 start = alignDown(submittedLength, alignment);
+    bool submitted = submitBlock(buffer, start, capacity - start, -1);
+    buffer = next;
+    windowStart += capacity;
+    windowLength = 0;
+    submittedLength = 0;
+    dirty = false;
+    return submitted;
+}
+
+bool BlockWriter::submitPartialWindow(qint64 commitEnd) {
+    if (!dirty) {
+        return commitEnd < 0 || submitBlock(nullptr, windowLength, 0, commitEnd);
+    }
+    char* copy = acquireBuffer();
+    if (!copy) {
+        return false;
+    }
+    qint64 start = alignDown(submittedLength, alignment);
+    qint64 end = direct ? alignUp(windowLength, alignment) : windowLength;
+    memcpy(copy + start, buffer + start, static_cast<size_t>(windowLength - start));
+    memset(copy + windowLength, 0, static_cast<size_t>(end - windowLength));
+    reserve(windowStart + end);
+    submittedLength = windowLength;
+    dirty = false;
+    return submitBlock(copy, start, end - start, commitEnd);
+}
+
+bool BlockWriter::waitForWrites() {
+    QMutexLocker locker(&queue->mutex);
+    while (pendingWrites > 0) {
+        queue->done.wait(&queue->mutex);
+    }
+    return !writeFailed;
+}
+
+bool BlockWriter::writeBlock(qint64 offset, const char* data, qint64 length, qint64 commitEnd) {
+    if (length > 0) {
+        QElapsedTimer timer;
+        timer.start();
+        bool written = writeAt(offset, data, length);
+        recordStorageWrite(filePath, length, timer.nsecsElapsed() / 1000);
+        if (!written) {
+            qWarning() << "Failed to write block of" << filePath << "at" << offset;
+            return false;
+        }
+    }
+    if (commitEnd >= 0) {
+        updateActiveRecording(filePath, commitEnd);
+    }
+    return true;
+}
+
+void BlockWriter::completeBlock(char* block, bool written) {
+    if (block) {
+        freeBuffers.append(block);
+    }
+    pendingWrites--;
+    writeFailed = writeFailed || !written;
+}
+
+bool BlockWriter::flushWindow() {
+    bool submitted = submitPartialWindow(-1);
+    return waitForWrites() && submitted;
+}
+
+bool BlockWriter::reserve(qint64 bytes) {
+    if (bytes <= allocatedBytes) {
+        return true;
+    }
+    qint64 target = qMax(bytes, allocatedBytes + allocationStep);
+#ifdef Q_OS_WIN
+    FILE_ALLOCATION_INFO info = {};
+    info.AllocationSize.QuadPart = target;
+    bool reserved = SetFileInformationByHandle(reinterpret_cast<HANDLE>(handle), FileAllocationInfo,
+                                               &info, sizeof(info));
+#elif defined(Q_OS_LINUX)
+    bool reserved = ::fallocate(static_cast<int>(handle), FALLOC_FL_KEEP_SIZE, allocatedBytes,
+                                target - allocatedBytes) == 0;
+#else
+    bool reserved = false;
+#endif
+    if (!reserved) {
+        qWarning() << "Failed to preallocate" << target << "bytes for" << filePath;
+        allocatedBytes = std::numeric_limits<qint64>::max();
+        return false;
+    }
+    allocatedBytes = target;
+    return true;
+}
+
+bool BlockWriter::writeAt(qint64 offset, const char* data, qint64 length) {
+#ifdef Q_OS_WIN
+    while (length > 0) {
+        OVERLAPPED overlapped = {};
+        overlapped.Offset = static_cast<DWORD>(offset & 0xFFFFFFFF);
+        overlapped.OffsetHigh = static_cast<DWORD>(offset >> 32);
+        DWORD written = 0;
+        DWORD chunk = static_cast<DWORD>(qMin<qint64>(length, 1 << 30));
+        if (!WriteFile(reinterpret_cast<HANDLE>(handle), data, chunk, &written, &overlapped) || written == 0) {
+            return false;
+        }
+        offset += written;
+        data += written;
+        length -= written;
+    }
+    return true;
+#else
+    qint64 start = offset;
+    qint64 total = length;
+    while (length > 0) {
+        ssize_t written = ::pwrite(static_cast<int>(handle), data, static_cast<size_t>(length), offset);
+        if (written < 0 && errno == EINTR) {
+            continue;
+        }
+        if (written <= 0) {
+            return false;
+        }
+        offset += written;
+        data += written;
+        length -= written;
+    }
+#ifdef Q_OS_LINUX
+    if (!direct) {
+        ::sync_file_range(static_cast<int>(handle), start, total, SYNC_FILE_RANGE_WRITE);
+    }
+#else
+    Q_UNUSED(start);
+    Q_UNUSED(total);
+#endif
+    return true;
+#endif
+}
+
+qint64 BlockWriter::readAt(qint64 offset, char* data, qint64 length) {
+    qint64 received = 0;
+    while (received < length) {
+#ifdef Q_OS_WIN
+        OVERLAPPED overlapped = {};
+        overlapped.Offset = static_cast<DWORD>((offset + received) & 0xFFFFFFFF);
+        overlapped.OffsetHigh = static_cast<DWORD>((offset + received) >> 32);
+        DWORD count = 0;
+        if (!ReadFile(reinterpret_cast<HANDLE>(handle), data + received,
+                      static_cast<DWORD>(length - received), &count, &overlapped)) {
+            break;
+        }
+#else
+        ssize_t count = ::pread(static_cast<int>(handle), data + received,
+                                static_cast<size_t>(length - received), offset + received);
+        if (count < 0 && errno == EINTR) {
+            continue;
+        }
+#endif
+        if (count <= 0) {
+            break;
+        }
+        received += count;
+    }
+    return received;
+}
+
+bool BlockWriter::truncate(qint64 length) {
+#ifdef Q_OS_WIN
+    FILE_END_OF_FILE_INFO info = {};
+    info.EndOfFile.QuadPart = length;
+    return SetFileInformationByHandle(reinterpret_cast<HANDLE>(handle), FileEndOfFileInfo, &info, sizeof(info));
+#else
+    return ::ftruncate(static_cast<int>(handle), length) == 0;
+#endif
+}
+
+void BlockWriter::closeHandle() {
+#ifdef Q_OS_WIN
+    CloseHandle(reinterpret_cast<HANDLE>(handle));
+#else
+    ::close(static_cast<int>(handle));
+#endif
+    handle = -1;
+}
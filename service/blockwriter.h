@@ -0,0 +1,74 @@
+#pragma once
+
+#include <QList>
+#include <QString>
+#include <QVector>
+
+struct StorageStreamStats {
+    QString filePath;
+    bool directIo = false;
+    bool active = false;
+    qint64 bytesWritten = 0;
+    qint64 writeCount = 0;
+    qint64 totalLatencyUs = 0;
+    qint64 maxLatencyUs = 0;
+};
+
+QList<StorageStreamStats> storageStreamStats();
+void stopBlockWriteQueues();
+
+struct BlockWriteQueue;
+
+class BlockWriter {
+public:
+    BlockWriter() = default;
+    ~BlockWriter();
+
+    bool open(const QString& path, qint64 preallocateBytes, bool directIo, qint64 blockSize = 1 << 20);
+    bool write(const char* data, qint64 length);
+    bool seek(qint64 offset);
+    bool flush();
+    bool close();
+
+    qint64 position() const;
+    qint64 size() const;
+
+    bool writeBlock(qint64 offset, const char* data, qint64 length, qint64 commitEnd);
+    void completeBlock(char* block, bool written);
+
+private:
+    static const qint64 alignment = 4096;
+    static const qint64 allocationStep = 64 << 20;
+    static const int maxBuffers = 4;
+
+    qintptr handle = -1;
+    QString filePath;
+    BlockWriteQueue* queue = nullptr;
+    bool direct = false;
+    char* buffer = nullptr;
+    qint64 capacity = 0;
+    qint64 windowStart = 0;
+    qint64 windowLength = 0;
+    qint64 submittedLength = 0;
+    qint64 writePosition = 0;
+    qint64 fileSize = 0;
+    qint64 allocatedBytes = 0;
+    bool dirty = false;
+    QVector<char*> freeBuffers;
+    int bufferCount = 0;
+    int pendingWrites = 0;
+    bool writeFailed = false;
+
+    bool moveWindow(qint64 offset);
+    char* acquireBuffer();
+    bool submitBlock(char* block, qint64 offset, qint64 length, qint64 commitEnd);
+    bool submitWindow();
+    bool submitPartialWindow(qint64 commitEnd);
+    bool waitForWrites();
+    bool flushWindow();
+    bool reserve(qint64 bytes);
+    bool writeAt(qint64 offset, const char* data, qint64 length);
+    qint64 readAt(qint64 offset, char* data, qint64 length);
+    bool truncate(qint64 length);
+    void closeHandle();
+};
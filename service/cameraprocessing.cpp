@@ -1,16 +1,30 @@
 
 #include <QDir>
 #include <QFile>
+#include <QFileInfo>
 #include <QDebug>
+#include <QMutex>
+#include <QVector>
+#include <QWaitCondition>
 #include <QImage>
+#include <QJsonArray>
+#include <QJsonObject>
+#include <QJsonDocument>
 #include <QThread>
 #include <QCoreApplication>
 #include <QRegularExpression>
 
 #include "cameraprocessing.h"
+#include "pcmring.h"
+#include "recordingindex.h"
+#include "storagemanager.h"
+#include "pipelinescheduler.h"
+#include "framesync.h"
+#include "tracing.h"
+#include "serviceconfig.h"
+#include "usbids.h"
 
-QMap<QString, QString> vendorMap;
-QMap<QPair<QString, QString>, QString> deviceMap;
+#include <atomic>
 
 QString getCurrentTimestamp() {
     return QDateTime::currentDateTime().toString("yyyy-MM-dd_hh-mm-ss");
@@ -179,6 +193,18 @@ QString getVendorID(IMFActivate* device) {
     return QString();
 }
 
+QString getStableDeviceID(IMFActivate* device) {
+    QString deviceString = getDeviceSymbolicLink(device);
+    QStringList parts = deviceString.split('#');
+    QString instance = parts.size() > 2 ? parts.at(2).toLower() : deviceString.toLower();
+    QString vendorID = getVendorID(device);
+    QString deviceID = getDeviceID(device);
+    if (vendorID.isEmpty() || deviceID.isEmpty()) {
+        return instance;
+    }
+    return QString("%1-%2-%3").arg(vendorID.toUpper(), deviceID.toUpper(), instance);
+}
+
 QList<QString> getAvailableVideoCodecs(IMFActivate* videoDevice) {
     QList<QString> codecsList;
     if (!videoDevice) {
@@ -430,7 +456,150 @@ bool configureSourceReaderAudioFormat(IMFSourceReader* sourceReader,
     return true;
 }
 
-IMFSinkWriter* createSinkWriter(const QString& outputPath) {
+bool configureSourceReaderVideoMode(IMFSourceReader* sourceReader, const VideoMode& mode) {
+    if (!sourceReader) {
+        qCritical() << "Source reader is null.";
+        return false;
+    }
+    IMFMediaType* mediaType = nullptr;
+    HRESULT status = sourceReader->GetNativeMediaType(
+        (DWORD)MF_SOURCE_READER_FIRST_VIDEO_STREAM, mode.mediaTypeIndex, &mediaType);
+    if (FAILED(status)) {
+        qCritical() << "Failed to get native media type" << mode.mediaTypeIndex;
+        return false;
+    }
+    status = sourceReader->SetCurrentMediaType(
+        MF_SOURCE_READER_FIRST_VIDEO_STREAM, nullptr, mediaType);
+    mediaType->Release();
+    if (FAILED(status)) {
+        qCritical() << "Failed to set native media type for source reader:" << describeVideoMode(mode);
+        return false;
+    }
+    return true;
+}
+
+bool getNativeAudioFormat(IMFSourceReader* sourceReader, UINT32& sampleRate, UINT32& channels, UINT32& bitsPerSample) {
+    if (!sourceReader) {
+        return false;
+    }
+    DWORD mediaTypeIndex = 0;
+    IMFMediaType* mediaType = nullptr;
+    while (SUCCEEDED(sourceReader->GetNativeMediaType(
+        (DWORD)MF_SOURCE_READER_FIRST_AUDIO_STREAM, mediaTypeIndex, &mediaType))) {
+        GUID subtype = GUID_NULL;
+        mediaType->GetGUID(MF_MT_SUBTYPE, &subtype);
+        UINT32 nativeRate = MFGetAttributeUINT32(mediaType, MF_MT_AUDIO_SAMPLES_PER_SECOND, 0);
+        UINT32 nativeChannels = MFGetAttributeUINT32(mediaType, MF_MT_AUDIO_NUM_CHANNELS, 0);
+        mediaType->Release();
+        if (nativeRate > 0 && nativeChannels > 0) {
+            sampleRate = nativeRate;
+            channels = qMin<UINT32>(nativeChannels, 2);
+            bitsPerSample = 16;
+            return true;
+        }
+        mediaTypeIndex++;
+    }
+    return false;
+}
+
+QList<VideoMode> enumerateVideoModes(IMFSourceReader* sourceReader) {
+    QList<VideoMode> modes;
+    if (!sourceReader) {
+        return modes;
+    }
+    DWORD mediaTypeIndex = 0;
+    IMFMediaType* mediaType = nullptr;
+    while (SUCCEEDED(sourceReader->GetNativeMediaType(
+        (DWORD)MF_SOURCE_READER_FIRST_VIDEO_STREAM, mediaTypeIndex, &mediaType))) {
+        VideoMode mode;
+        mode.mediaTypeIndex = mediaTypeIndex;
+        mediaType->GetGUID(MF_MT_SUBTYPE, &mode.subtype);
+        MFGetAttributeSize(mediaType, MF_MT_FRAME_SIZE, &mode.width, &mode.height);
+        MFGetAttributeRatio(mediaType, MF_MT_FRAME_RATE, &mode.fpsNumerator, &mode.fpsDenominator);
+        if (mode.fpsDenominator == 0) {
+            mode.fpsDenominator = 1;
+        }
+        modes.append(mode);
+        mediaType->Release();
+        mediaTypeIndex++;
+    }
+    return modes;
+}
+
+UINT32 videoModeFps(const VideoMode& mode) {
+    return static_cast<UINT32>(qRound(static_cast<double>(mode.fpsNumerator) / mode.fpsDenominator));
+}
+
+QString describeVideoMode(const VideoMode& mode) {
+    return QString("%1 %2x%3@%4").arg(getCodecName(mode.subtype)).arg(mode.width).arg(mode.height).arg(videoModeFps(mode));
+}
+
+static bool isRecordableSubtype(const GUID& subtype, const QString& container) {
+    if (container == "mp4") {
+        return subtype == MFVideoFormat_NV12 || subtype == MFVideoFormat_YUY2 || subtype == MFVideoFormat_I420;
+    }
+    return subtype == MFVideoFormat_MJPG || subtype == MFVideoFormat_NV12 || subtype == MFVideoFormat_YUY2;
+}
+
+static int subtypePreference(const GUID& subtype) {
+    if (subtype == MFVideoFormat_MJPG) return 3;
+    if (subtype == MFVideoFormat_NV12) return 2;
+    if (subtype == MFVideoFormat_YUY2) return 1;
+    return 0;
+}
+
+static bool isBetterVideoMode(const VideoMode& candidate, const VideoMode& current) {
+    bool candidateSmooth = videoModeFps(candidate) >= 24;
+    bool currentSmooth = videoModeFps(current) >= 24;
+    if (candidateSmooth != currentSmooth) {
+        return candidateSmooth;
+    }
+    quint64 candidatePixels = static_cast<quint64>(candidate.width) * candidate.height;
+    quint64 currentPixels = static_cast<quint64>(current.width) * current.height;
+    if (candidatePixels != currentPixels) {
+        return candidatePixels > currentPixels;
+    }
+    if (videoModeFps(candidate) != videoModeFps(current)) {
+        return videoModeFps(candidate) > videoModeFps(current);
+    }
+    return subtypePreference(candidate.subtype) > subtypePreference(current.subtype);
+}
+
+bool selectVideoMode(const QList<VideoMode>& modes, const CaptureParameters& parameters, VideoMode& selected) {
+    bool found = false;
+    for (const VideoMode& mode : modes) {
+        if ((parameters.width && mode.width != parameters.width) ||
+            (parameters.height && mode.height != parameters.height) ||
+            (parameters.fps && videoModeFps(mode) != parameters.fps)) {
+            continue;
+        }
+        if (!parameters.pixelFormat.isEmpty() &&
+            getCodecName(mode.subtype).compare(parameters.pixelFormat, Qt::CaseInsensitive) != 0) {
+            continue;
+        }
+        if (!isRecordableSubtype(mode.subtype, parameters.container)) {
+            continue;
+        }
+        if (found && parameters.preferredFps) {
+            UINT32 modeDistance = qAbs(static_cast<int>(videoModeFps(mode)) - static_cast<int>(parameters.preferredFps));
+            UINT32 selectedDistance =
+                qAbs(static_cast<int>(videoModeFps(selected)) - static_cast<int>(parameters.preferredFps));
+            if (modeDistance != selectedDistance) {
+                if (modeDistance < selectedDistance) {
+                    selected = mode;
+                }
+                continue;
+            }
+        }
+        if (!found || isBetterVideoMode(mode, selected)) {
+            selected = mode;
+            found = true;
+        }
+    }
+    return found;
+}
+
+IMFSinkWriter* createSinkWriter(const QString& outputPath, const GUID& containerType) {
     IMFSinkWriter* sinkWriter = nullptr;
     IMFAttributes* attributes = nullptr;
     HRESULT status = MFCreateAttributes(&attributes, 1);
@@ -438,9 +607,9 @@ IMFSinkWriter* createSinkWriter(const QString& outputPath) {
         qCritical() << "Failed to create attributes for Sink Writer.";
         return nullptr;
     }
-    status = attributes->SetGUID(MF_TRANSCODE_CONTAINERTYPE, MFTranscodeContainerType_AVI);
+    status = attributes->SetGUID(MF_TRANSCODE_CONTAINERTYPE, containerType);
     if (FAILED(status)) {
-        qCritical() << "Failed to set container type to AVI.";
+        qCritical() << "Failed to set container type.";
         attributes->Release();
         return nullptr;
     }
@@ -455,7 +624,7 @@ IMFSinkWriter* createSinkWriter(const QString& outputPath) {
 }
 
 bool configureOutputFormat(IMFSinkWriter* sinkWriter, DWORD& streamIndex,
-                           UINT32 width, UINT32 height, UINT32 fps) {
+                           UINT32 width, UINT32 height, UINT32 fps, const GUID& subtype) {
     if (!sinkWriter) {
         qCritical() << "Sink Writer is null.";
         return false;
@@ -467,10 +636,14 @@ bool configureOutputFormat(IMFSinkWriter* sinkWriter, DWORD& streamIndex,
         return false;
     }
     status = outputMediaType->SetGUID(MF_MT_MAJOR_TYPE, MFMediaType_Video);
-    status |= outputMediaType->SetGUID(MF_MT_SUBTYPE, MFVideoFormat_MJPG);
+    status |= outputMediaType->SetGUID(MF_MT_SUBTYPE, subtype);
     status |= MFSetAttributeSize(outputMediaType, MF_MT_FRAME_SIZE, width, height);
     status |= MFSetAttributeRatio(outputMediaType, MF_MT_FRAME_RATE, fps, 1);
     status |= MFSetAttributeRatio(outputMediaType, MF_MT_PIXEL_ASPECT_RATIO, 1, 1);
+    status |= outputMediaType->SetUINT32(MF_MT_INTERLACE_MODE, MFVideoInterlace_Progressive);
+    if (subtype == MFVideoFormat_H264) {
+        status |= outputMediaType->SetUINT32(MF_MT_AVG_BITRATE, width * height * fps / 8);
+    }
     if (FAILED(status)) {
         qCritical() << "Failed to configure output media type.";
         outputMediaType->Release();
@@ -486,7 +659,7 @@ bool configureOutputFormat(IMFSinkWriter* sinkWriter, DWORD& streamIndex,
 }
 
 bool configureInputFormat(IMFSinkWriter* sinkWriter, DWORD streamIndex,
-                          UINT32 width, UINT32 height, UINT32 fps) {
+                          UINT32 width, UINT32 height, UINT32 fps, const GUID& subtype) {
     if (!sinkWriter) {
         qCritical() << "Sink Writer is null.";
         return false;
@@ -498,10 +671,11 @@ bool configureInputFormat(IMFSinkWriter* sinkWriter, DWORD streamIndex,
         return false;
     }
     status = inputMediaType->SetGUID(MF_MT_MAJOR_TYPE, MFMediaType_Video);
-    status |= inputMediaType->SetGUID(MF_MT_SUBTYPE, MFVideoFormat_MJPG);
+    status |= inputMediaType->SetGUID(MF_MT_SUBTYPE, subtype);
     status |= MFSetAttributeSize(inputMediaType, MF_MT_FRAME_SIZE, width, height);
     status |= MFSetAttributeRatio(inputMediaType, MF_MT_FRAME_RATE, fps, 1);
     status |= MFSetAttributeRatio(inputMediaType, MF_MT_PIXEL_ASPECT_RATIO, 1, 1);
+    status |= inputMediaType->SetUINT32(MF_MT_INTERLACE_MODE, MFVideoInterlace_Progressive);
     if (FAILED(status)) {
         qCritical() << "Failed to configure input media type. HRESULT:"
                     << QString("0x%1").arg(status, 0, 16);
@@ -520,8 +694,21 @@ bool configureInputFormat(IMFSinkWriter* sinkWriter, DWORD streamIndex,
     return true;
 }
 
+static UINT32 aacBytesPerSecond(UINT32 bitrate) {
+    static const UINT32 supportedRates[] = { 12000, 16000, 20000, 24000 };
+    UINT32 selected = supportedRates[0];
+    for (UINT32 rate : supportedRates) {
+        if (qAbs(static_cast<int>(rate) - static_cast<int>(bitrate / 8)) <
+            qAbs(static_cast<int>(selected) - static_cast<int>(bitrate / 8))) {
+            selected = rate;
+        }
+    }
+    return selected;
+}
+
 bool configureAudioOutputFormat(IMFSinkWriter* sinkWriter, DWORD& audioStreamIndex,
-                                UINT32 sampleRate, UINT32 channels) {
+                                UINT32 sampleRate, UINT32 channels,
+                                const GUID& subtype, UINT32 bitrate) {
     if (!sinkWriter) {
         qCritical() << "Sink Writer is null.";
         return false;
@@ -533,10 +720,14 @@ bool configureAudioOutputFormat(IMFSinkWriter* sinkWriter, DWORD& audioStreamInd
         return false;
     }
     status = outputAudioType->SetGUID(MF_MT_MAJOR_TYPE, MFMediaType_Audio);
-    status |= outputAudioType->SetGUID(MF_MT_SUBTYPE, MFAudioFormat_PCM);
+    status |= outputAudioType->SetGUID(MF_MT_SUBTYPE, subtype);
     status |= outputAudioType->SetUINT32(MF_MT_AUDIO_SAMPLES_PER_SECOND, sampleRate);
     status |= outputAudioType->SetUINT32(MF_MT_AUDIO_NUM_CHANNELS, channels);
     status |= outputAudioType->SetUINT32(MF_MT_AUDIO_BITS_PER_SAMPLE, 16);
+    if (subtype == MFAudioFormat_AAC) {
+        status |= outputAudioType->SetUINT32(MF_MT_AUDIO_AVG_BYTES_PER_SECOND, aacBytesPerSecond(bitrate));
+        status |= outputAudioType->SetUINT32(MF_MT_AAC_PAYLOAD_TYPE, 0);
+    }
     if (FAILED(status)) {
         qCritical() << "Failed to configure output audio format.";
         outputAudioType->Release();
@@ -688,19 +879,41 @@ void deleteSinkWriter(IMFSinkWriter* sinkWriter) {
 //     deinitializeWMF();
 // }
 
-bool recordFromDevice(IMFActivate* videoDevice, IMFActivate* audioDevice,
-                      const QString& outputPath, int durationSeconds, UINT32 fps) {
+bool recordFromDevice(IMFActivate* videoDevice, IMFActivate* audioDevice, const QString& outputBaseName,
+                      const CaptureParameters& parameters, QString& outputPath, int cameraIndex) {
     IMFMediaSource* videoSource = createMediaSource(videoDevice);
     IMFMediaSource* audioSource = audioDevice ? createMediaSource(audioDevice) : nullptr;
     IMFSourceReader* videoReader = createSourceReader(videoSource);
     IMFSourceReader* audioReader = audioSource ? createSourceReader(audioSource) : nullptr;
-    UINT32 videoWidth = 1920, videoHeight = 1080;
-    UINT32 audioSampleRate = 48000, audioChannels = 2, audioBitsPerSample = 16;
-    bool result = captureVideoWithAudio(
-        videoReader, audioReader, outputPath,
-        videoWidth, videoHeight, fps,
-        audioSampleRate, audioChannels, audioBitsPerSample,
-        durationSeconds);
+    QList<VideoMode> modes = enumerateVideoModes(videoReader);
+    VideoMode videoMode;
+    bool result = selectVideoMode(modes, parameters, videoMode);
+    if (!result) {
+        qCritical() << "No native video mode matches the requested parameters for" << getDeviceName(videoDevice);
+        for (const VideoMode& mode : modes) {
+            qCritical() << "  available:" << describeVideoMode(mode);
+        }
+    } else {
+        bool mp4 = parameters.container == "mp4" || (parameters.container.isEmpty() && parameters.audioCodec == "aac");
+        bool aac = parameters.audioCodec == "aac" || (mp4 && parameters.audioCodec.isEmpty());
+        outputPath = outputBaseName + (mp4 ? ".mp4" : ".avi");
+        UINT32 audioSampleRate = 48000, audioChannels = 2, audioBitsPerSample = 16;
+        getNativeAudioFormat(audioReader, audioSampleRate, audioChannels, audioBitsPerSample);
+        if (aac) {
+            audioSampleRate = audioSampleRate == 44100 ? 44100 : 48000;
+            audioChannels = qMin<UINT32>(audioChannels, 2);
+            audioBitsPerSample = 16;
+        }
+        bool withAudio = parameters.audioCodec != "none" && (aac || !mp4);
+        qDebug() << "Recording" << getDeviceName(videoDevice) << "as" << describeVideoMode(videoMode)
+                 << "audio" << (withAudio && audioReader ? (aac ? "aac" : "pcm") : "none");
+        result = captureVideoWithAudio(
+            videoReader, withAudio ? audioReader : nullptr, outputPath,
+            videoMode, mp4 ? MFVideoFormat_H264 : videoMode.subtype,
+            audioSampleRate, audioChannels, audioBitsPerSample,
+            aac ? MFAudioFormat_AAC : MFAudioFormat_PCM, parameters.audioBitrate,
+            parameters.durationSeconds, cameraIndex);
+    }
     deleteSourceReader(videoReader);
     deleteSourceReader(audioReader);
     deleteMediaSource(videoSource);
@@ -709,26 +922,181 @@ bool recordFromDevice(IMFActivate* videoDevice, IMFActivate* audioDevice,
     return result;
 }
 
+static void captureAudioIntoRing(IMFSourceReader* audioReader, PcmRingBuffer* ring, std::atomic<bool>* running,
+                                 int cameraIndex) {
+    PipelineThreadPlacement placement(PipelineStage::Audio, cameraIndex);
+    while (running->load()) {
+        TRACE_SCOPE("wmf_audio_read");
+        PipelineStageTimer audioTimer(PipelineStage::Audio, cameraIndex);
+        IMFSample* sample = nullptr;
+        DWORD streamIndex = 0;
+        DWORD flags = 0;
+        LONGLONG timestamp = 0;
+        HRESULT status = audioReader->ReadSample(MF_SOURCE_READER_FIRST_AUDIO_STREAM, 0, &streamIndex, &flags,
+                                                 &timestamp, &sample);
+        if (FAILED(status)) {
+            qCritical() << "Failed to read audio sample. HRESULT:" << QString("0x%1").arg(status, 0, 16);
+            return;
+        }
+        if (flags & MF_SOURCE_READERF_ENDOFSTREAM) {
+            qWarning() << "Audio stream ended.";
+            if (sample) {
+                sample->Release();
+            }
+            return;
+        }
+        if (!sample) {
+            continue;
+        }
+        IMFMediaBuffer* buffer = nullptr;
+        if (SUCCEEDED(sample->ConvertToContiguousBuffer(&buffer))) {
+            BYTE* data = nullptr;
+            DWORD length = 0;
+            if (SUCCEEDED(buffer->Lock(&data, nullptr, &length))) {
+                if (ring->write(data, length) < length) {
+                    qWarning() << "Audio ring buffer overflow, replacing dropped PCM data with silence.";
+                }
+                buffer->Unlock();
+            }
+            buffer->Release();
+        }
+        sample->Release();
+    }
+}
+
+static bool writePcmFromRing(IMFSinkWriter* sinkWriter, QMutex* sinkWriterMutex, DWORD streamIndex,
+                             PcmRingBuffer& ring, UINT32 sampleRate, UINT32 blockAlign, LONGLONG untilTime,
+                             qint64& writtenFrames) {
+    const qint64 maxFramesPerSample = sampleRate / 50;
+    while (true) {
+        qint64 frames = ring.available() / blockAlign;
+        if (untilTime >= 0) {
+            qint64 limitFrames = untilTime * sampleRate / 10000000LL;
+            frames = qMin(frames, limitFrames - writtenFrames);
+        }
+        frames = qMin(frames, maxFramesPerSample);
+        if (frames <= 0) {
+            return true;
+        }
+        DWORD length = static_cast<DWORD>(frames * blockAlign);
+        IMFMediaBuffer* buffer = nullptr;
+        IMFSample* sample = nullptr;
+        BYTE* data = nullptr;
+        if (FAILED(MFCreateMemoryBuffer(length, &buffer)) || FAILED(MFCreateSample(&sample)) ||
+            FAILED(buffer->Lock(&data, nullptr, nullptr))) {
+            qCritical() << "Failed to allocate audio sample.";
+            if (buffer) {
+                buffer->Release();
+            }
+            if (sample) {
+                sample->Release();
+            }
+            return false;
+        }
+        ring.read(data, length);
+        buffer->Unlock();
+        buffer->SetCurrentLength(length);
+        sample->AddBuffer(buffer);
+        buffer->Release();
+        LONGLONG sampleTime = writtenFrames * 10000000LL / sampleRate;
+        writtenFrames += frames;
+        sample->SetSampleTime(sampleTime);
+        sample->SetSampleDuration(writtenFrames * 10000000LL / sampleRate - sampleTime);
+        bool written = false;
+        {
+            QMutexLocker locker(sinkWriterMutex);
+            written = writeSample(sinkWriter, streamIndex, sample);
+        }
+        sample->Release();
+        if (!written) {
+            qCritical() << "Failed to write audio sample.";
+            return false;
+        }
+    }
+}
+
+class VideoSampleQueue {
+public:
+    explicit VideoSampleQueue(int capacity) : samples(capacity, nullptr) {}
+
+    ~VideoSampleQueue() {
+        IMFSample* sample = nullptr;
+        while (count > 0 && pop(sample)) {
+            sample->Release();
+        }
+    }
+
+    bool push(IMFSample* sample) {
+        QMutexLocker locker(&mutex);
+        if (count == samples.size()) {
+            return false;
+        }
+        samples[(head + count) % samples.size()] = sample;
+        count++;
+        ready.wakeOne();
+        return true;
+    }
+
+    bool pop(IMFSample*& sample) {
+        QMutexLocker locker(&mutex);
+        while (count == 0 && !closed) {
+            ready.wait(&mutex);
+        }
+        if (count == 0) {
+            return false;
+        }
+        sample = samples[head];
+        samples[head] = nullptr;
+        head = (head + 1) % samples.size();
+        count--;
+        return true;
+    }
+
+    void close() {
+        QMutexLocker locker(&mutex);
+        closed = true;
+        ready.wakeAll();
+    }
+
+    std::atomic<bool> failed { false };
+
+private:
+    QMutex mutex;
+    QWaitCondition ready;
+    QVector<IMFSample*> samples;
+    int head = 0;
+    int count = 0;
+    bool closed = false;
+};
+
+static const int videoSampleQueueSize = 3;
+
 bool captureVideoWithAudio(IMFSourceReader* videoReader,
                            IMFSourceReader* audioReader, const QString& outputPath,
-                           UINT32 videoWidth, UINT32 videoHeight, UINT32 videoFPS,
+                           const VideoMode& videoMode, const GUID& outputSubtype,
                            UINT32 audioSampleRate, UINT32 audioChannels, UINT32 audioBitsPerSample,
-                           int durationSeconds) {
-    IMFSinkWriter* sinkWriter = createSinkWriter(outputPath);
+                           const GUID& audioSubtype, UINT32 audioBitrate, int durationSeconds,
+                           int cameraIndex) {
+    UINT32 videoWidth = videoMode.width, videoHeight = videoMode.height;
+    UINT32 videoFPS = qMax<UINT32>(1, videoModeFps(videoMode));
+    IMFSinkWriter* sinkWriter = createSinkWriter(outputPath, outputSubtype == MFVideoFormat_H264
+                                                                 ? MFTranscodeContainerType_MPEG4
+                                                                 : MFTranscodeContainerType_AVI);
     if (!sinkWriter) {
         return false;
     }
     DWORD videoStreamIndex = 0, audioStreamIndex = 0;
     if (!configureOutputFormat(sinkWriter, videoStreamIndex,
-                               videoWidth, videoHeight, videoFPS) ||
+                               videoWidth, videoHeight, videoFPS, outputSubtype) ||
         !configureInputFormat(sinkWriter, videoStreamIndex,
-                              videoWidth, videoHeight, videoFPS)) {
+                              videoWidth, videoHeight, videoFPS, videoMode.subtype)) {
         deleteSinkWriter(sinkWriter);
         return false;
     }
     if (audioReader) {
         if (!configureAudioOutputFormat(sinkWriter, audioStreamIndex,
-                                        audioSampleRate, audioChannels) ||
+                                        audioSampleRate, audioChannels,
+                                        audioSubtype, audioBitrate) ||
             !configureAudioInputFormat(sinkWriter, audioStreamIndex,
                                        audioSampleRate, audioChannels,
                                        audioBitsPerSample)) {
@@ -740,8 +1108,7 @@ bool captureVideoWithAudio(IMFSourceReader* videoReader,
         deleteSinkWriter(sinkWriter);
         return false;
     }
-    if (!configureSourceReaderVideoFormat(videoReader,
-                                          videoWidth, videoHeight, videoFPS)) {
+    if (!configureSourceReaderVideoMode(videoReader, videoMode)) {
         deleteSinkWriter(sinkWriter);
         return false;
     }
@@ -753,67 +1120,155 @@ bool captureVideoWithAudio(IMFSourceReader* videoReader,
             return false;
         }
     }
-    LONGLONG frameDuration = 10000000 / videoFPS;
-    LONGLONG audioDuration = 0;
+    LONGLONG frameDuration = 10000000LL * videoMode.fpsDenominator / qMax<UINT32>(1, videoMode.fpsNumerator);
+    UINT32 audioBlockAlign = qMax<UINT32>(1, audioChannels * (audioBitsPerSample / 8));
+    PcmRingBuffer audioRing(static_cast<qint64>(audioSampleRate) * audioBlockAlign * serviceConfig().audioRingMs / 1000,
+                            audioBlockAlign);
+    QMutex sinkWriterMutex;
+    std::atomic<bool> audioRunning { true };
+    std::atomic<bool> muxRunning { true };
+    std::atomic<bool> muxFailed { false };
+    std::atomic<LONGLONG> muxUntilTime { 0 };
+    qint64 audioFrames = 0;
+    QThread* audioThread = nullptr;
+    QThread* muxThread = nullptr;
+    if (audioReader) {
+        audioThread = QThread::create(captureAudioIntoRing, audioReader, &audioRing, &audioRunning, cameraIndex);
+        audioThread->start(QThread::TimeCriticalPriority);
+        muxThread = QThread::create([&]() {
+            PipelineThreadPlacement placement(PipelineStage::Encode, cameraIndex);
+            while (muxRunning.load()) {
+                {
+                    TRACE_SCOPE("wmf_write_audio");
+                    if (!writePcmFromRing(sinkWriter, &sinkWriterMutex, audioStreamIndex, audioRing, audioSampleRate,
+                                          audioBlockAlign, muxUntilTime.load(), audioFrames)) {
+                        muxFailed = true;
+                        return;
+                    }
+                }
+                QThread::msleep(10);
+            }
+        });
+        muxThread->start();
+    }
+    bool result = true;
     int totalFrames = durationSeconds * videoFPS;
-    LONGLONG rtStart = 0;
-    for (int frameCount = 0; frameCount < totalFrames; ++frameCount) {
-        auto frameStartTime = std::chrono::high_resolution_clock::now();
-
-        IMFSample* videoSample = readSampleFromSourceReader(
-            videoReader, MF_SOURCE_READER_FIRST_VIDEO_STREAM);
-        if (videoSample) {
-            videoSample->SetSampleTime(rtStart);
-            videoSample->SetSampleDuration(frameDuration);
+    LONGLONG durationTime = durationSeconds * 10000000LL;
+    RecordingIndexWriter index;
+    index.open(outputPath, false);
+    resetCameraSync(cameraIndex);
+    VideoSampleQueue videoQueue(videoSampleQueueSize);
+    QThread* grabThread = QThread::create([&]() {
+        PipelineThreadPlacement grabPlacement(PipelineStage::Grab, cameraIndex);
+        LONGLONG firstDeviceTime = -1;
+        LONGLONG rtStart = 0;
+        int droppedFrames = 0;
+        for (int frameCount = 0; frameCount < totalFrames && rtStart < durationTime && !videoQueue.failed.load();
+             ++frameCount) {
+            auto frameStartTime = std::chrono::high_resolution_clock::now();
 
-            if (!writeSample(sinkWriter, videoStreamIndex, videoSample)) {
-                qCritical() << "Failed to write video sample.";
-                videoSample->Release();
-                break;
+            IMFSample* videoSample = nullptr;
+            {
+                TRACE_SCOPE("wmf_read_sample");
+                PipelineStageTimer grabTimer(PipelineStage::Grab, cameraIndex);
+                videoSample = readSampleFromSourceReader(videoReader, MF_SOURCE_READER_FIRST_VIDEO_STREAM);
             }
-            videoSample->Release();
-        }
-        if (audioReader) {
-            IMFSample* audioSample = readSampleFromSourceReader(
-                audioReader, MF_SOURCE_READER_FIRST_AUDIO_STREAM);
-            if (audioSample) {
-                audioSample->SetSampleTime(audioDuration);
-                IMFMediaBuffer* buffer = nullptr;
-                HRESULT hr = audioSample->ConvertToContiguousBuffer(&buffer);
-                if (SUCCEEDED(hr)) {
-                    DWORD cbBuffer = 0;
-                    buffer->GetCurrentLength(&cbBuffer);
-                    LONGLONG sampleDuration = (LONGLONG)((cbBuffer * 10000000) /
-                                                          (audioSampleRate * audioChannels * (audioBitsPerSample / 8)));
-                    audioSample->SetSampleDuration(sampleDuration);
-                    audioDuration += sampleDuration;
-                    buffer->Release();
+            if (videoSample) {
+                LONGLONG deviceTime = 0;
+                if (FAILED(videoSample->GetSampleTime(&deviceTime))) {
+                    deviceTime = firstDeviceTime < 0 ? 0 : firstDeviceTime + rtStart + frameDuration;
                 }
-                if (!writeSample(sinkWriter, audioStreamIndex, audioSample)) {
-                    qCritical() << "Failed to write audio sample.";
-                    audioSample->Release();
-                    break;
+                if (firstDeviceTime < 0) {
+                    firstDeviceTime = deviceTime;
+                } else {
+                    rtStart = qMax(rtStart + 1, deviceTime - firstDeviceTime);
+                }
+                qint64 captureTime = syncedCaptureTimestampUs(cameraIndex, currentCaptureTimestampUs(), deviceTime / 10);
+                DWORD sampleLength = 0;
+                videoSample->GetTotalLength(&sampleLength);
+                index.append(frameCount, captureTime, 0, sampleLength, true);
+                videoSample->SetSampleTime(rtStart);
+                videoSample->SetSampleDuration(frameDuration);
+                if (!videoQueue.push(videoSample)) {
+                    videoSample->Release();
+                    droppedFrames++;
                 }
-                audioSample->Release();
+            }
+            auto frameEndTime = std::chrono::high_resolution_clock::now();
+            auto elapsedTime = std::chrono::duration_cast<std::chrono::milliseconds>(
+                frameEndTime - frameStartTime);
+            int frameDurationMs = 1000 / videoFPS;
+            int remainingTime = frameDurationMs - static_cast<int>(elapsedTime.count());
+            if (remainingTime > 0) {
+                TRACE_SCOPE("frame_sleep");
+                QThread::msleep(remainingTime);
+            }
+        }
+        if (droppedFrames > 0) {
+            qWarning() << "Sink writer fell behind on camera" << cameraIndex << "- dropped" << droppedFrames << "frames.";
+        }
+        videoQueue.close();
+    });
+    grabThread->start();
+    PipelineThreadPlacement placement(PipelineStage::Encode, cameraIndex);
+    IMFSample* videoSample = nullptr;
+    while (videoQueue.pop(videoSample)) {
+        if (muxFailed.load()) {
+            result = false;
+            videoQueue.failed = true;
+        }
+        if (!videoQueue.failed.load()) {
+            TRACE_SCOPE("wmf_write_sample");
+            PipelineStageTimer encodeTimer(PipelineStage::Encode, cameraIndex);
+            LONGLONG sampleTime = 0;
+            videoSample->GetSampleTime(&sampleTime);
+            bool written = false;
+            {
+                QMutexLocker locker(&sinkWriterMutex);
+                written = writeSample(sinkWriter, videoStreamIndex, videoSample);
+            }
+            if (written) {
+                muxUntilTime = sampleTime + frameDuration;
+            } else {
+                qCritical() << "Failed to write video sample.";
+                result = false;
+                videoQueue.failed = true;
             }
         }
-        rtStart += frameDuration;
-        auto frameEndTime = std::chrono::high_resolution_clock::now();
-        auto elapsedTime = std::chrono::duration_cast<std::chrono::milliseconds>(
-            frameEndTime - frameStartTime);
-        int frameDurationMs = 1000 / videoFPS;
-        int remainingTime = frameDurationMs - static_cast<int>(elapsedTime.count());
-        if (remainingTime > 0) {
-            QThread::msleep(remainingTime);
+        videoSample->Release();
+    }
+    grabThread->wait();
+    delete grabThread;
+    if (audioThread) {
+        audioRunning = false;
+        audioThread->wait();
+        delete audioThread;
+        muxRunning = false;
+        muxThread->wait();
+        delete muxThread;
+        if (muxFailed.load()) {
+            result = false;
+        } else if (result) {
+            result = writePcmFromRing(sinkWriter, &sinkWriterMutex, audioStreamIndex, audioRing, audioSampleRate,
+                                      audioBlockAlign, muxUntilTime.load(), audioFrames);
         }
+        if (audioRing.droppedBytes() > 0) {
+            qWarning() << "Dropped" << audioRing.droppedBytes() << "bytes of audio during capture.";
+        }
+    }
+    index.close();
+    bool finalized = false;
+    {
+        QMutexLocker locker(&sinkWriterMutex);
+        finalized = finalizeSinkWriter(sinkWriter);
     }
-    if (!finalizeSinkWriter(sinkWriter)) {
+    if (!finalized) {
         deleteSinkWriter(sinkWriter);
         return false;
     }
     deleteSinkWriter(sinkWriter);
     qDebug() << "Capture complete. File saved to:" << outputPath;
-    return true;
+    return result;
 }
 
 QList<QString> listDeviceInfo() {
@@ -875,59 +1330,7 @@ QList<QString> listDeviceInfo() {
     return deviceInfoList;
 }
 
-bool loadUsbIds(const QString &filePath) {
-    QFile file(filePath);
-    if (!file.open(QIODevice::ReadOnly | QIODevice::Text)) {
-        qWarning() << "Failed to open usb.ids file:" << filePath;
-        return false;
-    }
-    QTextStream in(&file);
-    QString line;
-    QString currentVendorId;
-    QString currentVendorName;
-    static const QRegularExpression whitespaceRegex("\\s+");
-    while (!in.atEnd()) {
-        line = in.readLine();
-        if (line.trimmed().isEmpty() || line.trimmed().startsWith('#')) {
-            continue;
-        }
-        int tabCount = 0;
-        while (tabCount < line.length() && line[tabCount] == '\t') {
-            tabCount++;
-        }
-        QString trimmedLine = line.mid(tabCount);
-        trimmedLine = trimmedLine.trimmed();
-        if (tabCount == 0) {
-            QStringList parts = trimmedLine.split(whitespaceRegex, Qt::SkipEmptyParts);
-            if (parts.size() >= 2) {
-                currentVendorId = parts.takeFirst().toUpper();
-                currentVendorName = parts.join(' ');
-                vendorMap.insert(currentVendorId, currentVendorName);
-            }
-        } else if (tabCount == 1 && !currentVendorId.isEmpty()) {
-            QStringList parts = trimmedLine.split(whitespaceRegex, Qt::SkipEmptyParts);
-            if (parts.size() >= 2) {
-                QString deviceId = parts.takeFirst().toUpper();
-                QString deviceName = parts.join(' ');
-                QPair<QString, QString> key(currentVendorId, deviceId);
-                deviceMap.insert(key, deviceName);
-            }
-        }
-    }
-    file.close();
-    return true;
-}
-
-QString getVendorNameFromId(const QString &vendorId) {
-    return vendorMap.value(vendorId.toUpper(), QString());
-}
-
-QString getDeviceNameFromIds(const QString &vendorId, const QString &deviceId) {
-    QPair<QString, QString> key(vendorId.toUpper(), deviceId.toUpper());
-    return deviceMap.value(key, QString());
-}
-
-QString getAllCamerasInfo() {
+QString getAllCamerasInfo(bool* complete) {
     QString info;
     initializeWMF();
     IMFAttributes* videoAttributes = createCaptureAttributes(MF_DEVSOURCE_ATTRIBUTE_SOURCE_TYPE_VIDCAP_GUID);
@@ -935,6 +1338,9 @@ QString getAllCamerasInfo() {
     UINT32 videoDeviceCount = 0, audioDeviceCount = 0;
     IMFActivate** videoDevices = enumerateCaptureDevices(videoAttributes, videoDeviceCount);
     IMFActivate** audioDevices = enumerateCaptureDevices(audioAttributes, audioDeviceCount);
+    if (complete) {
+        *complete = videoDevices != nullptr;
+    }
     if (videoDevices) {
         for (UINT32 i = 0; i < videoDeviceCount; ++i) {
             QString deviceInfo;
@@ -944,6 +1350,9 @@ QString getAllCamerasInfo() {
             QString vendorName = getVendorNameFromId(vendorID);
             QString deviceProductName = getDeviceNameFromIds(vendorID, deviceID);
             QList<QString> videoCodecs = getAvailableVideoCodecs(videoDevices[i]);
+            if (complete && videoCodecs.isEmpty()) {
+                *complete = false;
+            }
             IMFActivate* linkedAudioDevice = nullptr;
             QList<QString> audioCodecs;
             for (UINT32 j = 0; j < audioDeviceCount; ++j) {
@@ -986,8 +1395,111 @@ QString getAllCamerasInfo() {
     return info;
 }
 
+static QJsonArray videoModesJson(IMFActivate* videoDevice) {
+    QJsonArray modes;
+    IMFMediaSource* videoSource = createMediaSource(videoDevice);
+    IMFSourceReader* sourceReader = createSourceReader(videoSource);
+    for (const VideoMode& mode : enumerateVideoModes(sourceReader)) {
+        QJsonObject entry;
+        entry["format"] = getCodecName(mode.subtype);
+        entry["width"] = static_cast<int>(mode.width);
+        entry["height"] = static_cast<int>(mode.height);
+        entry["fps"] = static_cast<double>(mode.fpsNumerator) / mode.fpsDenominator;
+        modes.append(entry);
+    }
+    deleteSourceReader(sourceReader);
+    deleteMediaSource(videoSource);
+    return modes;
+}
+
+static QJsonArray audioFormatsJson(IMFActivate* audioDevice) {
+    QJsonArray formats;
+    IMFMediaSource* audioSource = createMediaSource(audioDevice);
+    IMFSourceReader* sourceReader = createSourceReader(audioSource);
+    DWORD mediaTypeIndex = 0;
+    IMFMediaType* mediaType = nullptr;
+    while (sourceReader && SUCCEEDED(sourceReader->GetNativeMediaType(
+        (DWORD)MF_SOURCE_READER_FIRST_AUDIO_STREAM, mediaTypeIndex, &mediaType))) {
+        GUID subtype = GUID_NULL;
+        UINT32 sampleRate = 0, channels = 0, bitsPerSample = 0;
+        mediaType->GetGUID(MF_MT_SUBTYPE, &subtype);
+        mediaType->GetUINT32(MF_MT_AUDIO_SAMPLES_PER_SECOND, &sampleRate);
+        mediaType->GetUINT32(MF_MT_AUDIO_NUM_CHANNELS, &channels);
+        mediaType->GetUINT32(MF_MT_AUDIO_BITS_PER_SAMPLE, &bitsPerSample);
+        QJsonObject entry;
+        entry["format"] = getCodecName(subtype);
+        entry["sampleRate"] = static_cast<int>(sampleRate);
+        entry["channels"] = static_cast<int>(channels);
+        entry["bitsPerSample"] = static_cast<int>(bitsPerSample);
+        formats.append(entry);
+        mediaType->Release();
+        mediaTypeIndex++;
+    }
+    deleteSourceReader(sourceReader);
+    deleteMediaSource(audioSource);
+    return formats;
+}
+
+QByteArray getAllCamerasInfoJson(bool* complete) {
+    QJsonArray cameras;
+    initializeWMF();
+    IMFAttributes* videoAttributes = createCaptureAttributes(MF_DEVSOURCE_ATTRIBUTE_SOURCE_TYPE_VIDCAP_GUID);
+    IMFAttributes* audioAttributes = createCaptureAttributes(MF_DEVSOURCE_ATTRIBUTE_SOURCE_TYPE_AUDCAP_GUID);
+    UINT32 videoDeviceCount = 0, audioDeviceCount = 0;
+    IMFActivate** videoDevices = enumerateCaptureDevices(videoAttributes, videoDeviceCount);
+    IMFActivate** audioDevices = enumerateCaptureDevices(audioAttributes, audioDeviceCount);
+    if (complete) {
+        *complete = videoDevices != nullptr;
+    }
+    for (UINT32 i = 0; videoDevices && i < videoDeviceCount; ++i) {
+        QString vendorID = getVendorID(videoDevices[i]);
+        QString deviceID = getDeviceID(videoDevices[i]);
+        QJsonObject camera;
+        camera["index"] = static_cast<int>(i);
+        camera["id"] = getStableDeviceID(videoDevices[i]).replace(':', '.');
+        camera["name"] = getDeviceName(videoDevices[i]);
+        camera["vendorId"] = vendorID;
+        camera["productId"] = deviceID;
+        camera["vendorName"] = getVendorNameFromId(vendorID);
+        camera["productName"] = getDeviceNameFromIds(vendorID, deviceID);
+        QJsonArray videoModes = videoModesJson(videoDevices[i]);
+        if (complete && videoModes.isEmpty()) {
+            *complete = false;
+        }
+        camera["videoModes"] = videoModes;
+        QJsonValue audio;
+        for (UINT32 j = 0; j < audioDeviceCount; ++j) {
+            if (areDevicesLinked(videoDevices[i], audioDevices[j])) {
+                QJsonObject audioDevice;
+                audioDevice["name"] = getDeviceName(audioDevices[j]);
+                audioDevice["formats"] = audioFormatsJson(audioDevices[j]);
+                audio = audioDevice;
+                break;
+            }
+        }
+        camera["audio"] = audio;
+        cameras.append(camera);
+    }
+    deleteDeviceList(videoDevices, videoDeviceCount);
+    deleteDeviceList(audioDevices, audioDeviceCount);
+    deleteAttributes(videoAttributes);
+    deleteAttributes(audioAttributes);
+    deinitializeWMF();
+    QJsonObject root;
+    root["cameras"] = cameras;
+    return QJsonDocument(root).toJson(QJsonDocument::Compact);
+}
 
 QList<QString> recordVideoWithAudioFromAllCameras(const QString& basePath, int durationSeconds, UINT32 fps) {
+    CaptureParameters parameters;
+    parameters.preferredFps = fps;
+    parameters.durationSeconds = durationSeconds;
+    QMap<int, CaptureParameters> cameras;
+    cameras.insert(-1, parameters);
+    return recordVideoWithAudioFromCameras(basePath, cameras);
+}
+
+QList<QString> recordVideoWithAudioFromCameras(const QString& basePath, const QMap<int, CaptureParameters>& cameras) {
     QList<QString> videoPaths;
     initializeWMF();
     IMFAttributes* videoAttributes = createCaptureAttributes(MF_DEVSOURCE_ATTRIBUTE_SOURCE_TYPE_VIDCAP_GUID);
@@ -1015,6 +1527,10 @@ QList<QString> recordVideoWithAudioFromAllCameras(const QString& basePath, int d
         }
     }
     for (UINT32 i = 0; i < videoDeviceCount; ++i) {
+        if (!cameras.contains(static_cast<int>(i)) && !cameras.contains(-1)) {
+            continue;
+        }
+        CaptureParameters parameters = cameras.value(static_cast<int>(i), cameras.value(-1));
         IMFActivate* linkedAudioDevice = nullptr;
 
         for (UINT32 j = 0; j < audioDeviceCount; ++j) {
@@ -1023,12 +1539,16 @@ QList<QString> recordVideoWithAudioFromAllCameras(const QString& basePath, int d
                 break;
             }
         }
-        QString outputPath = QString("video_camera_%1_%2.avi").arg(i).arg(getCurrentTimestamp());
-        if (!recordFromDevice(videoDevices[i], linkedAudioDevice, outputPath, durationSeconds, fps)) {
+        QString outputBaseName = allocateRecordingPath(basePath, QString("video_camera_%1_%2").arg(i).arg(getCurrentTimestamp()));
+        QString outputPath;
+        bool recorded = recordFromDevice(videoDevices[i], linkedAudioDevice, outputBaseName, parameters, outputPath,
+                                         static_cast<int>(i));
+        if (!recorded) {
             qCritical() << "Failed to record video from device:" << getDeviceName(videoDevices[i]);
         } else {
             videoPaths.append(outputPath);
         }
+        releaseRecordingPath(outputPath.isEmpty() ? outputBaseName : outputPath, recorded);
     }
     deleteDeviceList(videoDevices, videoDeviceCount);
     deleteDeviceList(audioDevices, audioDeviceCount);
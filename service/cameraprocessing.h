@@ -1,15 +1,40 @@
 #pragma once
 
+#include <QString>
+#include <QMap>
+#include <QList>
+#include <QPair>
+#include <QByteArray>
+
+#include "usbids.h"
+
+struct CaptureParameters {
+    quint32 width = 0;
+    quint32 height = 0;
+    quint32 fps = 0;
+    quint32 preferredFps = 0;
+    QString pixelFormat;
+    QString container;
+    QString audioCodec;
+    quint32 audioBitrate = 128000;
+    int durationSeconds = 5;
+};
+
+#ifdef Q_OS_WIN
 #include <mfapi.h>
 #include <mfobjects.h>
 #include <mfidl.h>
 #include <mfreadwrite.h>
 #include <comdef.h>
-#include <QString>
-#include <QMap>
-#include <QList>
-#include <QPair>
-#include <QMap>
+
+struct VideoMode {
+    GUID subtype = GUID_NULL;
+    UINT32 width = 0;
+    UINT32 height = 0;
+    UINT32 fpsNumerator = 0;
+    UINT32 fpsDenominator = 1;
+    DWORD mediaTypeIndex = 0;
+};
 
 void initializeWMF();
 void deinitializeWMF();
@@ -32,14 +57,24 @@ void deleteSourceReader(IMFSourceReader* sourceReader);
 IMFSample* readSampleFromSourceReader(IMFSourceReader* sourceReader, DWORD streamType, int maxAttempts = 10);
 
 bool configureSourceReaderVideoFormat(IMFSourceReader* sourceReader, UINT32 width, UINT32 height, UINT32 fps);
+bool configureSourceReaderVideoMode(IMFSourceReader* sourceReader, const VideoMode& mode);
+bool getNativeAudioFormat(IMFSourceReader* sourceReader, UINT32& sampleRate, UINT32& channels, UINT32& bitsPerSample);
+
+QList<VideoMode> enumerateVideoModes(IMFSourceReader* sourceReader);
+bool selectVideoMode(const QList<VideoMode>& modes, const CaptureParameters& parameters, VideoMode& selected);
+UINT32 videoModeFps(const VideoMode& mode);
+QString describeVideoMode(const VideoMode& mode);
 bool configureSourceReaderAudioFormat(IMFSourceReader* sourceReader, UINT32 sampleRate, UINT32 channels, UINT32 bitsPerSample);
 
-IMFSinkWriter* createSinkWriter(const QString& outputPath);
+IMFSinkWriter* createSinkWriter(const QString& outputPath, const GUID& containerType = MFTranscodeContainerType_AVI);
 void deleteSinkWriter(IMFSinkWriter* sinkWriter);
 
-bool configureOutputFormat(IMFSinkWriter* sinkWriter, DWORD& streamIndex, UINT32 width, UINT32 height, UINT32 fps);
-bool configureInputFormat(IMFSinkWriter* sinkWriter, DWORD streamIndex, UINT32 width, UINT32 height, UINT32 fps);
-bool configureAudioOutputFormat(IMFSinkWriter* sinkWriter, DWORD& audioStreamIndex, UINT32 sampleRate, UINT32 channels);
+bool configureOutputFormat(IMFSinkWriter* sinkWriter, DWORD& streamIndex, UINT32 width, UINT32 height, UINT32 fps,
+                           const GUID& subtype = MFVideoFormat_MJPG);
+bool configureInputFormat(IMFSinkWriter* sinkWriter, DWORD streamIndex, UINT32 width, UINT32 height, UINT32 fps,
+                          const GUID& subtype = MFVideoFormat_MJPG);
+bool configureAudioOutputFormat(IMFSinkWriter* sinkWriter, DWORD& audioStreamIndex, UINT32 sampleRate, UINT32 channels,
+                                const GUID& subtype = MFAudioFormat_PCM, UINT32 bitrate = 0);
 bool configureAudioInputFormat(IMFSinkWriter* sinkWriter, DWORD audioStreamIndex, UINT32 sampleRate, UINT32 channels, UINT32 bitsPerSample);
 
 bool beginSinkWriter(IMFSinkWriter* sinkWriter);
@@ -48,25 +83,26 @@ bool finalizeSinkWriter(IMFSinkWriter* sinkWriter);
 
 //void recordFromAllCameras(const QString& basePath, int durationSeconds, UINT32 fps);
 bool captureVideoWithAudio(IMFSourceReader* videoReader, IMFSourceReader* audioReader, const QString& outputPath,
-                           UINT32 videoWidth, UINT32 videoHeight, UINT32 videoFPS,
+                           const VideoMode& videoMode, const GUID& outputSubtype,
                            UINT32 audioSampleRate, UINT32 audioChannels, UINT32 audioBitsPerSample,
-                           int durationSeconds);
-bool recordFromDevice(IMFActivate* videoDevice, IMFActivate* audioDevice,
-                      const QString& outputPath, int durationSeconds, UINT32 fps);
+                           const GUID& audioSubtype, UINT32 audioBitrate, int durationSeconds,
+                           int cameraIndex = -1);
+bool recordFromDevice(IMFActivate* videoDevice, IMFActivate* audioDevice, const QString& outputBaseName,
+                      const CaptureParameters& parameters, QString& outputPath, int cameraIndex = -1);
 
 
 QString getDeviceSymbolicLink(IMFActivate* device);
 QString getDeviceID(IMFActivate* device);
 QString getVendorID(IMFActivate* device);
+QString getStableDeviceID(IMFActivate* device);
 QList<QString> getAvailableVideoCodecs(IMFActivate* videoDevice);
 QList<QString> getAvailableAudioCodecs(IMFActivate* audioDevice);
-bool loadUsbIds(const QString& filePath);
-QString getVendorNameFromId(const QString& vendorId);
-QString getDeviceNameFromIds(const QString& vendorId, const QString& deviceId);
 
 // void listDeviceInfo();
 QList<QString> listDeviceInfo();
 
-QString getAllCamerasInfo();
+QString getAllCamerasInfo(bool* complete = nullptr);
+QByteArray getAllCamerasInfoJson(bool* complete = nullptr);
 QList<QString> recordVideoWithAudioFromAllCameras(const QString& basePath, int durationSeconds, UINT32 fps);
-
+QList<QString> recordVideoWithAudioFromCameras(const QString& basePath, const QMap<int, CaptureParameters>& cameras);
+#endif
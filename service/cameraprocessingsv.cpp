@@ -1,8 +1,27 @@
 #include "cameraprocessingsv.h"
+#include "recordingindex.h"
+#include "h264writer.h"
+#include "framepool.h"
+#include "rawframe.h"
+#include "devicediscovery.h"
+#include "storagemanager.h"
+#include "pipelinescheduler.h"
+#include "framesync.h"
+#include "tracing.h"
+#include "serviceconfig.h"
+#ifdef Q_OS_LINUX
+#include "v4l2capture.h"
+#endif
 
 #include <QDir>
+#include <QFile>
 #include <QDebug>
+#include <QMutex>
 #include <QThread>
+#include <QWaitCondition>
+#include <atomic>
+#include <functional>
+#include <memory>
 #include <opencv2/opencv.hpp>
 
 QString getCurrentTimestampSV() {
@@ -11,17 +30,11 @@ QString getCurrentTimestampSV() {
 
 QVector<int> getConnectedCameras() {
     QVector<int> cameras;
-    int cameraIndex = 0;
-    while (true) {
-        cv::VideoCapture cap(cameraIndex);
-        if (cap.isOpened()) {
-            cameras.append(cameraIndex);
-            cap.release();
-        } else {
-            break;
-        }
-        cameraIndex++;
+    if (cachedCameraIndices(cameras)) {
+        return cameras;
     }
+    cameras = enumerateCameraIndices();
+    cacheCameraIndices(cameras);
     return cameras;
 }
 
@@ -139,10 +152,12 @@ void recordVideoAVI(const QVector<int>& cameras, const QString& basePath, int du
             continue;
         }
         qDebug() << "Capturing video from camera" << cameraIndex << "to file:" << filename;
+        framePoolAllocator()->reserve(frameWidth, frameHeight, CV_8UC3, 2);
+        cv::Mat frame;
+        frame.allocator = framePoolAllocator();
         for (int frameIndex = 0; frameIndex < totalFrames; ++frameIndex) {
             auto frameStartTime = std::chrono::high_resolution_clock::now();
 
-            cv::Mat frame;
             cap >> frame;
 
             if (frame.empty()) {
@@ -154,6 +169,7 @@ void recordVideoAVI(const QVector<int>& cameras, const QString& basePath, int du
             auto elapsedTime = std::chrono::duration_cast<std::chrono::milliseconds>(frameEndTime - frameStartTime);
             int remainingTime = frameDurationMs - static_cast<int>(elapsedTime.count());
             if (remainingTime > 0) {
+                TRACE_SCOPE("frame_sleep");
                 QThread::msleep(remainingTime);
             }
         }
@@ -198,9 +214,11 @@ void recordVideoMP4(const QVector<int>& cameras, const QString& basePath, int du
             continue;
         }
         qDebug() << "Recording video from camera" << cameraIndex << "to file:" << filename;
+        framePoolAllocator()->reserve(frameWidth, frameHeight, CV_8UC3, 2);
+        cv::Mat frame;
+        frame.allocator = framePoolAllocator();
         for (int frameIndex = 0; frameIndex < totalFrames; ++frameIndex) {
             auto frameStartTime = std::chrono::high_resolution_clock::now();
-            cv::Mat frame;
             cap >> frame;
             if (frame.empty()) {
                 qWarning() << "Failed to capture frame from camera" << cameraIndex << "at frame" << frameIndex;
@@ -211,6 +229,7 @@ void recordVideoMP4(const QVector<int>& cameras, const QString& basePath, int du
             auto elapsedTime = std::chrono::duration_cast<std::chrono::milliseconds>(frameEndTime - frameStartTime);
             int remainingTime = frameDurationMs - static_cast<int>(elapsedTime.count());
             if (remainingTime > 0) {
+                TRACE_SCOPE("frame_sleep");
                 QThread::msleep(remainingTime);
             }
         }
@@ -228,24 +247,12 @@ QList<QPair<QString, QByteArray>> capturePhotoFromAllCameras() {
         return photos;
     }
     for (int cameraIndex : cameras) {
-        cv::VideoCapture cap(cameraIndex);
-        if (!cap.isOpened()) {
-            qWarning() << "Failed to open camera" << cameraIndex;
-            continue;
-        }
-        cv::Mat frame;
-        cap >> frame;
-        if (frame.empty()) {
-            qWarning() << "Failed to capture frame from camera" << cameraIndex;
-            cap.release();
+        QByteArray imageData = capturePhotoFromCamera(cameraIndex, 0);
+        if (imageData.isEmpty()) {
             continue;
         }
-        std::vector<uchar> buf;
-        cv::imencode(".jpg", frame, buf);
-        QByteArray imageData(reinterpret_cast<const char*>(buf.data()), buf.size());
         QString fileName = QString("photo_camera_%1_%2.jpg").arg(cameraIndex).arg(getCurrentTimestampSV());
         photos.append(qMakePair(fileName, imageData));
-        cap.release();
     }
     return photos;
 }
@@ -264,51 +271,363 @@ QList<QString> recordVideoFromAllCameras(const QString& basePath, int durationSe
             return videoPaths;
         }
     }
-    int frameDurationMs = 1000 / fps;
-    int totalFrames = durationSeconds * fps;
+    H264Settings settings;
+    settings.container = "fmp4";
+    settings.fragmentFrames = fps;
+    settings.gopSize = fps;
+    settings.preset = h264PresetForCameraCount(1);
+    settings.threads = h264ThreadsForCameraCount(1);
     for (int cameraIndex : cameras) {
-        cv::VideoCapture cap(cameraIndex);
-        if (!cap.isOpened()) {
-            qWarning() << "Failed to open camera" << cameraIndex;
-            continue;
+        QString filename = allocateRecordingPath(basePath, QString("video_camera_%1_%2.mp4").arg(cameraIndex).arg(getCurrentTimestampSV()));
+        bool recorded = recordH264VideoFromCamera(cameraIndex, filename, durationSeconds, fps, settings);
+        if (recorded) {
+            videoPaths.append(filename);
         }
-        int frameWidth = static_cast<int>(cap.get(cv::CAP_PROP_FRAME_WIDTH));
-        int frameHeight = static_cast<int>(cap.get(cv::CAP_PROP_FRAME_HEIGHT));
-        QString filename = QString("video_camera_%1_%2.mp4").arg(cameraIndex).arg(getCurrentTimestampSV());
-        cv::VideoWriter writer(
-            filename.toStdString(),
-            cv::VideoWriter::fourcc('m', 'p', '4', 'v'),
-            fps,
-            cv::Size(frameWidth, frameHeight)
-            );
-        if (!writer.isOpened()) {
-            qWarning() << "Could not open VideoWriter for camera" << cameraIndex;
-            cap.release();
-            continue;
+        releaseRecordingPath(filename, recorded);
+    }
+    return videoPaths;
+}
+
+bool openFrameSource(int cameraIndex, bool preferCompressed, cv::VideoCapture& cap,
+                     std::function<bool(cv::Mat&, qint64&)>& grab, RawPixelFormat& format,
+                     int& frameWidth, int& frameHeight, int maxFps) {
+#ifdef Q_OS_LINUX
+    auto v4l2 = std::make_shared<V4l2Capture>();
+    if (openV4l2Camera(*v4l2, cameraIndex, preferCompressed, serviceConfig().v4l2Buffers, maxFps)) {
+        format = v4l2->rawFormat();
+        frameWidth = static_cast<int>(v4l2->format().width);
+        frameHeight = static_cast<int>(v4l2->format().height);
+        grab = [v4l2](cv::Mat& frame, qint64& deviceTimestampUs) {
+            frame = v4l2->readSample();
+            deviceTimestampUs = v4l2->lastTimestampUs();
+            return !frame.empty();
+        };
+        return true;
+    }
+#else
+    Q_UNUSED(preferCompressed);
+    Q_UNUSED(maxFps);
+#endif
+    cap.open(cameraIndex);
+    if (!cap.isOpened()) {
+        qWarning() << "Failed to open camera" << cameraIndex;
+        return false;
+    }
+    format = openNativeCapture(cap);
+    frameWidth = static_cast<int>(cap.get(cv::CAP_PROP_FRAME_WIDTH));
+    frameHeight = static_cast<int>(cap.get(cv::CAP_PROP_FRAME_HEIGHT));
+    grab = [&cap](cv::Mat& frame, qint64& deviceTimestampUs) {
+        cap >> frame;
+        deviceTimestampUs = static_cast<qint64>(cap.get(cv::CAP_PROP_POS_MSEC) * 1000.0);
+        return !frame.empty();
+    };
+    return true;
+}
+
+class EncodeFrameQueue {
+public:
+    explicit EncodeFrameQueue(int capacity) : frames(capacity) {}
+
+    bool push(const cv::Mat& frame, qint64 timestampUs) {
+        QMutexLocker locker(&mutex);
+        if (count == frames.size()) {
+            return false;
         }
-        qDebug() << "Record video from camera" << cameraIndex << "to file:" << filename;
-        for (int frameIndex = 0; frameIndex < totalFrames; ++frameIndex) {
+        EncodeFrame& slot = frames[(head + count) % frames.size()];
+        slot.frame = frame;
+        slot.timestampUs = timestampUs;
+        count++;
+        ready.wakeOne();
+        return true;
+    }
+
+    bool pop(cv::Mat& frame, qint64& timestampUs) {
+        QMutexLocker locker(&mutex);
+        while (count == 0 && !closed) {
+            ready.wait(&mutex);
+        }
+        if (count == 0) {
+            return false;
+        }
+        EncodeFrame& slot = frames[head];
+        frame = slot.frame;
+        timestampUs = slot.timestampUs;
+        slot.frame.release();
+        head = (head + 1) % frames.size();
+        count--;
+        return true;
+    }
+
+    void close() {
+        QMutexLocker locker(&mutex);
+        closed = true;
+        ready.wakeAll();
+    }
+
+    std::atomic<bool> failed { false };
+
+private:
+    struct EncodeFrame {
+        cv::Mat frame;
+        qint64 timestampUs = 0;
+    };
+
+    QMutex mutex;
+    QWaitCondition ready;
+    QVector<EncodeFrame> frames;
+    int head = 0;
+    int count = 0;
+    bool closed = false;
+};
+
+static const int encodeQueueFrames = 2;
+
+bool recordH264VideoFromCamera(int cameraIndex, const QString& filename, int durationSeconds, int fps,
+                               const H264Settings& settings, FrameSyncGroup* syncGroup) {
+    cv::VideoCapture cap;
+    std::function<bool(cv::Mat&, qint64&)> grab;
+    RawPixelFormat format = RawPixelFormat::Bgr;
+    int frameWidth = 0;
+    int frameHeight = 0;
+    if (!openFrameSource(cameraIndex, false, cap, grab, format, frameWidth, frameHeight, fps)) {
+        if (syncGroup) {
+            syncGroup->leave(cameraIndex);
+        }
+        return false;
+    }
+    H264Settings fileSettings = settings;
+    if (fileSettings.preallocateBytes <= 0) {
+        fileSettings.preallocateBytes = static_cast<qint64>(settings.bitrate) / 8 * durationSeconds * 5 / 4;
+    }
+    PipelineThreadPlacement encodePlacement(PipelineStage::Encode, cameraIndex);
+    H264Writer writer;
+    if (!writer.open(filename, frameWidth, frameHeight, fps, fileSettings)) {
+        qWarning() << "Could not open H.264 writer for camera" << cameraIndex;
+        cap.release();
+        if (syncGroup) {
+            syncGroup->leave(cameraIndex);
+        }
+        return false;
+    }
+    qDebug() << "Record H.264 video from camera" << cameraIndex << "to file:" << filename;
+    if (format == RawPixelFormat::Bgr) {
+        framePoolAllocator()->reserve(frameWidth, frameHeight, CV_8UC3, encodeQueueFrames + 2);
+    }
+    resetCameraSync(cameraIndex);
+    EncodeFrameQueue queue(encodeQueueFrames);
+    QThread* grabThread = QThread::create([&]() {
+        PipelineThreadPlacement grabPlacement(PipelineStage::Grab, cameraIndex);
+        int frameDurationMs = 1000 / fps;
+        int totalFrames = durationSeconds * fps;
+        int droppedFrames = 0;
+        if (syncGroup) {
+            syncGroup->waitForStart(cameraIndex);
+        }
+        for (int frameIndex = 0; frameIndex < totalFrames && !queue.failed.load(); ++frameIndex) {
             auto frameStartTime = std::chrono::high_resolution_clock::now();
 
             cv::Mat frame;
-            cap >> frame;
-
-            if (frame.empty()) {
+            frame.allocator = framePoolAllocator();
+            bool grabbed = false;
+            qint64 deviceTimestampUs = 0;
+            {
+                TRACE_SCOPE("h264_grab");
+                PipelineStageTimer grabTimer(PipelineStage::Grab, cameraIndex);
+                grabbed = grab(frame, deviceTimestampUs);
+            }
+            if (!grabbed) {
                 qWarning() << "Failed to capture frame from camera" << cameraIndex << "on frame" << frameIndex;
                 break;
             }
-            writer.write(frame);
+            qint64 captureTimeUs = syncedCaptureTimestampUs(cameraIndex, currentCaptureTimestampUs(), deviceTimestampUs);
+            if (!queue.push(frame, captureTimeUs)) {
+                droppedFrames++;
+            }
+            frame.release();
             auto frameEndTime = std::chrono::high_resolution_clock::now();
             auto elapsedTime = std::chrono::duration_cast<std::chrono::milliseconds>(frameEndTime - frameStartTime);
             int remainingTime = frameDurationMs - static_cast<int>(elapsedTime.count());
+            if (syncGroup) {
+                syncGroup->addFrame(cameraIndex, static_cast<quint32>(frameIndex), captureTimeUs);
+                remainingTime = static_cast<int>((syncGroup->frameDeadlineUs(frameIndex) - currentCaptureTimestampUs()) / 1000);
+            }
             if (remainingTime > 0) {
+                TRACE_SCOPE("frame_sleep");
                 QThread::msleep(remainingTime);
             }
         }
-        qDebug() << "Record video from camera" << cameraIndex << "completed.";
-        cap.release();
-        writer.release();
-        videoPaths.append(filename);
+        if (syncGroup) {
+            syncGroup->leave(cameraIndex);
+        }
+        if (droppedFrames > 0) {
+            qWarning() << "Encoder fell behind on camera" << cameraIndex << "- dropped" << droppedFrames << "frames.";
+        }
+        queue.close();
+    });
+    grabThread->start();
+    cv::Mat frame;
+    qint64 timestampUs = 0;
+    while (queue.pop(frame, timestampUs)) {
+        if (!queue.failed.load()) {
+            TRACE_SCOPE("h264_encode");
+            PipelineStageTimer encodeTimer(PipelineStage::Encode, cameraIndex);
+            if (!writer.writeRawFrame(frame, format, timestampUs)) {
+                qWarning() << "Failed to encode frame from camera" << cameraIndex;
+                queue.failed = true;
+            }
+        }
+        frame.release();
+    }
+    grabThread->wait();
+    delete grabThread;
+    grab = nullptr;
+    cap.release();
+    bool result = writer.close();
+    qDebug() << "Record H.264 video from camera" << cameraIndex << "completed.";
+    return result;
+}
+
+QList<QString> recordH264VideoFromAllCameras(const QString& basePath, int durationSeconds, int fps,
+                                             const H264Settings& settings) {
+    QList<QString> videoPaths;
+    QVector<int> cameras = getConnectedCameras();
+    if (cameras.isEmpty()) {
+        qWarning() << "No cameras found!";
+        return videoPaths;
     }
+    QDir dir(basePath);
+    if (!dir.exists()) {
+        if (!dir.mkpath(".")) {
+            qWarning() << "Failed to create directory:" << basePath;
+            return videoPaths;
+        }
+    }
+    H264Settings cameraSettings = settings;
+    if (cameraSettings.preset.isEmpty()) {
+        cameraSettings.preset = h264PresetForCameraCount(cameras.size());
+    }
+    if (cameraSettings.threads <= 0) {
+        cameraSettings.threads = h264ThreadsForCameraCount(cameras.size());
+    }
+    QString extension = cameraSettings.container == "mp4" ? "mp4" : "mkv";
+    QList<QThread*> threads;
+    QVector<bool> results(cameras.size(), false);
+    QStringList filenames;
+    QString syncPath = allocateRecordingPath(basePath, QString("sync_%1.csv").arg(getCurrentTimestampSV()));
+    FrameSyncGroup syncGroup(syncPath, cameras, fps);
+    for (int i = 0; i < cameras.size(); ++i) {
+        int cameraIndex = cameras.at(i);
+        QString filename = allocateRecordingPath(basePath, QString("video_camera_%1_%2.%3").arg(cameraIndex).arg(getCurrentTimestampSV()).arg(extension));
+        filenames.append(filename);
+        QThread* thread = QThread::create([&results, &syncGroup, i, cameraIndex, filename, durationSeconds, fps, cameraSettings]() {
+            results[i] = recordH264VideoFromCamera(cameraIndex, filename, durationSeconds, fps, cameraSettings, &syncGroup);
+        });
+        threads.append(thread);
+        thread->start();
+    }
+    for (int i = 0; i < threads.size(); ++i) {
+        threads.at(i)->wait();
+        delete threads.at(i);
+        if (results.at(i)) {
+            videoPaths.append(filenames.at(i));
+        }
+        releaseRecordingPath(filenames.at(i), results.at(i));
+    }
+    bool synced = syncGroup.finish() > 0;
+    if (synced) {
+        videoPaths.append(syncPath);
+    } else {
+        QFile::remove(syncPath);
+    }
+    releaseRecordingPath(syncPath, synced);
     return videoPaths;
 }
+
+QByteArray capturePhotoFromCamera(int cameraIndex, int jpegQuality) {
+    cv::VideoCapture cap;
+    std::function<bool(cv::Mat&, qint64&)> grab;
+    RawPixelFormat format = RawPixelFormat::Bgr;
+    int frameWidth = 0;
+    int frameHeight = 0;
+    if (!openFrameSource(cameraIndex, jpegQuality <= 0, cap, grab, format, frameWidth, frameHeight)) {
+        return QByteArray();
+    }
+    cv::Mat frame;
+    qint64 deviceTimestampUs = 0;
+    if (!grab(frame, deviceTimestampUs)) {
+        qWarning() << "Failed to capture frame from camera" << cameraIndex;
+        return QByteArray();
+    }
+    QByteArray photo = rawFrameToJpeg(frame, format, frameWidth, frameHeight, jpegQuality);
+    if (photo.isEmpty()) {
+        qWarning() << "Failed to encode photo for camera" << cameraIndex;
+    }
+    return photo;
+}
+
+QList<CaptureResult> captureBatch(const QList<CaptureRequest>& requests, const QString& basePath) {
+    QList<CaptureResult> results;
+    QDir dir(basePath);
+    if (!dir.exists() && !dir.mkpath(".")) {
+        qWarning() << "Failed to create directory:" << basePath;
+        return results;
+    }
+    QString timestamp = getCurrentTimestampSV();
+
+    for (const CaptureRequest& request : requests) {
+        if (request.video) {
+            continue;
+        }
+        QByteArray photo = capturePhotoFromCamera(request.cameraIndex, request.jpegQuality);
+        if (photo.isEmpty()) {
+            continue;
+        }
+        CaptureResult result;
+        result.fileName = QString("photo_camera_%1_%2.jpg").arg(request.cameraIndex).arg(timestamp);
+        result.data = photo;
+        results.append(result);
+    }
+
+    QList<CaptureRequest> videoRequests;
+    for (const CaptureRequest& request : requests) {
+        if (request.video) {
+            videoRequests.append(request);
+        }
+    }
+    if (videoRequests.isEmpty()) {
+        return results;
+    }
+    H264Settings settings;
+    settings.container = "mp4";
+    settings.preset = h264PresetForCameraCount(videoRequests.size());
+    settings.threads = h264ThreadsForCameraCount(videoRequests.size());
+    QList<QThread*> threads;
+    QVector<bool> recorded(videoRequests.size(), false);
+    QStringList fileNames;
+    QStringList filePaths;
+    for (int i = 0; i < videoRequests.size(); ++i) {
+        CaptureRequest request = videoRequests.at(i);
+        QString fileName = QString("video_camera_%1_%2.mp4").arg(request.cameraIndex).arg(timestamp);
+        QString filePath = allocateRecordingPath(basePath, fileName);
+        fileNames.append(fileName);
+        filePaths.append(filePath);
+        QThread* thread = QThread::create([&recorded, i, request, filePath, settings]() {
+            recorded[i] = recordH264VideoFromCamera(request.cameraIndex, filePath, request.durationSeconds,
+                                                    request.fps, settings);
+        });
+        threads.append(thread);
+        thread->start();
+    }
+    for (int i = 0; i < threads.size(); ++i) {
+        threads.at(i)->wait();
+        delete threads.at(i);
+        if (recorded.at(i)) {
+            CaptureResult result;
+            result.fileName = fileNames.at(i);
+            result.filePath = filePaths.at(i);
+            results.append(result);
+        }
+        releaseRecordingPath(filePaths.at(i), recorded.at(i));
+    }
+    return results;
+}
@@ -3,6 +3,28 @@
 #include <QVector>
 #include <QString>
 
+#include "h264writer.h"
+#include "rawframe.h"
+
+#include <functional>
+#include <opencv2/videoio.hpp>
+
+class FrameSyncGroup;
+
+struct CaptureRequest {
+    int cameraIndex = 0;
+    bool video = false;
+    int jpegQuality = 0;
+    int durationSeconds = 5;
+    int fps = 30;
+};
+
+struct CaptureResult {
+    QString fileName;
+    QByteArray data;
+    QString filePath;
+};
+
 QVector<int> getConnectedCameras();
 double getCameraFPS(int cameraIndex);
 void capturePhotoFromAllCameras(const QVector<int>& cameras, const QString& basePath);
@@ -10,3 +32,12 @@ void recordVideoAVI(const QVector<int>& cameras, const QString& basePath, int du
 void recordVideoMP4(const QVector<int>& cameras, const QString& basePath, int durationSeconds = 5, int fps = 30);
 QList<QPair<QString, QByteArray>> capturePhotoFromAllCameras();
 QList<QString> recordVideoFromAllCameras(const QString& basePath, int durationSeconds, int fps);
+bool recordH264VideoFromCamera(int cameraIndex, const QString& filename, int durationSeconds, int fps,
+                               const H264Settings& settings, FrameSyncGroup* syncGroup = nullptr);
+QList<QString> recordH264VideoFromAllCameras(const QString& basePath, int durationSeconds, int fps,
+                                             const H264Settings& settings);
+bool openFrameSource(int cameraIndex, bool preferCompressed, cv::VideoCapture& cap,
+                     std::function<bool(cv::Mat&, qint64&)>& grab, RawPixelFormat& format,
+                     int& frameWidth, int& frameHeight, int maxFps = 0);
+QByteArray capturePhotoFromCamera(int cameraIndex, int jpegQuality);
+QList<CaptureResult> captureBatch(const QList<CaptureRequest>& requests, const QString& basePath);
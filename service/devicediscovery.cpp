@@ -0,0 +1,79 @@
+#include "devicediscovery.h"
+
+#include <QMutex>
+#include <QDebug>
+#include <opencv2/videoio/registry.hpp>
+
+#ifdef Q_OS_WIN
+#include "cameraprocessing.h"
+#endif
+
+#ifdef Q_OS_LINUX
+#include "v4l2capture.h"
+#endif
+
+static QMutex cameraCacheMutex;
+static QVector<int> cameraCache;
+static bool cameraCacheValid = false;
+
+QVector<int> enumerateCameraIndices() {
+    QVector<int> cameras;
+#ifdef Q_OS_LINUX
+    for (const V4l2Device& device : enumerateV4l2Devices()) {
+        cameras.append(device.cameraIndex);
+    }
+#elif defined(Q_OS_WIN)
+    initializeWMF();
+    IMFAttributes* attributes = createCaptureAttributes(MF_DEVSOURCE_ATTRIBUTE_SOURCE_TYPE_VIDCAP_GUID);
+    UINT32 deviceCount = 0;
+    IMFActivate** devices = enumerateCaptureDevices(attributes, deviceCount);
+    for (UINT32 i = 0; i < deviceCount; ++i) {
+        cameras.append(static_cast<int>(i));
+    }
+    deleteDeviceList(devices, deviceCount);
+    deleteAttributes(attributes);
+    deinitializeWMF();
+#endif
+    return cameras;
+}
+
+bool cachedCameraIndices(QVector<int>& cameras) {
+    QMutexLocker locker(&cameraCacheMutex);
+    if (!cameraCacheValid) {
+        return false;
+    }
+    cameras = cameraCache;
+    return true;
+}
+
+void cacheCameraIndices(const QVector<int>& cameras) {
+    QMutexLocker locker(&cameraCacheMutex);
+    cameraCache = cameras;
+    cameraCacheValid = true;
+}
+
+void invalidateCameraIndices() {
+    QMutexLocker locker(&cameraCacheMutex);
+    cameraCacheValid = false;
+}
+
+bool warmUpCaptureBackends() {
+#ifdef Q_OS_WIN
+    initializeWMF();
+#endif
+    std::vector<cv::VideoCaptureAPIs> backends = cv::videoio_registry::getCameraBackends();
+    if (backends.empty()) {
+        qWarning() << "No OpenCV camera backends available.";
+        return false;
+    }
+    for (cv::VideoCaptureAPIs backend : backends) {
+        qDebug() << "Camera backend available:" << QString::fromStdString(cv::videoio_registry::getBackendName(backend));
+    }
+    return true;
+}
+
+void releaseCaptureBackends() {
+#ifdef Q_OS_WIN
+    deinitializeWMF();
+#endif
+}
@@ -0,0 +1,10 @@
+#pragma once
+
+#include <QVector>
+
+QVector<int> enumerateCameraIndices();
+bool cachedCameraIndices(QVector<int>& cameras);
+void cacheCameraIndices(const QVector<int>& cameras);
+void invalidateCameraIndices();
+bool warmUpCaptureBackends();
+void releaseCaptureBackends();
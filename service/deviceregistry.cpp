@@ -0,0 +1,287 @@
+#include "deviceregistry.h"
+#include "devicediscovery.h"
+
+#include <QDebug>
+#include <QTimer>
+#include <QVector>
+#include <algorithm>
+
+#ifdef Q_OS_LINUX
+#include "v4l2capture.h"
+
+#include <QFileInfo>
+#include <QSocketNotifier>
+#include <cstring>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <linux/netlink.h>
+#endif
+
+#ifdef Q_OS_WIN
+#include "cameraprocessing.h"
+
+#include <dbt.h>
+#include <ks.h>
+#include <ksmedia.h>
+#endif
+
+static const int refreshDelayMs = 500;
+
+#ifdef Q_OS_WIN
+static const wchar_t* notificationWindowClass = L"CameraDeviceNotifications";
+
+static LRESULT CALLBACK deviceNotificationProc(HWND window, UINT message, WPARAM wParam, LPARAM lParam) {
+    if (message == WM_DEVICECHANGE && (wParam == DBT_DEVICEARRIVAL || wParam == DBT_DEVICEREMOVECOMPLETE)) {
+        DeviceRegistry* registry = reinterpret_cast<DeviceRegistry*>(GetWindowLongPtrW(window, GWLP_USERDATA));
+        if (registry) {
+            registry->scheduleRefresh();
+        }
+        return TRUE;
+    }
+    return DefWindowProcW(window, message, wParam, lParam);
+}
+#endif
+
+
+QList<CameraDevice> scanCameraDevices() {
+    QList<CameraDevice> devices;
+#ifdef Q_OS_LINUX
+    for (const V4l2Device& v4l2Device : enumerateV4l2Devices()) {
+        CameraDevice device;
+        device.cameraIndex = v4l2Device.cameraIndex;
+        device.id = v4l2StableDeviceId(v4l2Device);
+        device.name = v4l2Device.name;
+        devices.append(device);
+    }
+#elif defined(Q_OS_WIN)
+    initializeWMF();
+    IMFAttributes* attributes = createCaptureAttributes(MF_DEVSOURCE_ATTRIBUTE_SOURCE_TYPE_VIDCAP_GUID);
+    UINT32 deviceCount = 0;
+    IMFActivate** videoDevices = enumerateCaptureDevices(attributes, deviceCount);
+    for (UINT32 i = 0; i < deviceCount; ++i) {
+        CameraDevice device;
+        device.cameraIndex = static_cast<int>(i);
+        device.id = getStableDeviceID(videoDevices[i]);
+        device.name = getDeviceName(videoDevices[i]);
+        devices.append(device);
+    }
+    deleteDeviceList(videoDevices, deviceCount);
+    deleteAttributes(attributes);
+    deinitializeWMF();
+#endif
+    QMap<QString, int> seen;
+    for (CameraDevice& device : devices) {
+        device.id.replace(':', '.');
+        int duplicate = seen.value(device.id, 0);
+        seen.insert(device.id, duplicate + 1);
+        if (duplicate > 0) {
+            device.id += QString("#%1").arg(duplicate);
+        }
+    }
+    return devices;
+}
+
+DeviceRegistry::DeviceRegistry(QObject* parent)
+    : QObject(parent) {
+    qRegisterMetaType<CameraDevice>("CameraDevice");
+    qRegisterMetaType<QList<CameraDevice>>("QList<CameraDevice>");
+}
+
+DeviceRegistry::~DeviceRegistry() {
+#ifdef Q_OS_LINUX
+    if (netlinkDescriptor >= 0) {
+        ::close(netlinkDescriptor);
+    }
+#endif
+#ifdef Q_OS_WIN
+    if (notificationHandle) {
+        UnregisterDeviceNotification(notificationHandle);
+    }
+    if (notificationWindow) {
+        DestroyWindow(notificationWindow);
+    }
+#endif
+}
+
+bool DeviceRegistry::startMonitoring() {
+#ifdef Q_OS_LINUX
+    netlinkDescriptor = ::socket(AF_NETLINK, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, NETLINK_KOBJECT_UEVENT);
+    if (netlinkDescriptor < 0) {
+        qWarning() << "Failed to open udev netlink socket.";
+        return false;
+    }
+    sockaddr_nl address = {};
+    address.nl_family = AF_NETLINK;
+    address.nl_groups = 1;
+    if (::bind(netlinkDescriptor, reinterpret_cast<sockaddr*>(&address), sizeof(address)) < 0) {
+        qWarning() << "Failed to bind udev netlink socket.";
+        ::close(netlinkDescriptor);
+        netlinkDescriptor = -1;
+        return false;
+    }
+    notifier = new QSocketNotifier(netlinkDescriptor, QSocketNotifier::Read, this);
+    connect(notifier, &QSocketNotifier::activated, this, &DeviceRegistry::onNetlinkActivated);
+    return true;
+#elif defined(Q_OS_WIN)
+    WNDCLASSW windowClass = {};
+    windowClass.lpfnWndProc = deviceNotificationProc;
+    windowClass.hInstance = GetModuleHandleW(nullptr);
+    windowClass.lpszClassName = notificationWindowClass;
+    RegisterClassW(&windowClass);
+    notificationWindow = CreateWindowExW(0, notificationWindowClass, notificationWindowClass, 0, 0, 0, 0, 0,
+                                         HWND_MESSAGE, nullptr, windowClass.hInstance, nullptr);
+    if (!notificationWindow) {
+        qWarning() << "Failed to create device notification window.";
+        return false;
+    }
+    SetWindowLongPtrW(notificationWindow, GWLP_USERDATA, reinterpret_cast<LONG_PTR>(this));
+    DEV_BROADCAST_DEVICEINTERFACE_W filter = {};
+    filter.dbcc_size = sizeof(filter);
+    filter.dbcc_devicetype = DBT_DEVTYP_DEVICEINTERFACE;
+    filter.dbcc_classguid = KSCATEGORY_VIDEO_CAMERA;
+    notificationHandle = RegisterDeviceNotificationW(notificationWindow, &filter, DEVICE_NOTIFY_WINDOW_HANDLE);
+    if (!notificationHandle) {
+        qWarning() << "Failed to register for device notifications.";
+        return false;
+    }
+    return true;
+#else
+    return false;
+#endif
+}
+
+QList<CameraDevice> DeviceRegistry::devices() const {
+    QMutexLocker locker(&mutex);
+    QList<CameraDevice> result = knownDevices.values();
+    std::sort(result.begin(), result.end(), [](const CameraDevice& a, const CameraDevice& b) {
+        return a.cameraIndex < b.cameraIndex;
+    });
+    return result;
+}
+
+int DeviceRegistry::cameraIndexForId(const QString& id) const {
+    QMutexLocker locker(&mutex);
+    return knownDevices.value(id).cameraIndex;
+}
+
+void DeviceRegistry::applySnapshot(const QList<CameraDevice>& snapshot) {
+    QMap<QString, CameraDevice> current;
+    for (const CameraDevice& device : snapshot) {
+        current.insert(device.id, device);
+    }
+    QList<QString> removed;
+    {
+        QMutexLocker locker(&mutex);
+        for (auto it = knownDevices.cbegin(); it != knownDevices.cend(); ++it) {
+            if (!current.contains(it.key()) || current.value(it.key()).cameraIndex != it.value().cameraIndex) {
+                removed.append(it.key());
+            }
+        }
+    }
+    for (const QString& id : removed) {
+        removeDevice(id);
+    }
+    for (const CameraDevice& device : snapshot) {
+        bool known = false;
+        {
+            QMutexLocker locker(&mutex);
+            known = knownDevices.contains(device.id);
+        }
+        if (!known) {
+            addDevice(device);
+        }
+    }
+    publishCameraIndices();
+}
+
+void DeviceRegistry::refresh() {
+    refreshPending = false;
+    applySnapshot(scanCameraDevices());
+}
+
+void DeviceRegistry::addDevice(const CameraDevice& device) {
+    {
+        QMutexLocker locker(&mutex);
+        knownDevices.insert(device.id, device);
+    }
+    qDebug() << "Camera added:" << device.id << device.name << "index" << device.cameraIndex;
+    emit deviceAdded(device);
+}
+
+void DeviceRegistry::removeDevice(const QString& id) {
+    CameraDevice device;
+    {
+        QMutexLocker locker(&mutex);
+        if (!knownDevices.contains(id)) {
+            return;
+        }
+        device = knownDevices.take(id);
+    }
+    qDebug() << "Camera removed:" << device.id << device.name;
+    emit deviceRemoved(device);
+}
+
+void DeviceRegistry::publishCameraIndices() {
+    QVector<int> cameras;
+    for (const CameraDevice& device : devices()) {
+        cameras.append(device.cameraIndex);
+    }
+    cacheCameraIndices(cameras);
+}
+
+void DeviceRegistry::scheduleRefresh() {
+    if (refreshPending) {
+        return;
+    }
+    refreshPending = true;
+    QTimer::singleShot(refreshDelayMs, this, &DeviceRegistry::refresh);
+}
+
+#ifdef Q_OS_LINUX
+void DeviceRegistry::onNetlinkActivated() {
+    char buffer[8192];
+    while (true) {
+        ssize_t received = ::recv(netlinkDescriptor, buffer, sizeof(buffer) - 1, 0);
+        if (received <= 0) {
+            return;
+        }
+        buffer[received] = '\0';
+        QString action;
+        QString subsystem;
+        QString deviceName;
+        for (const char* field = buffer; field < buffer + received; field += strlen(field) + 1) {
+            QByteArray entry(field);
+            if (entry.startsWith("ACTION=")) {
+                action = QString::fromUtf8(entry.mid(7));
+            } else if (entry.startsWith("SUBSYSTEM=")) {
+                subsystem = QString::fromUtf8(entry.mid(10));
+            } else if (entry.startsWith("DEVNAME=")) {
+                deviceName = QString::fromUtf8(entry.mid(8));
+            }
+        }
+        if (subsystem != "video4linux" || deviceName.isEmpty()) {
+            continue;
+        }
+        QString devicePath = deviceName.startsWith('/') ? deviceName : "/dev/" + deviceName;
+        if (action == "add") {
+            scheduleRefresh();
+        } else if (action == "remove") {
+            QString removedId;
+            {
+                QMutexLocker locker(&mutex);
+                int cameraIndex = QFileInfo(devicePath).fileName().mid(5).toInt();
+                for (auto it = knownDevices.cbegin(); it != knownDevices.cend(); ++it) {
+                    if (it.value().cameraIndex == cameraIndex) {
+                        removedId = it.key();
+                        break;
+                    }
+                }
+            }
+            if (!removedId.isEmpty()) {
+                removeDevice(removedId);
+                publishCameraIndices();
+            }
+        }
+    }
+}
+#endif
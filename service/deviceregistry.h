@@ -0,0 +1,63 @@
+#pragma once
+
+#include <QMap>
+#include <QList>
+#include <QMutex>
+#include <QObject>
+#include <QString>
+
+#ifdef Q_OS_WIN
+#include <windows.h>
+#endif
+
+class QSocketNotifier;
+
+struct CameraDevice {
+    QString id;
+    int cameraIndex = -1;
+    QString name;
+};
+
+Q_DECLARE_METATYPE(CameraDevice)
+
+QList<CameraDevice> scanCameraDevices();
+
+class DeviceRegistry : public QObject {
+    Q_OBJECT
+
+public:
+    explicit DeviceRegistry(QObject* parent = nullptr);
+    ~DeviceRegistry();
+
+    bool startMonitoring();
+    QList<CameraDevice> devices() const;
+    int cameraIndexForId(const QString& id) const;
+
+public slots:
+    void applySnapshot(const QList<CameraDevice>& snapshot);
+    void refresh();
+    void scheduleRefresh();
+
+signals:
+    void deviceAdded(const CameraDevice& device);
+    void deviceRemoved(const CameraDevice& device);
+
+private:
+    mutable QMutex mutex;
+    QMap<QString, CameraDevice> knownDevices;
+    bool refreshPending = false;
+
+    void addDevice(const CameraDevice& device);
+    void removeDevice(const QString& id);
+    void publishCameraIndices();
+
+#ifdef Q_OS_LINUX
+    int netlinkDescriptor = -1;
+    QSocketNotifier* notifier = nullptr;
+    void onNetlinkActivated();
+#endif
+#ifdef Q_OS_WIN
+    HWND notificationWindow = nullptr;
+    HDEVNOTIFY notificationHandle = nullptr;
+#endif
+};
@@ -0,0 +1,118 @@
+#include "framepool.h"
+
+#include <QDebug>
+#include <QtGlobal>
+
+static const size_t frameBufferAlignment = 64;
+static const int maxFreeBuffersPerSize = 16;
+
+FramePoolAllocator::~FramePoolAllocator() {
+    QMutexLocker locker(&mutex);
+    for (auto it = freeBuffers.begin(); it != freeBuffers.end(); ++it) {
+        for (uchar* buffer : std::as_const(it.value())) {
+            qFreeAligned(buffer);
+        }
+    }
+    freeBuffers.clear();
+    freeBytes = 0;
+}
+
+cv::UMatData* FramePoolAllocator::allocate(int dims, const int* sizes, int type, void* data0, size_t* step,
+                                           cv::AccessFlag, cv::UMatUsageFlags) const {
+    size_t total = CV_ELEM_SIZE(type);
+    for (int i = dims - 1; i >= 0; i--) {
+        if (step) {
+            if (data0 && step[i] != CV_AUTOSTEP) {
+                total = step[i];
+            } else {
+                step[i] = total;
+            }
+        }
+        total *= sizes[i];
+    }
+    uchar* data = data0 ? static_cast<uchar*>(data0) : acquire(total);
+    if (!data) {
+        CV_Error(cv::Error::StsNoMem, "Failed to allocate pooled frame buffer");
+    }
+    cv::UMatData* u = new cv::UMatData(this);
+    u->data = u->origdata = data;
+    u->size = total;
+    if (data0) {
+        u->flags |= cv::UMatData::USER_ALLOCATED;
+    }
+    return u;
+}
+
+bool FramePoolAllocator::allocate(cv::UMatData* data, cv::AccessFlag, cv::UMatUsageFlags) const {
+    return data != nullptr;
+}
+
+void FramePoolAllocator::deallocate(cv::UMatData* u) const {
+    if (!u) {
+        return;
+    }
+    CV_Assert(u->urefcount == 0);
+    CV_Assert(u->refcount == 0);
+    if (!(u->flags & cv::UMatData::USER_ALLOCATED)) {
+        recycle(u->origdata, u->size);
+        u->origdata = nullptr;
+    }
+    delete u;
+}
+
+void FramePoolAllocator::reserve(int width, int height, int type, int count) {
+    size_t size = static_cast<size_t>(width) * static_cast<size_t>(height) * CV_ELEM_SIZE(type);
+    if (size == 0) {
+        return;
+    }
+    QMutexLocker locker(&mutex);
+    QVector<uchar*>& buffers = freeBuffers[size];
+    while (buffers.size() < count && buffers.size() < maxFreeBuffersPerSize) {
+        uchar* buffer = static_cast<uchar*>(qMallocAligned(size, frameBufferAlignment));
+        if (!buffer) {
+            qWarning() << "Failed to preallocate frame buffer of" << size << "bytes";
+            return;
+        }
+        buffers.append(buffer);
+        freeBytes += size;
+    }
+}
+
+size_t FramePoolAllocator::pooledBytes() const {
+    QMutexLocker locker(&mutex);
+    return freeBytes;
+}
+
+uchar* FramePoolAllocator::acquire(size_t size) const {
+    {
+        QMutexLocker locker(&mutex);
+        auto it = freeBuffers.find(size);
+        if (it != freeBuffers.end() && !it.value().isEmpty()) {
+            uchar* buffer = it.value().takeLast();
+            freeBytes -= size;
+            return buffer;
+        }
+    }
+    return static_cast<uchar*>(qMallocAligned(size, frameBufferAlignment));
+}
+
+void FramePoolAllocator::recycle(uchar* data, size_t size) const {
+    if (!data) {
+        return;
+    }
+    {
+        QMutexLocker locker(&mutex);
+        QVector<uchar*>& buffers = freeBuffers[size];
+        if (buffers.size() < maxFreeBuffersPerSize) {
+            buffers.append(data);
+            freeBytes += size;
+            return;
+        }
+    }
+    qFreeAligned(data);
+}
+
+FramePoolAllocator* framePoolAllocator() {
+    static FramePoolAllocator allocator;
+    return &allocator;
+}
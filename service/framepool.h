@@ -0,0 +1,30 @@
+#pragma once
+
+#include <QMap>
+#include <QMutex>
+#include <QVector>
+#include <opencv2/core.hpp>
+
+class FramePoolAllocator : public cv::MatAllocator {
+public:
+    FramePoolAllocator() = default;
+    ~FramePoolAllocator() override;
+
+    cv::UMatData* allocate(int dims, const int* sizes, int type, void* data, size_t* step,
+                           cv::AccessFlag flags, cv::UMatUsageFlags usageFlags) const override;
+    bool allocate(cv::UMatData* data, cv::AccessFlag accessFlags, cv::UMatUsageFlags usageFlags) const override;
+    void deallocate(cv::UMatData* data) const override;
+
+    void reserve(int width, int height, int type, int count);
+    size_t pooledBytes() const;
+
+private:
+    uchar* acquire(size_t size) const;
+    void recycle(uchar* data, size_t size) const;
+
+    mutable QMutex mutex;
+    mutable QMap<size_t, QVector<uchar*>> freeBuffers;
+    mutable size_t freeBytes = 0;
+};
+
+FramePoolAllocator* framePoolAllocator();
@@ -0,0 +1,259 @@
+#include "framesync.h"
+#include "recordingindex.h"
+
+#include <QDebug>
+#include <QDeadlineTimer>
+#include <climits>
+#include <cmath>
+
+struct CameraSyncState {
+    qint64 offsetUs = 0;
+    bool hasBaseline = false;
+    qint64 baselineUs = 0;
+    qint64 frames = 0;
+    qint64 jitterTotalUs = 0;
+    qint64 maxJitterUs = 0;
+    bool deviceClock = false;
+};
+
+static const qint64 baselineResetUs = 1000000;
+static const int baselineDriftShift = 10;
+
+static QMutex syncMutex;
+static QMap<int, CameraSyncState> syncStates;
+
+void setCameraLatencyOffset(int cameraIndex, qint64 offsetUs) {
+    QMutexLocker locker(&syncMutex);
+    syncStates[cameraIndex].offsetUs = offsetUs;
+}
+
+qint64 syncedCaptureTimestampUs(int cameraIndex, qint64 arrivalUs, qint64 deviceTimestampUs) {
+    QMutexLocker locker(&syncMutex);
+    CameraSyncState& state = syncStates[cameraIndex];
+    state.frames++;
+    if (deviceTimestampUs <= 0) {
+        state.deviceClock = false;
+        return arrivalUs - state.offsetUs;
+    }
+    qint64 deltaUs = arrivalUs - deviceTimestampUs;
+    if (!state.hasBaseline || qAbs(deltaUs - state.baselineUs) > baselineResetUs) {
+        state.baselineUs = deltaUs;
+        state.hasBaseline = true;
+    } else if (deltaUs < state.baselineUs) {
+        state.baselineUs = deltaUs;
+    } else {
+        state.baselineUs += (deltaUs - state.baselineUs) >> baselineDriftShift;
+    }
+    qint64 jitterUs = deltaUs - state.baselineUs;
+    state.jitterTotalUs += jitterUs;
+    state.maxJitterUs = qMax(state.maxJitterUs, jitterUs);
+    state.deviceClock = true;
+    return deviceTimestampUs + state.baselineUs - state.offsetUs;
+}
+
+void resetCameraSync(int cameraIndex) {
+    QMutexLocker locker(&syncMutex);
+    CameraSyncState& state = syncStates[cameraIndex];
+    qint64 offsetUs = state.offsetUs;
+    state = CameraSyncState();
+    state.offsetUs = offsetUs;
+}
+
+QList<CameraSyncStats> cameraSyncStats() {
+    QMutexLocker locker(&syncMutex);
+    QList<CameraSyncStats> result;
+    for (auto it = syncStates.constBegin(); it != syncStates.constEnd(); ++it) {
+        CameraSyncStats stats;
+        stats.cameraIndex = it.key();
+        stats.frames = it->frames;
+        stats.offsetUs = it->offsetUs;
+        stats.averageJitterUs = it->frames > 0 ? it->jitterTotalUs / it->frames : 0;
+        stats.maxJitterUs = it->maxJitterUs;
+        stats.deviceClock = it->deviceClock;
+        result.append(stats);
+    }
+    return result;
+}
+
+FrameSyncGroup::FrameSyncGroup(const QString& sidecarPath, const QVector<int>& cameras, int fps, qint64 maxSkewUs)
+    : file(sidecarPath),
+      cameraIndices(cameras),
+      periodUs(1000000 / qMax(1, fps)),
+      skewLimitUs(maxSkewUs > 0 ? maxSkewUs : periodUs / 2),
+      pendingStarts(cameras.size()),
+      latestSlots(cameras.size(), LLONG_MIN),
+      started(cameras.size(), false),
+      departed(cameras.size(), false),
+      lastWrittenSlot(LLONG_MIN) {
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate | QIODevice::Text)) {
+        qWarning() << "Failed to open frame sync index:" << sidecarPath;
+        return;
+    }
+    QByteArray header = QString("# fps=%1 max_skew_us=%2\ntimestamp_us").arg(fps).arg(skewLimitUs).toUtf8();
+    for (int cameraIndex : cameraIndices) {
+        header += QString(",camera_%1").arg(cameraIndex).toUtf8();
+    }
+    header += ",skew_us\n";
+    file.write(header);
+}
+
+FrameSyncGroup::~FrameSyncGroup() {
+    finish();
+}
+
+void FrameSyncGroup::waitForStart(int cameraIndex, int timeoutMs) {
+    QMutexLocker locker(&mutex);
+    int position = cameraIndices.indexOf(cameraIndex);
+    if (position >= 0 && !started.at(position)) {
+        started[position] = true;
+        pendingStarts--;
+    }
+    QDeadlineTimer deadline(timeoutMs);
+    while (pendingStarts > 0) {
+        if (!startCondition.wait(&mutex, deadline)) {
+            qWarning() << "Frame sync start timed out, starting without" << pendingStarts << "camera(s).";
+            pendingStarts = 0;
+            break;
+        }
+    }
+    if (startUs == 0) {
+        startUs = currentCaptureTimestampUs();
+        startCondition.wakeAll();
+    }
+}
+
+void FrameSyncGroup::leave(int cameraIndex) {
+    QMutexLocker locker(&mutex);
+    int position = cameraIndices.indexOf(cameraIndex);
+    if (position < 0 || departed.at(position)) {
+        return;
+    }
+    departed[position] = true;
+    if (!started.at(position)) {
+        started[position] = true;
+        if (--pendingStarts == 0) {
+            startCondition.wakeAll();
+        }
+    }
+    writeReadySlots(false);
+}
+
+qint64 FrameSyncGroup::frameDeadlineUs(int frameIndex) const {
+    return startUs + static_cast<qint64>(frameIndex + 1) * periodUs;
+}
+
+void FrameSyncGroup::addFrame(int cameraIndex, quint32 frameNumber, qint64 timestampUs) {
+    QMutexLocker locker(&mutex);
+    int position = cameraIndices.indexOf(cameraIndex);
+    if (position < 0 || !file.isOpen()) {
+        return;
+    }
+    qint64 slot = std::llround(static_cast<double>(timestampUs - startUs) / periodUs);
+    if (slot <= lastWrittenSlot) {
+        lateFrames++;
+        return;
+    }
+    QVector<SyncedFrame>& frames = pendingSlots[slot];
+    if (frames.isEmpty()) {
+        frames.resize(cameraIndices.size());
+    }
+    qint64 slotTimeUs = startUs + slot * periodUs;
+    SyncedFrame& current = frames[position];
+    if (current.frameNumber < 0 || qAbs(timestampUs - slotTimeUs) < qAbs(current.timestampUs - slotTimeUs)) {
+        current.frameNumber = frameNumber;
+        current.timestampUs = timestampUs;
+    }
+    latestSlots[position] = qMax(latestSlots.at(position), slot);
+    writeReadySlots(false);
+}
+
+int FrameSyncGroup::finish() {
+    QMutexLocker locker(&mutex);
+    if (!file.isOpen()) {
+        return writtenGroups;
+    }
+    writeReadySlots(true);
+    file.close();
+    qDebug() << "Frame sync index" << file.fileName() << "has" << writtenGroups << "groups," << completeGroups
+             << "complete," << lateFrames << "late frames," << skewedFrames << "frames over the skew limit.";
+    return writtenGroups;
+}
+
+void FrameSyncGroup::writeSlot(qint64 slot, const QVector<SyncedFrame>& frames) {
+    qint64 slotTimeUs = startUs + slot * periodUs;
+    qint64 windowStartUs = LLONG_MIN;
+    int windowCount = 0;
+    for (const SyncedFrame& first : frames) {
+        if (first.frameNumber < 0) {
+            continue;
+        }
+        int count = 0;
+        for (const SyncedFrame& frame : frames) {
+            if (frame.frameNumber >= 0 && frame.timestampUs >= first.timestampUs &&
+                frame.timestampUs - first.timestampUs <= skewLimitUs) {
+                count++;
+            }
+        }
+        if (count > windowCount ||
+            (count == windowCount && qAbs(first.timestampUs + skewLimitUs / 2 - slotTimeUs) <
+                                         qAbs(windowStartUs + skewLimitUs / 2 - slotTimeUs))) {
+            windowStartUs = first.timestampUs;
+            windowCount = count;
+        }
+    }
+    qint64 earliestUs = LLONG_MAX;
+    qint64 latestUs = LLONG_MIN;
+    int matched = 0;
+    QByteArray line = QByteArray::number(slotTimeUs);
+    for (const SyncedFrame& frame : frames) {
+        line += ',';
+        if (frame.frameNumber < 0) {
+            continue;
+        }
+        if (frame.timestampUs < windowStartUs || frame.timestampUs - windowStartUs > skewLimitUs) {
+            skewedFrames++;
+            continue;
+        }
+        line += QByteArray::number(frame.frameNumber);
+        earliestUs = qMin(earliestUs, frame.timestampUs);
+        latestUs = qMax(latestUs, frame.timestampUs);
+        matched++;
+    }
+    if (matched == 0) {
+        return;
+    }
+    line += ',';
+    line += QByteArray::number(latestUs - earliestUs);
+    line += '\n';
+    file.write(line);
+    writtenGroups++;
+    if (matched == frames.size()) {
+        completeGroups++;
+    }
+}
+
+void FrameSyncGroup::writeReadySlots(bool all) {
+    if (!file.isOpen()) {
+        return;
+    }
+    qint64 oldestLatestSlot = LLONG_MAX;
+    for (int i = 0; i < cameraIndices.size(); ++i) {
+        if (!departed.at(i)) {
+            oldestLatestSlot = qMin(oldestLatestSlot, latestSlots.at(i));
+        }
+    }
+    qint64 settledSlot = oldestLatestSlot == LLONG_MIN ? LLONG_MIN : oldestLatestSlot - 1;
+    while (!pendingSlots.isEmpty()) {
+        auto it = pendingSlots.begin();
+        bool complete = true;
+        for (const SyncedFrame& frame : it.value()) {
+            complete = complete && frame.frameNumber >= 0;
+        }
+        if (!all && !complete && it.key() >= settledSlot) {
+            break;
+        }
+        writeSlot(it.key(), it.value());
+        lastWrittenSlot = it.key();
+        pendingSlots.erase(it);
+    }
+}
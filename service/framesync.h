@@ -0,0 +1,62 @@
+#pragma once
+
+#include <QFile>
+#include <QList>
+#include <QMap>
+#include <QMutex>
+#include <QString>
+#include <QVector>
+#include <QWaitCondition>
+
+struct CameraSyncStats {
+    int cameraIndex = -1;
+    qint64 frames = 0;
+    qint64 offsetUs = 0;
+    qint64 averageJitterUs = 0;
+    qint64 maxJitterUs = 0;
+    bool deviceClock = false;
+};
+
+void setCameraLatencyOffset(int cameraIndex, qint64 offsetUs);
+qint64 syncedCaptureTimestampUs(int cameraIndex, qint64 arrivalUs, qint64 deviceTimestampUs);
+void resetCameraSync(int cameraIndex);
+QList<CameraSyncStats> cameraSyncStats();
+
+class FrameSyncGroup {
+public:
+    FrameSyncGroup(const QString& sidecarPath, const QVector<int>& cameras, int fps, qint64 maxSkewUs = 0);
+    ~FrameSyncGroup();
+
+    void waitForStart(int cameraIndex, int timeoutMs = 5000);
+    void leave(int cameraIndex);
+    qint64 frameDeadlineUs(int frameIndex) const;
+    void addFrame(int cameraIndex, quint32 frameNumber, qint64 timestampUs);
+    int finish();
+
+private:
+    struct SyncedFrame {
+        qint64 frameNumber = -1;
+        qint64 timestampUs = 0;
+    };
+
+    QFile file;
+    QVector<int> cameraIndices;
+    qint64 periodUs;
+    qint64 skewLimitUs;
+    qint64 startUs = 0;
+    int pendingStarts;
+    QMutex mutex;
+    QWaitCondition startCondition;
+    QMap<qint64, QVector<SyncedFrame>> pendingSlots;
+    QVector<qint64> latestSlots;
+    QVector<bool> started;
+    QVector<bool> departed;
+    qint64 lastWrittenSlot;
+    int writtenGroups = 0;
+    int completeGroups = 0;
+    int lateFrames = 0;
+    int skewedFrames = 0;
+
+    void writeSlot(qint64 slot, const QVector<SyncedFrame>& frames);
+    void writeReadySlots(bool all);
+};
@@ -0,0 +1,375 @@
+#include "h264writer.h"
+#include "recordingregistry.h"
+#include "tracing.h"
+
+#include <QDebug>
+#include <QThread>
+
+extern "C" {
+#include <libavcodec/avcodec.h>
+#include <libavformat/avformat.h>
+#include <libavutil/opt.h>
+#include <libavutil/imgutils.h>
+#include <libswscale/swscale.h>
+}
+
+QString h264PresetForCameraCount(int cameraCount) {
+    if (cameraCount <= 1) {
+        return "faster";
+    }
+    if (cameraCount <= 2) {
+        return "veryfast";
+    }
+    if (cameraCount <= 4) {
+        return "superfast";
+    }
+    return "ultrafast";
+}
+
+int h264ThreadsForCameraCount(int cameraCount) {
+    int cores = QThread::idealThreadCount();
+    if (cameraCount <= 0 || cores <= 0) {
+        return 1;
+    }
+    return qMax(1, cores / cameraCount);
+}
+
+static const int storageIoBufferSize = 64 * 1024;
+static const int pendingTimestampSlots = 512;
+
+#if LIBAVFORMAT_VERSION_MAJOR >= 61
+static int writeStoragePacket(void* opaque, const uint8_t* data, int size) {
+#else
+static int writeStoragePacket(void* opaque, uint8_t* data, int size) {
+#endif
+    BlockWriter* storage = static_cast<BlockWriter*>(opaque);
+    return storage->write(reinterpret_cast<const char*>(data), size) ? size : AVERROR(EIO);
+}
+
+static int64_t seekStorage(void* opaque, int64_t offset, int whence) {
+    BlockWriter* storage = static_cast<BlockWriter*>(opaque);
+    switch (whence & ~AVSEEK_FORCE) {
+    case AVSEEK_SIZE:
+        return storage->size();
+    case SEEK_SET:
+        break;
+    case SEEK_CUR:
+        offset += storage->position();
+        break;
+    case SEEK_END:
+        offset += storage->size();
+        break;
+    default:
+        return AVERROR(EINVAL);
+    }
+    return storage->seek(offset) ? offset : AVERROR(EINVAL);
+}
+
+H264Writer::~H264Writer() {
+    if (formatContext) {
+        close();
+    }
+}
+
+bool H264Writer::open(const QString& outputPath, int width, int height, int fps, const H264Settings& settings) {
+    QByteArray path = outputPath.toUtf8();
+    fragmented = settings.container == "fmp4" && settings.fragmentFrames > 0;
+    const char* formatName = settings.container == "mp4" || fragmented ? "mp4" : "matroska";
+    if (avformat_alloc_output_context2(&formatContext, nullptr, formatName, path.constData()) < 0 || !formatContext) {
+        qWarning() << "Failed to create output context for" << outputPath;
+        return false;
+    }
+    const AVCodec* codec = avcodec_find_encoder_by_name("libx264");
+    if (!codec) {
+        codec = avcodec_find_encoder(AV_CODEC_ID_H264);
+    }
+    if (!codec) {
+        qWarning() << "No H.264 encoder available";
+        release();
+        return false;
+    }
+    stream = avformat_new_stream(formatContext, nullptr);
+    codecContext = avcodec_alloc_context3(codec);
+    if (!stream || !codecContext) {
+        qWarning() << "Failed to allocate H.264 stream for" << outputPath;
+        release();
+        return false;
+    }
+    codecContext->width = width;
+    codecContext->height = height;
+    codecContext->time_base = AVRational{ 1, fps };
+    codecContext->framerate = AVRational{ fps, 1 };
+    codecContext->pix_fmt = AV_PIX_FMT_YUV420P;
+    codecContext->gop_size = fragmented ? qMin(settings.gopSize, settings.fragmentFrames) : settings.gopSize;
+    codecContext->max_b_frames = 0;
+    codecContext->bit_rate = settings.bitrate;
+    codecContext->thread_count = settings.threads > 0 ? settings.threads : h264ThreadsForCameraCount(1);
+    if (formatContext->oformat->flags & AVFMT_GLOBALHEADER) {
+        codecContext->flags |= AV_CODEC_FLAG_GLOBAL_HEADER;
+    }
+    QByteArray preset = (settings.preset.isEmpty() ? h264PresetForCameraCount(1) : settings.preset).toUtf8();
+    av_opt_set(codecContext->priv_data, "preset", preset.constData(), 0);
+    if (avcodec_open2(codecContext, codec, nullptr) < 0) {
+        qWarning() << "Failed to open H.264 encoder for" << outputPath;
+        release();
+        return false;
+    }
+    if (avcodec_parameters_from_context(stream->codecpar, codecContext) < 0) {
+        qWarning() << "Failed to copy H.264 encoder parameters for" << outputPath;
+        release();
+        return false;
+    }
+    stream->time_base = codecContext->time_base;
+    if (!(formatContext->oformat->flags & AVFMT_NOFILE) && !openStorage(outputPath, settings)) {
+        qWarning() << "Failed to open output file" << outputPath;
+        release();
+        return false;
+    }
+    AVDictionary* options = nullptr;
+    if (fragmented) {
+        av_dict_set(&options, "movflags", "frag_custom+empty_moov+default_base_moof", 0);
+    }
+    int headerStatus = avformat_write_header(formatContext, &options);
+    av_dict_free(&options);
+    if (headerStatus < 0) {
+        qWarning() << "Failed to write container header for" << outputPath;
+        release();
+        return false;
+    }
+    frame = av_frame_alloc();
+    packet = av_packet_alloc();
+    if (!frame || !packet) {
+        qWarning() << "Failed to allocate H.264 frame buffers for" << outputPath;
+        release();
+        return false;
+    }
+    frame->format = codecContext->pix_fmt;
+    frame->width = width;
+    frame->height = height;
+    if (av_frame_get_buffer(frame, 0) < 0) {
+        qWarning() << "Failed to allocate H.264 frame data for" << outputPath;
+        release();
+        return false;
+    }
+    frameCount = 0;
+    fragmentPackets = 0;
+    pendingTimestamps.fill(PendingTimestamp(), pendingTimestampSlots);
+    filePath = outputPath;
+    fragmentFrames = settings.fragmentFrames;
+    if (fragmented) {
+        beginActiveRecording(filePath);
+        avio_flush(formatContext->pb);
+        storage->flush();
+        index.open(outputPath, true, static_cast<quint64>(avio_tell(formatContext->pb)));
+    } else {
+        index.open(outputPath, false);
+    }
+    qDebug() << "H.264 writer opened:" << outputPath << "preset:" << preset
+             << "threads:" << codecContext->thread_count << "bitrate:" << settings.bitrate
+             << "gop:" << settings.gopSize;
+    return true;
+}
+
+bool H264Writer::openStorage(const QString& outputPath, const H264Settings& settings) {
+    storage = new BlockWriter();
+    if (!storage->open(outputPath, settings.preallocateBytes, settings.directIo)) {
+        return false;
+    }
+    unsigned char* ioBuffer = static_cast<unsigned char*>(av_malloc(storageIoBufferSize));
+    if (!ioBuffer) {
+        return false;
+    }
+    formatContext->pb = avio_alloc_context(ioBuffer, storageIoBufferSize, 1, storage, nullptr,
+                                           writeStoragePacket, seekStorage);
+    if (!formatContext->pb) {
+        av_free(ioBuffer);
+        return false;
+    }
+    formatContext->flags |= AVFMT_FLAG_CUSTOM_IO;
+    return true;
+}
+
+bool H264Writer::writeFrame(const cv::Mat& image, qint64 timestampUs) {
+    if (!codecContext || image.empty() || image.type() != CV_8UC3) {
+        return false;
+    }
+    const uint8_t* sourceData[4] = { image.data, nullptr, nullptr, nullptr };
+    int sourceStride[4] = { static_cast<int>(image.step[0]), 0, 0, 0 };
+    return convertAndEncode(sourceData, sourceStride, AV_PIX_FMT_BGR24, image.cols, image.rows, timestampUs);
+}
+
+bool H264Writer::writeRawFrame(const cv::Mat& raw, RawPixelFormat format, qint64 timestampUs) {
+    if (!codecContext || raw.empty()) {
+        return false;
+    }
+    AVPixelFormat sourceFormat = AV_PIX_FMT_NONE;
+    switch (format) {
+    case RawPixelFormat::Yuyv:
+        sourceFormat = AV_PIX_FMT_YUYV422;
+        break;
+    case RawPixelFormat::Nv12:
+        sourceFormat = AV_PIX_FMT_NV12;
+        break;
+    case RawPixelFormat::I420:
+        sourceFormat = AV_PIX_FMT_YUV420P;
+        break;
+    case RawPixelFormat::Bgr:
+        return writeFrame(raw, timestampUs);
+    case RawPixelFormat::Mjpeg: {
+        thread_local cv::Mat decoded;
+        if (!rawFrameToBgr(raw, format, codecContext->width, codecContext->height, decoded)) {
+            return false;
+        }
+        return writeFrame(decoded, timestampUs);
+    }
+    }
+    int width = codecContext->width;
+    int height = codecContext->height;
+    if (!raw.isContinuous() ||
+        static_cast<qint64>(raw.total() * raw.elemSize()) < rawFrameSize(format, width, height)) {
+        qWarning() << "Raw frame does not match the H.264 encoder size";
+        return false;
+    }
+    uint8_t* sourceData[4] = { nullptr, nullptr, nullptr, nullptr };
+    int sourceStride[4] = { 0, 0, 0, 0 };
+    if (av_image_fill_arrays(sourceData, sourceStride, raw.data, sourceFormat, width, height, 1) < 0) {
+        return false;
+    }
+    return convertAndEncode(sourceData, sourceStride, sourceFormat, width, height, timestampUs);
+}
+
+bool H264Writer::convertAndEncode(const uint8_t* const sourceData[], const int sourceStride[], int sourceFormat,
+                                  int width, int height, qint64 timestampUs) {
+    if (av_frame_make_writable(frame) < 0) {
+        qWarning() << "Failed to prepare frame for H.264 encoding";
+        return false;
+    }
+    AVPixelFormat format = static_cast<AVPixelFormat>(sourceFormat);
+    if (format == codecContext->pix_fmt && width == codecContext->width && height == codecContext->height) {
+        av_image_copy(frame->data, frame->linesize, const_cast<const uint8_t**>(sourceData), sourceStride,
+                      format, width, height);
+    } else {
+        swsContext = sws_getCachedContext(swsContext, width, height, format,
+                                          codecContext->width, codecContext->height, codecContext->pix_fmt,
+                                          SWS_BILINEAR, nullptr, nullptr, nullptr);
+        if (!swsContext) {
+            qWarning() << "Failed to prepare frame for H.264 encoding";
+            return false;
+        }
+        sws_scale(swsContext, sourceData, sourceStride, 0, height, frame->data, frame->linesize);
+    }
+    frame->pts = frameCount++;
+    PendingTimestamp& pending = pendingTimestamps[frame->pts % pendingTimestamps.size()];
+    pending.pts = frame->pts;
+    pending.timestampUs = timestampUs;
+    return encode(frame);
+}
+
+bool H264Writer::encode(AVFrame* input) {
+    TRACE_SCOPE("h264_codec");
+    if (avcodec_send_frame(codecContext, input) < 0) {
+        qWarning() << "Failed to send frame to H.264 encoder";
+        return false;
+    }
+    while (true) {
+        int status = avcodec_receive_packet(codecContext, packet);
+        if (status == AVERROR(EAGAIN) || status == AVERROR_EOF) {
+            return true;
+        }
+        if (status < 0) {
+            qWarning() << "Failed to receive packet from H.264 encoder";
+            return false;
+        }
+        qint64 pts = packet->pts;
+        quint32 size = static_cast<quint32>(packet->size);
+        bool keyframe = packet->flags & AV_PKT_FLAG_KEY;
+        if (fragmented && keyframe && fragmentPackets >= fragmentFrames && !flushFragment()) {
+            return false;
+        }
+        qint64 offset = fragmented ? avio_tell(formatContext->pb) : 0;
+        bool seekable = keyframe && (!fragmented || fragmentPackets == 0);
+        av_packet_rescale_ts(packet, codecContext->time_base, stream->time_base);
+        packet->stream_index = stream->index;
+        if (av_interleaved_write_frame(formatContext, packet) < 0) {
+            qWarning() << "Failed to write H.264 packet";
+            return false;
+        }
+        index.append(static_cast<quint32>(pts), takePendingTimestamp(pts), offset, size, seekable);
+        fragmentPackets++;
+    }
+}
+
+qint64 H264Writer::takePendingTimestamp(qint64 pts) {
+    if (pts < 0 || pendingTimestamps.isEmpty()) {
+        return 0;
+    }
+    PendingTimestamp& pending = pendingTimestamps[pts % pendingTimestamps.size()];
+    if (pending.pts != pts) {
+        return 0;
+    }
+    pending.pts = -1;
+    return pending.timestampUs;
+}
+
+bool H264Writer::flushFragment() {
+    if (av_write_frame(formatContext, nullptr) < 0) {
+        qWarning() << "Failed to flush MP4 fragment for" << filePath;
+        return false;
+    }
+    avio_flush(formatContext->pb);
+    if (!storage->flush()) {
+        qWarning() << "Failed to commit MP4 fragment for" << filePath;
+        return false;
+    }
+    fragmentPackets = 0;
+    return true;
+}
+
+bool H264Writer::close() {
+    if (!formatContext) {
+        return false;
+    }
+    bool result = true;
+    if (codecContext && frame) {
+        result = encode(nullptr);
+        if (av_write_trailer(formatContext) < 0) {
+            qWarning() << "Failed to write container trailer";
+            result = false;
+        }
+    }
+    if (formatContext->pb) {
+        avio_flush(formatContext->pb);
+    }
+    if (storage && !storage->close()) {
+        result = false;
+    }
+    release();
+    return result;
+}
+
+void H264Writer::release() {
+    index.close();
+    if (formatContext && formatContext->pb) {
+        avio_flush(formatContext->pb);
+        av_freep(&formatContext->pb->buffer);
+        avio_context_free(&formatContext->pb);
+    }
+    if (storage) {
+        storage->close();
+        delete storage;
+        storage = nullptr;
+    }
+    if (fragmented) {
+        endActiveRecording(filePath);
+        fragmented = false;
+    }
+    sws_freeContext(swsContext);
+    swsContext = nullptr;
+    av_packet_free(&packet);
+    av_frame_free(&frame);
+    avcodec_free_context(&codecContext);
+    avformat_free_context(formatContext);
+    formatContext = nullptr;
+    stream = nullptr;
+    pendingTimestamps.clear();
+}
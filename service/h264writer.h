@@ -0,0 +1,70 @@
+#pragma once
+
+#include <QVector>
+#include <QString>
+#include <opencv2/core.hpp>
+
+#include "blockwriter.h"
+#include "recordingindex.h"
+#include "rawframe.h"
+
+struct AVFormatContext;
+struct AVCodecContext;
+struct AVStream;
+struct AVFrame;
+struct AVPacket;
+struct SwsContext;
+
+struct H264Settings {
+    int bitrate = 4000000;
+    int gopSize = 60;
+    QString preset;
+    int threads = 0;
+    QString container = "mkv";
+    int fragmentFrames = 0;
+    qint64 preallocateBytes = 0;
+    bool directIo = false;
+};
+
+QString h264PresetForCameraCount(int cameraCount);
+int h264ThreadsForCameraCount(int cameraCount);
+
+class H264Writer {
+public:
+    H264Writer() = default;
+    ~H264Writer();
+
+    bool open(const QString& outputPath, int width, int height, int fps, const H264Settings& settings);
+    bool writeFrame(const cv::Mat& image, qint64 timestampUs);
+    bool writeRawFrame(const cv::Mat& raw, RawPixelFormat format, qint64 timestampUs);
+    bool close();
+
+private:
+    AVFormatContext* formatContext = nullptr;
+    AVCodecContext* codecContext = nullptr;
+    AVStream* stream = nullptr;
+    AVFrame* frame = nullptr;
+    AVPacket* packet = nullptr;
+    SwsContext* swsContext = nullptr;
+    qint64 frameCount = 0;
+    int fragmentPackets = 0;
+    int fragmentFrames = 0;
+    bool fragmented = false;
+    QString filePath;
+    struct PendingTimestamp {
+        qint64 pts = -1;
+        qint64 timestampUs = 0;
+    };
+
+    QVector<PendingTimestamp> pendingTimestamps;
+    RecordingIndexWriter index;
+    BlockWriter* storage = nullptr;
+
+    bool openStorage(const QString& outputPath, const H264Settings& settings);
+    bool convertAndEncode(const uint8_t* const sourceData[], const int sourceStride[], int sourceFormat,
+                          int width, int height, qint64 timestampUs);
+    bool encode(AVFrame* input);
+    qint64 takePendingTimestamp(qint64 pts);
+    bool flushFragment();
+    void release();
+};
@@ -0,0 +1,99 @@
+#include "livecapture.h"
+#include "framepool.h"
+#include "pipelinescheduler.h"
+#include "tracing.h"
+
+#include <QDebug>
+#include <chrono>
+#include <opencv2/opencv.hpp>
+
+LiveCapture::LiveCapture(int cameraIndex, int fps, QObject* parent)
+    : QThread(parent), deviceIndex(cameraIndex), targetFps(fps > 0 ? fps : 30) {
+    qRegisterMetaType<cv::Mat>("cv::Mat");
+}
+
+LiveCapture::~LiveCapture() {
+    stop();
+}
+
+int LiveCapture::cameraIndex() const {
+    return deviceIndex;
+}
+
+int LiveCapture::fps() const {
+    return targetFps.load();
+}
+
+void LiveCapture::setFps(int fps) {
+    if (fps > 0) {
+        targetFps = fps;
+    }
+}
+
+void LiveCapture::stop() {
+    requestInterruption();
+    wait();
+}
+
+void LiveCapture::run() {
+    PipelineThreadPlacement placement(PipelineStage::Grab, deviceIndex);
+    cv::VideoCapture cap(deviceIndex);
+    if (!cap.isOpened()) {
+        qWarning() << "Failed to open camera" << deviceIndex << "for live capture";
+        return;
+    }
+    quint64 frameNumber = 0;
+    framePoolAllocator()->reserve(static_cast<int>(cap.get(cv::CAP_PROP_FRAME_WIDTH)),
+                                  static_cast<int>(cap.get(cv::CAP_PROP_FRAME_HEIGHT)), CV_8UC3, 4);
+    qDebug() << "Live capture started for camera" << deviceIndex << "at" << targetFps.load() << "fps";
+    while (!isInterruptionRequested()) {
+        auto frameStartTime = std::chrono::high_resolution_clock::now();
+        cv::Mat frame;
+        frame.allocator = framePoolAllocator();
+        {
+            TRACE_SCOPE("live_grab");
+            PipelineStageTimer grabTimer(PipelineStage::Grab, deviceIndex);
+            cap >> frame;
+        }
+        if (frame.empty()) {
+            qWarning() << "Failed to capture live frame from camera" << deviceIndex << "on frame" << frameNumber;
+            break;
+        }
+        emit frameCaptured(deviceIndex, frameNumber++, frame);
+        auto frameEndTime = std::chrono::high_resolution_clock::now();
+        auto elapsedTime = std::chrono::duration_cast<std::chrono::milliseconds>(frameEndTime - frameStartTime);
+        int remainingTime = 1000 / targetFps.load() - static_cast<int>(elapsedTime.count());
+        if (remainingTime > 0) {
+            TRACE_SCOPE("frame_sleep");
+            QThread::msleep(remainingTime);
+        }
+    }
+    cap.release();
+    qDebug() << "Live capture stopped for camera" << deviceIndex;
+}
+
+bool encodeJpegFrame(const cv::Mat& frame, double scale, int quality, std::vector<uchar>& jpeg) {
+    TRACE_SCOPE("jpeg_encode");
+    thread_local cv::Mat scaled;
+    thread_local std::vector<int> params;
+    const cv::Mat* source = &frame;
+    if (scale > 0.0 && scale < 1.0) {
+        scaled.allocator = framePoolAllocator();
+        cv::resize(frame, scaled, cv::Size(), scale, scale, cv::INTER_AREA);
+        source = &scaled;
+    }
+    params.assign({ cv::IMWRITE_JPEG_QUALITY, quality });
+    if (!cv::imencode(".jpg", *source, jpeg, params)) {
+        qWarning() << "Failed to encode live frame";
+        return false;
+    }
+    return true;
+}
+
+QByteArray encodeJpegFrame(const cv::Mat& frame, double scale, int quality) {
+    thread_local std::vector<uchar> buf;
+    if (!encodeJpegFrame(frame, scale, quality, buf)) {
+        return QByteArray();
+    }
+    return QByteArray(reinterpret_cast<const char*>(buf.data()), static_cast<int>(buf.size()));
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <QThread>
+#include <QByteArray>
+#include <opencv2/core.hpp>
+
+#include <atomic>
+#include <vector>
+
+Q_DECLARE_METATYPE(cv::Mat)
+
+class LiveCapture : public QThread {
+    Q_OBJECT
+
+public:
+    explicit LiveCapture(int cameraIndex, int fps, QObject* parent = nullptr);
+    ~LiveCapture();
+
+    int cameraIndex() const;
+    int fps() const;
+    void setFps(int fps);
+
+    void stop();
+
+signals:
+    void frameCaptured(int cameraIndex, quint64 frameNumber, const cv::Mat& frame);
+
+protected:
+    void run() override;
+
+private:
+    int deviceIndex;
+    std::atomic<int> targetFps;
+};
+
+QByteArray encodeJpegFrame(const cv::Mat& frame, double scale, int quality);
+bool encodeJpegFrame(const cv::Mat& frame, double scale, int quality, std::vector<uchar>& jpeg);
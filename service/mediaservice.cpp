@@ -1,12 +1,157 @@
 
+#include <QFile>
+#include <QDebug>
+#include <QThread>
+#include <QDateTime>
+
 #include "mediaservice.h"
+#include "devicediscovery.h"
+#include "storagemanager.h"
+#include "blockwriter.h"
+#include "recordingindex.h"
+
+#ifdef Q_OS_LINUX
+#include "v4l2capture.h"
+#endif
 
 MediaService::MediaService(QObject* parent)
-    : QObject(parent) {
+    : QObject(parent), registry(new DeviceRegistry(this)) {
+    auto updateCount = [this]() {
+        discoveredCameraCount = registry->devices().size();
+        invalidateCameraInfo();
+    };
+    connect(registry, &DeviceRegistry::deviceAdded, this, updateCount);
+    connect(registry, &DeviceRegistry::deviceRemoved, this, updateCount);
+}
+
+MediaService::~MediaService() {
+    for (int cameraIndex : timeLapseCaptures.keys()) {
+        stopTimeLapse(cameraIndex);
+    }
+    for (const QPointer<QThread>& thread : std::as_const(backgroundThreads)) {
+        if (thread) {
+            thread->wait();
+            delete thread;
+        }
+    }
+    stopStorageMover();
+    stopBlockWriteQueues();
+    if (backendState == InitReady) {
+        releaseCaptureBackends();
+    }
+}
+
+void MediaService::initializeInBackground(const QString& usbIdsFilePath) {
+    startStorageMover();
+    reloadUsbIds(usbIdsFilePath);
+    runInBackground([this]() {
+        backendState = warmUpCaptureBackends() ? InitReady : InitFailed;
+    });
+    registry->startMonitoring();
+    runInBackground([this]() {
+        QList<CameraDevice> cameras = scanCameraDevices();
+        QMetaObject::invokeMethod(registry, [this, cameras]() {
+            registry->applySnapshot(cameras);
+            discoveryState = InitReady;
+        }, Qt::QueuedConnection);
+        qDebug() << "Discovered" << cameras.size() << "cameras.";
+    });
+}
+
+void MediaService::reloadUsbIds(const QString& usbIdsFilePath) {
+    usbIdsState = InitPending;
+    runInBackground([this, usbIdsFilePath]() {
+        usbIdsState = loadUsbIds(usbIdsFilePath) ? InitReady : InitFailed;
+        if (usbIdsState == InitFailed) {
+            qCritical() << "Could not load USB IDs.";
+        }
+        invalidateCameraInfo();
+    });
+}
+
+DeviceRegistry* MediaService::deviceRegistry() const {
+    return registry;
+}
+
+QString MediaService::statusText() const {
+    bool ready = usbIdsState != InitPending && backendState != InitPending && discoveryState == InitReady;
+    return QString("STATUS:%1:usb_ids=%2:backend=%3:devices=%4:cameras=%5\n")
+        .arg(ready ? "ready" : "starting")
+        .arg(initStateName(usbIdsState))
+        .arg(initStateName(backendState))
+        .arg(initStateName(discoveryState))
+        .arg(discoveredCameraCount.load());
+}
+
+void MediaService::runInBackground(const std::function<void()>& task) {
+    backgroundThreads.removeAll(nullptr);
+    QThread* thread = QThread::create(task);
+    connect(thread, &QThread::finished, thread, &QObject::deleteLater);
+    backgroundThreads.append(thread);
+    thread->start();
+}
+
+QString MediaService::initStateName(int state) {
+    switch (state) {
+    case InitReady:
+        return "ready";
+    case InitFailed:
+        return "failed";
+    default:
+        return "loading";
+    }
 }
 
 QString MediaService::getAllCamerasInfo() {
-    return ::getAllCamerasInfo();
+    quint64 generation = 0;
+    {
+        QMutexLocker locker(&cameraInfoMutex);
+        if (!cachedCameraInfoText.isEmpty()) {
+            return cachedCameraInfoText;
+        }
+        generation = cameraInfoGeneration;
+    }
+    bool complete = false;
+#ifdef Q_OS_WIN
+    QString info = ::getAllCamerasInfo(&complete);
+#else
+    QString info = getV4l2CamerasInfo(&complete);
+#endif
+    QMutexLocker locker(&cameraInfoMutex);
+    if (complete && generation == cameraInfoGeneration) {
+        cachedCameraInfoText = info;
+    }
+    return info;
+}
+
+QByteArray MediaService::cameraInfoJsonResponse() {
+    quint64 generation = 0;
+    {
+        QMutexLocker locker(&cameraInfoMutex);
+        if (!cachedCameraInfoJson.isEmpty()) {
+            return cachedCameraInfoJson;
+        }
+        generation = cameraInfoGeneration;
+    }
+    bool complete = false;
+#ifdef Q_OS_WIN
+    QByteArray json = ::getAllCamerasInfoJson(&complete);
+#else
+    QByteArray json = getV4l2CamerasInfoJson(&complete);
+#endif
+    QByteArray response = QString("INFO_JSON:%1\n").arg(json.size()).toUtf8() + json;
+    QMutexLocker locker(&cameraInfoMutex);
+    if (complete && generation == cameraInfoGeneration) {
+        cachedCameraInfoJson = response;
+    }
+    return response;
+}
+
+void MediaService::invalidateCameraInfo() {
+    QMutexLocker locker(&cameraInfoMutex);
+    cameraInfoGeneration++;
+    cachedCameraInfoText.clear();
+    cachedCameraInfoJson.clear();
 }
 
 QList<QPair<QString, QByteArray>> MediaService::capturePhotoFromAllCameras() {
@@ -17,6 +162,119 @@ QList<QString> MediaService::recordVideoFromAllCameras(const QString& basePath,
     return ::recordVideoFromAllCameras(basePath, durationSeconds, fps);
 }
 
-QList<QString> MediaService::recordVideoWithAudioFromAllCameras(const QString& basePath, int durationSeconds, UINT32 fps) {
+QList<QString> MediaService::recordVideoWithAudioFromAllCameras(const QString& basePath, int durationSeconds, quint32 fps) {
+#ifdef Q_OS_WIN
     return ::recordVideoWithAudioFromAllCameras(basePath, durationSeconds, fps);
+#else
+    Q_UNUSED(basePath);
+    Q_UNUSED(durationSeconds);
+    Q_UNUSED(fps);
+    qWarning() << "Recording video with audio is only supported on Windows.";
+    return QList<QString>();
+#endif
+}
+
+QList<QString> MediaService::recordVideoWithAudioFromCameras(const QString& basePath,
+                                                             const QMap<int, CaptureParameters>& cameras) {
+#ifdef Q_OS_WIN
+    return ::recordVideoWithAudioFromCameras(basePath, cameras);
+#else
+    Q_UNUSED(basePath);
+    Q_UNUSED(cameras);
+    qWarning() << "Recording video with audio is only supported on Windows.";
+    return QList<QString>();
+#endif
+}
+
+void MediaService::startVideoRecordingFromAllCameras(const QString& basePath, int durationSeconds, int fps) {
+    runInBackground([basePath, durationSeconds, fps]() {
+        ::recordVideoFromAllCameras(basePath, durationSeconds, fps);
+    });
+}
+
+QList<QString> MediaService::recordH264VideoFromAllCameras(const QString& basePath, int durationSeconds, int fps,
+                                                           const H264Settings& settings) {
+    return ::recordH264VideoFromAllCameras(basePath, durationSeconds, fps, settings);
+}
+
+QList<CaptureResult> MediaService::captureBatch(const QList<CaptureRequest>& requests, const QString& basePath) {
+    return ::captureBatch(requests, basePath);
+}
+
+LiveCapture* MediaService::acquireLiveCapture(int cameraIndex, int fps, bool defaultFps) {
+    LiveCapture* capture = liveCaptures.value(cameraIndex, nullptr);
+    if (!capture) {
+        capture = new LiveCapture(cameraIndex, fps, this);
+        liveCaptures.insert(cameraIndex, capture);
+        capture->start();
+        if (defaultFps) {
+            defaultFpsCaptures.insert(cameraIndex);
+        }
+    } else if (!defaultFps) {
+        defaultFpsCaptures.remove(cameraIndex);
+    }
+    liveCaptureUsers[cameraIndex]++;
+    return capture;
+}
+
+void MediaService::releaseLiveCapture(int cameraIndex) {
+    if (!liveCaptureUsers.contains(cameraIndex)) {
+        return;
+    }
+    if (--liveCaptureUsers[cameraIndex] > 0) {
+        return;
+    }
+    liveCaptureUsers.remove(cameraIndex);
+    defaultFpsCaptures.remove(cameraIndex);
+    LiveCapture* capture = liveCaptures.take(cameraIndex);
+    if (capture) {
+        capture->stop();
+        delete capture;
+    }
+}
+
+void MediaService::setLiveCaptureFps(int fps) {
+    for (int cameraIndex : std::as_const(defaultFpsCaptures)) {
+        LiveCapture* capture = liveCaptures.value(cameraIndex, nullptr);
+        if (capture) {
+            capture->setFps(fps);
+        }
+    }
+}
+
+QString MediaService::startTimeLapse(int cameraIndex, const QString& basePath, const TimeLapseSettings& settings) {
+    if (timeLapseCaptures.contains(cameraIndex)) {
+        return QString();
+    }
+    QString extension = settings.format == "h264" ? "mp4" : "mjpeg";
+    QString filePath = allocateRecordingPath(basePath, QString("timelapse_camera_%1_%2.%3")
+                                                           .arg(cameraIndex)
+                                                           .arg(QDateTime::currentDateTime().toString("yyyy-MM-dd_hh-mm-ss"))
+                                                           .arg(extension));
+    TimeLapseCapture* capture = new TimeLapseCapture(cameraIndex, filePath, settings, this);
+    timeLapseCaptures.insert(cameraIndex, capture);
+    capture->start(QThread::LowPriority);
+    return filePath;
+}
+
+QString MediaService::stopTimeLapse(int cameraIndex) {
+    TimeLapseCapture* capture = timeLapseCaptures.take(cameraIndex);
+    if (!capture) {
+        return QString();
+    }
+    capture->stop();
+    QString filePath = capture->filePath();
+    bool recorded = capture->frameCount() > 0;
+    delete capture;
+    releaseRecordingPath(filePath, recorded);
+    if (!recorded) {
+        QFile::remove(filePath);
+        QFile::remove(recordingIndexPath(filePath));
+        return QString();
+    }
+    return filePath;
+}
+
+QList<TimeLapseCapture*> MediaService::timeLapses() const {
+    return timeLapseCaptures.values();
 }
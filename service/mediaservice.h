@@ -1,26 +1,90 @@
 #pragma once
 
 
+#include <QMap>
 #include <QList>
+#include <QSet>
 #include <QPair>
 #include <QString>
+#include <QMutex>
 #include <QObject>
+#include <QThread>
+#include <QPointer>
 #include <QByteArray>
 
 #include "cameraprocessing.h"
 #include "cameraprocessingsv.h"
+#include "livecapture.h"
+#include "timelapse.h"
+#include "deviceregistry.h"
+
+#include <atomic>
+#include <functional>
 
 class MediaService : public QObject {
     Q_OBJECT
 
 public:
     explicit MediaService(QObject* parent = nullptr);
+    ~MediaService();
+
+    void initializeInBackground(const QString& usbIdsFilePath);
+    void reloadUsbIds(const QString& usbIdsFilePath);
+    QString statusText() const;
+    DeviceRegistry* deviceRegistry() const;
 
     QString getAllCamerasInfo();
+    QByteArray cameraInfoJsonResponse();
+    void invalidateCameraInfo();
 
     QList<QPair<QString, QByteArray>> capturePhotoFromAllCameras();
 
     QList<QString> recordVideoFromAllCameras(const QString& basePath, int durationSeconds, int fps);
 
-    QList<QString> recordVideoWithAudioFromAllCameras(const QString& basePath, int durationSeconds, UINT32 fps);
+    QList<QString> recordVideoWithAudioFromAllCameras(const QString& basePath, int durationSeconds, quint32 fps);
+
+    QList<QString> recordVideoWithAudioFromCameras(const QString& basePath, const QMap<int, CaptureParameters>& cameras);
+
+    void startVideoRecordingFromAllCameras(const QString& basePath, int durationSeconds, int fps);
+
+    QList<QString> recordH264VideoFromAllCameras(const QString& basePath, int durationSeconds, int fps,
+                                                 const H264Settings& settings);
+
+    QList<CaptureResult> captureBatch(const QList<CaptureRequest>& requests, const QString& basePath);
+
+    LiveCapture* acquireLiveCapture(int cameraIndex, int fps, bool defaultFps = false);
+    void releaseLiveCapture(int cameraIndex);
+    void setLiveCaptureFps(int fps);
+
+    QString startTimeLapse(int cameraIndex, const QString& basePath, const TimeLapseSettings& settings);
+    QString stopTimeLapse(int cameraIndex);
+    QList<TimeLapseCapture*> timeLapses() const;
+
+private:
+    DeviceRegistry* registry;
+
+    enum InitState {
+        InitPending,
+        InitReady,
+        InitFailed
+    };
+
+    std::atomic<int> usbIdsState { InitPending };
+    std::atomic<int> backendState { InitPending };
+    std::atomic<int> discoveryState { InitPending };
+    std::atomic<int> discoveredCameraCount { 0 };
+
+    void runInBackground(const std::function<void()>& task);
+    static QString initStateName(int state);
+
+    QMutex cameraInfoMutex;
+    quint64 cameraInfoGeneration = 0;
+    QString cachedCameraInfoText;
+    QByteArray cachedCameraInfoJson;
+
+    QMap<int, LiveCapture*> liveCaptures;
+    QMap<int, int> liveCaptureUsers;
+    QSet<int> defaultFpsCaptures;
+    QMap<int, TimeLapseCapture*> timeLapseCaptures;
+    QList<QPointer<QThread>> backgroundThreads;
 };
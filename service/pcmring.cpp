@@ -0,0 +1,75 @@
+#include "pcmring.h"
+
+#include <cstring>
+
+static qint64 nextPowerOfTwo(qint64 value) {
+    qint64 result = 1;
+    while (result < value) {
+        result <<= 1;
+    }
+    return result;
+}
+
+PcmRingBuffer::PcmRingBuffer(qint64 capacityBytes, qint64 blockAlign)
+    : storage(static_cast<int>(nextPowerOfTwo(qMax<qint64>(capacityBytes, 4096)))), mask(storage.size() - 1),
+      blockAlign(qMax<qint64>(blockAlign, 1)) {
+}
+
+qint64 PcmRingBuffer::write(const uchar* data, qint64 size) {
+    qint64 writePosition = head.load(std::memory_order_relaxed);
+    qint64 readPosition = tail.load(std::memory_order_acquire);
+    qint64 space = storage.size() - (writePosition - readPosition);
+    qint64 count = qMin(size, space);
+    count -= count % blockAlign;
+    qint64 offset = writePosition & mask;
+    qint64 first = qMin(count, storage.size() - offset);
+    memcpy(storage.data() + offset, data, first);
+    memcpy(storage.data(), data + first, count - first);
+    head.store(writePosition + count, std::memory_order_release);
+    if (count < size) {
+        qint64 droppedCount = size - count;
+        dropped.fetch_add(droppedCount, std::memory_order_relaxed);
+        if (silenceBytes.load(std::memory_order_acquire) == 0) {
+            silencePosition.store(writePosition + count, std::memory_order_relaxed);
+        }
+        silenceBytes.fetch_add(droppedCount - droppedCount % blockAlign, std::memory_order_release);
+    }
+    return count;
+}
+
+qint64 PcmRingBuffer::read(uchar* data, qint64 size) {
+    qint64 readPosition = tail.load(std::memory_order_relaxed);
+    qint64 writePosition = head.load(std::memory_order_acquire);
+    qint64 silence = silenceBytes.load(std::memory_order_acquire);
+    qint64 count = writePosition - readPosition;
+    if (silence > 0) {
+        count = qBound<qint64>(0, silencePosition.load(std::memory_order_relaxed) - readPosition, count);
+    }
+    count = qMin(size, count);
+    qint64 offset = readPosition & mask;
+    qint64 first = qMin(count, storage.size() - offset);
+    memcpy(data, storage.constData() + offset, first);
+    memcpy(data + first, storage.constData(), count - first);
+    tail.store(readPosition + count, std::memory_order_release);
+    qint64 filled = count;
+    if (silence > 0 && readPosition + count >= silencePosition.load(std::memory_order_relaxed)) {
+        qint64 zeros = qMin(size - filled, silence);
+        memset(data + filled, 0, zeros);
+        silenceBytes.fetch_sub(zeros, std::memory_order_release);
+        filled += zeros;
+    }
+    return filled;
+}
+
+qint64 PcmRingBuffer::available() const {
+    return head.load(std::memory_order_acquire) - tail.load(std::memory_order_acquire) +
+           silenceBytes.load(std::memory_order_acquire);
+}
+
+qint64 PcmRingBuffer::capacity() const {
+    return storage.size();
+}
+
+qint64 PcmRingBuffer::droppedBytes() const {
+    return dropped.load(std::memory_order_relaxed);
+}
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <QtGlobal>
+#include <QVector>
+#include <atomic>
+
+class PcmRingBuffer {
+public:
+    PcmRingBuffer(qint64 capacityBytes, qint64 blockAlign = 1);
+
+    qint64 write(const uchar* data, qint64 size);
+    qint64 read(uchar* data, qint64 size);
+    qint64 available() const;
+    qint64 capacity() const;
+    qint64 droppedBytes() const;
+
+private:
+    QVector<uchar> storage;
+    qint64 mask;
+    qint64 blockAlign;
+    std::atomic<qint64> head { 0 };
+    std::atomic<qint64> tail { 0 };
+    std::atomic<qint64> dropped { 0 };
+    std::atomic<qint64> silencePosition { 0 };
+    std::atomic<qint64> silenceBytes { 0 };
+};
@@ -0,0 +1,207 @@
+#include "pipelinescheduler.h"
+
+#include <QMap>
+#include <QPair>
+#include <QDebug>
+#include <QMutex>
+#include <QThread>
+#include <atomic>
+
+#ifdef Q_OS_WIN
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <sched.h>
+#include <ctime>
+#endif
+
+static const int grabRealtimePriority = 10;
+static const int audioRealtimePriority = 20;
+
+static std::atomic<bool> affinityEnabled { true };
+static std::atomic<bool> realtimeWarningShown { false };
+static QMutex pipelineStatsMutex;
+static QMap<QPair<int, int>, PipelineStageStats> pipelineStats;
+
+static int coreCount() {
+    return qMax(1, QThread::idealThreadCount());
+}
+
+static int grabCoreCount() {
+    int cores = coreCount();
+    return cores >= 4 ? cores / 4 : 0;
+}
+
+static QList<int> coresForStage(PipelineStage stage, int cameraIndex) {
+    QList<int> cores;
+    int grabCores = grabCoreCount();
+    if (grabCores == 0) {
+        return cores;
+    }
+    if (stage == PipelineStage::Grab || stage == PipelineStage::Audio) {
+        cores.append(qMax(0, cameraIndex) % grabCores);
+        return cores;
+    }
+    for (int core = grabCores; core < coreCount(); ++core) {
+        cores.append(core);
+    }
+    return cores;
+}
+
+void setPipelineAffinityEnabled(bool enabled) {
+    affinityEnabled = enabled;
+}
+
+QString pipelineStageName(PipelineStage stage) {
+    switch (stage) {
+    case PipelineStage::Grab:
+        return "grab";
+    case PipelineStage::Encode:
+        return "encode";
+    case PipelineStage::Audio:
+        return "audio";
+    case PipelineStage::Network:
+        return "network";
+    }
+    return "unknown";
+}
+
+QString pipelineCoreLayout() {
+    int grabCores = grabCoreCount();
+    if (!affinityEnabled || grabCores == 0) {
+        return QString("cores=%1:affinity=off").arg(coreCount());
+    }
+    return QString("cores=%1:affinity=on:grab=0-%2:encode=%3-%4")
+        .arg(coreCount())
+        .arg(grabCores - 1)
+        .arg(grabCores)
+        .arg(coreCount() - 1);
+}
+
+qint64 currentThreadCpuTimeNs() {
+#ifdef Q_OS_WIN
+    FILETIME creation, exit, kernel, user;
+    if (!GetThreadTimes(GetCurrentThread(), &creation, &exit, &kernel, &user)) {
+        return 0;
+    }
+    quint64 kernelTime = (static_cast<quint64>(kernel.dwHighDateTime) << 32) | kernel.dwLowDateTime;
+    quint64 userTime = (static_cast<quint64>(user.dwHighDateTime) << 32) | user.dwLowDateTime;
+    return static_cast<qint64>((kernelTime + userTime) * 100);
+#else
+    timespec time;
+    if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &time) != 0) {
+        return 0;
+    }
+    return static_cast<qint64>(time.tv_sec) * 1000000000LL + time.tv_nsec;
+#endif
+}
+
+void recordPipelineStageTime(int cameraIndex, PipelineStage stage, qint64 cpuTimeNs, qint64 wallTimeNs) {
+    QMutexLocker locker(&pipelineStatsMutex);
+    PipelineStageStats& stats = pipelineStats[qMakePair(cameraIndex, static_cast<int>(stage))];
+    stats.cameraIndex = cameraIndex;
+    stats.stage = stage;
+    stats.samples++;
+    stats.cpuTimeNs += cpuTimeNs;
+    stats.wallTimeNs += wallTimeNs;
+}
+
+QList<PipelineStageStats> pipelineStageStats() {
+    QMutexLocker locker(&pipelineStatsMutex);
+    return pipelineStats.values();
+}
+
+void resetPipelineStageStats() {
+    QMutexLocker locker(&pipelineStatsMutex);
+    pipelineStats.clear();
+}
+
+PipelineThreadPlacement::PipelineThreadPlacement(PipelineStage stage, int cameraIndex) {
+    if (!affinityEnabled) {
+        return;
+    }
+    QList<int> cores = coresForStage(stage, cameraIndex);
+    bool realtime = stage == PipelineStage::Grab || stage == PipelineStage::Audio;
+#ifdef Q_OS_WIN
+    HANDLE thread = GetCurrentThread();
+    previousPriority = GetThreadPriority(thread);
+    if (!cores.isEmpty()) {
+        DWORD_PTR mask = 0;
+        for (int core : cores) {
+            if (core < static_cast<int>(sizeof(DWORD_PTR) * 8)) {
+                mask |= static_cast<DWORD_PTR>(1) << core;
+            }
+        }
+        DWORD_PTR previousMask = SetThreadAffinityMask(thread, mask);
+        if (previousMask) {
+            previousAffinity = QByteArray(reinterpret_cast<const char*>(&previousMask), sizeof(previousMask));
+        }
+    }
+    if (realtime) {
+        SetThreadPriority(thread, stage == PipelineStage::Audio ? THREAD_PRIORITY_TIME_CRITICAL
+                                                                : THREAD_PRIORITY_HIGHEST);
+    } else if (previousPriority > THREAD_PRIORITY_NORMAL) {
+        SetThreadPriority(thread, THREAD_PRIORITY_NORMAL);
+    }
+#elif defined(Q_OS_LINUX)
+    pthread_t thread = pthread_self();
+    cpu_set_t previousSet;
+    if (!cores.isEmpty() && pthread_getaffinity_np(thread, sizeof(previousSet), &previousSet) == 0) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        for (int core : cores) {
+            CPU_SET(core, &set);
+        }
+        if (pthread_setaffinity_np(thread, sizeof(set), &set) == 0) {
+            previousAffinity = QByteArray(reinterpret_cast<const char*>(&previousSet), sizeof(previousSet));
+        }
+    }
+    sched_param previousParam;
+    pthread_getschedparam(thread, &previousPolicy, &previousParam);
+    previousPriority = previousParam.sched_priority;
+    if (realtime) {
+        sched_param param = {};
+        param.sched_priority = stage == PipelineStage::Audio ? audioRealtimePriority : grabRealtimePriority;
+        if (pthread_setschedparam(thread, SCHED_FIFO, &param) != 0 && !realtimeWarningShown.exchange(true)) {
+            qWarning() << "Real-time scheduling is not permitted, capture threads keep the default policy.";
+        }
+    } else if (previousPolicy == SCHED_FIFO || previousPolicy == SCHED_RR) {
+        sched_param param = {};
+        pthread_setschedparam(thread, SCHED_OTHER, &param);
+    }
+#else
+    Q_UNUSED(cores);
+    Q_UNUSED(realtime);
+#endif
+    applied = true;
+}
+
+PipelineThreadPlacement::~PipelineThreadPlacement() {
+    if (!applied) {
+        return;
+    }
+#ifdef Q_OS_WIN
+    HANDLE thread = GetCurrentThread();
+    if (previousAffinity.size() == sizeof(DWORD_PTR)) {
+        SetThreadAffinityMask(thread, *reinterpret_cast<const DWORD_PTR*>(previousAffinity.constData()));
+    }
+    SetThreadPriority(thread, previousPriority);
+#elif defined(Q_OS_LINUX)
+    pthread_t thread = pthread_self();
+    if (previousAffinity.size() == sizeof(cpu_set_t)) {
+        pthread_setaffinity_np(thread, sizeof(cpu_set_t), reinterpret_cast<const cpu_set_t*>(previousAffinity.constData()));
+    }
+    sched_param param = {};
+    param.sched_priority = previousPriority;
+    pthread_setschedparam(thread, previousPolicy, &param);
+#endif
+}
+
+PipelineStageTimer::PipelineStageTimer(PipelineStage stage, int cameraIndex)
+    : timedStage(stage), timedCamera(cameraIndex), cpuStartNs(currentThreadCpuTimeNs()) {
+    wallTimer.start();
+}
+
+PipelineStageTimer::~PipelineStageTimer() {
+    recordPipelineStageTime(timedCamera, timedStage, currentThreadCpuTimeNs() - cpuStartNs, wallTimer.nsecsElapsed());
+}
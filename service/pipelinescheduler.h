@@ -0,0 +1,54 @@
+#pragma once
+
+#include <QList>
+#include <QString>
+#include <QByteArray>
+#include <QElapsedTimer>
+
+enum class PipelineStage {
+    Grab,
+    Encode,
+    Audio,
+    Network
+};
+
+struct PipelineStageStats {
+    int cameraIndex = -1;
+    PipelineStage stage = PipelineStage::Grab;
+    qint64 samples = 0;
+    qint64 cpuTimeNs = 0;
+    qint64 wallTimeNs = 0;
+};
+
+void setPipelineAffinityEnabled(bool enabled);
+QString pipelineStageName(PipelineStage stage);
+QString pipelineCoreLayout();
+
+qint64 currentThreadCpuTimeNs();
+void recordPipelineStageTime(int cameraIndex, PipelineStage stage, qint64 cpuTimeNs, qint64 wallTimeNs);
+QList<PipelineStageStats> pipelineStageStats();
+void resetPipelineStageStats();
+
+class PipelineThreadPlacement {
+public:
+    PipelineThreadPlacement(PipelineStage stage, int cameraIndex);
+    ~PipelineThreadPlacement();
+
+private:
+    bool applied = false;
+    QByteArray previousAffinity;
+    int previousPolicy = 0;
+    int previousPriority = 0;
+};
+
+class PipelineStageTimer {
+public:
+    PipelineStageTimer(PipelineStage stage, int cameraIndex);
+    ~PipelineStageTimer();
+
+private:
+    PipelineStage timedStage;
+    int timedCamera;
+    qint64 cpuStartNs;
+    QElapsedTimer wallTimer;
+};
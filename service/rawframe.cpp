@@ -0,0 +1,283 @@
+#include "rawframe.h"
+#include "tracing.h"
+
+#include <QDebug>
+#include <opencv2/opencv.hpp>
+
+extern "C" {
+#include <libavcodec/avcodec.h>
+}
+
+static const int defaultJpegQuality = 90;
+
+static RawPixelFormat rawPixelFormatFromFourcc(int fourcc) {
+    if (fourcc == cv::VideoWriter::fourcc('Y', 'U', 'Y', '2') || fourcc == cv::VideoWriter::fourcc('Y', 'U', 'Y', 'V')) {
+        return RawPixelFormat::Yuyv;
+    }
+    if (fourcc == cv::VideoWriter::fourcc('N', 'V', '1', '2')) {
+        return RawPixelFormat::Nv12;
+    }
+    if (fourcc == cv::VideoWriter::fourcc('I', '4', '2', '0') || fourcc == cv::VideoWriter::fourcc('Y', 'U', '1', '2')) {
+        return RawPixelFormat::I420;
+    }
+    if (fourcc == cv::VideoWriter::fourcc('M', 'J', 'P', 'G')) {
+        return RawPixelFormat::Mjpeg;
+    }
+    return RawPixelFormat::Bgr;
+}
+
+RawPixelFormat openNativeCapture(cv::VideoCapture& capture) {
+    if (!capture.isOpened() || !capture.set(cv::CAP_PROP_CONVERT_RGB, 0)) {
+        return RawPixelFormat::Bgr;
+    }
+    RawPixelFormat format = rawPixelFormatFromFourcc(static_cast<int>(capture.get(cv::CAP_PROP_FOURCC)));
+    if (format == RawPixelFormat::Bgr) {
+        capture.set(cv::CAP_PROP_CONVERT_RGB, 1);
+    }
+    return format;
+}
+
+qint64 rawFrameSize(RawPixelFormat format, int width, int height) {
+    switch (format) {
+    case RawPixelFormat::Yuyv:
+        return static_cast<qint64>(width) * height * 2;
+    case RawPixelFormat::Nv12:
+    case RawPixelFormat::I420:
+        return static_cast<qint64>(width) * height * 3 / 2;
+    case RawPixelFormat::Bgr:
+        return static_cast<qint64>(width) * height * 3;
+    case RawPixelFormat::Mjpeg:
+        break;
+    }
+    return 0;
+}
+
+bool rawFrameToBgr(const cv::Mat& raw, RawPixelFormat format, int width, int height, cv::Mat& bgr) {
+    if (raw.empty()) {
+        return false;
+    }
+    if (format == RawPixelFormat::Bgr) {
+        bgr = raw;
+        return true;
+    }
+    if (format == RawPixelFormat::Mjpeg) {
+        cv::imdecode(raw, cv::IMREAD_COLOR, &bgr);
+        return !bgr.empty();
+    }
+    if (!raw.isContinuous() || static_cast<qint64>(raw.total() * raw.elemSize()) < rawFrameSize(format, width, height)) {
+        qWarning() << "Raw frame is smaller than expected for" << width << "x" << height;
+        return false;
+    }
+    uchar* data = const_cast<uchar*>(raw.data);
+    switch (format) {
+    case RawPixelFormat::Yuyv:
+        cv::cvtColor(cv::Mat(height, width, CV_8UC2, data), bgr, cv::COLOR_YUV2BGR_YUYV);
+        break;
+    case RawPixelFormat::Nv12:
+        cv::cvtColor(cv::Mat(height * 3 / 2, width, CV_8UC1, data), bgr, cv::COLOR_YUV2BGR_NV12);
+        break;
+    case RawPixelFormat::I420:
+        cv::cvtColor(cv::Mat(height * 3 / 2, width, CV_8UC1, data), bgr, cv::COLOR_YUV2BGR_I420);
+        break;
+    default:
+        return false;
+    }
+    return true;
+}
+
+static void releaseBorrowedFrame(void* opaque, uint8_t* data) {
+    Q_UNUSED(opaque);
+    Q_UNUSED(data);
+}
+
+class YuvJpegEncoder {
+public:
+    ~YuvJpegEncoder() {
+        release();
+    }
+
+    QByteArray encode(AVFrame* source, int jpegQuality) {
+        if (!prepare(source->width, source->height, static_cast<AVPixelFormat>(source->format), jpegQuality)) {
+            return QByteArray();
+        }
+        source->quality = codecContext->global_quality;
+        source->pts = framePts++;
+        QByteArray jpeg;
+        if (avcodec_send_frame(codecContext, source) >= 0 && avcodec_receive_packet(codecContext, packet) >= 0) {
+            jpeg = QByteArray(reinterpret_cast<const char*>(packet->data), packet->size);
+            av_packet_unref(packet);
+        }
+        return jpeg;
+    }
+
+    AVFrame* borrowFrame() {
+        if (!inputFrame) {
+            inputFrame = av_frame_alloc();
+        }
+        return inputFrame;
+    }
+
+    void returnFrame() {
+        av_frame_unref(inputFrame);
+    }
+
+    AVFrame* decodeMjpeg(const cv::Mat& raw) {
+        if (!decoderContext) {
+            const AVCodec* codec = avcodec_find_decoder(AV_CODEC_ID_MJPEG);
+            decoderContext = codec ? avcodec_alloc_context3(codec) : nullptr;
+            if (!decoderContext || avcodec_open2(decoderContext, codec, nullptr) < 0) {
+                avcodec_free_context(&decoderContext);
+                return nullptr;
+            }
+        }
+        if (!decodedFrame && !(decodedFrame = av_frame_alloc())) {
+            return nullptr;
+        }
+        if (!packet && !(packet = av_packet_alloc())) {
+            return nullptr;
+        }
+        packet->data = const_cast<uint8_t*>(raw.data);
+        packet->size = static_cast<int>(raw.total() * raw.elemSize());
+        bool decoded = avcodec_send_packet(decoderContext, packet) >= 0 &&
+                       avcodec_receive_frame(decoderContext, decodedFrame) >= 0;
+        packet->data = nullptr;
+        packet->size = 0;
+        return decoded ? decodedFrame : nullptr;
+    }
+
+private:
+    AVCodecContext* codecContext = nullptr;
+    AVCodecContext* decoderContext = nullptr;
+    AVPacket* packet = nullptr;
+    AVFrame* decodedFrame = nullptr;
+    AVFrame* inputFrame = nullptr;
+    int encoderWidth = 0;
+    int encoderHeight = 0;
+    int encoderQuality = 0;
+    AVPixelFormat encoderFormat = AV_PIX_FMT_NONE;
+    int64_t framePts = 0;
+
+    bool prepare(int width, int height, AVPixelFormat format, int jpegQuality) {
+        if (codecContext && encoderWidth == width && encoderHeight == height && encoderFormat == format &&
+            encoderQuality == jpegQuality) {
+            return true;
+        }
+        avcodec_free_context(&codecContext);
+        encoderFormat = AV_PIX_FMT_NONE;
+        if (format != AV_PIX_FMT_YUV420P && format != AV_PIX_FMT_YUV422P && format != AV_PIX_FMT_YUVJ420P &&
+            format != AV_PIX_FMT_YUVJ422P && format != AV_PIX_FMT_YUVJ444P) {
+            return false;
+        }
+        const AVCodec* codec = avcodec_find_encoder(AV_CODEC_ID_MJPEG);
+        if (!codec || !(codecContext = avcodec_alloc_context3(codec)) || (!packet && !(packet = av_packet_alloc()))) {
+            qWarning() << "No MJPEG encoder available for YUV frames";
+            avcodec_free_context(&codecContext);
+            return false;
+        }
+        int qscale = 2 + (100 - qBound(1, jpegQuality, 100)) * 29 / 99;
+        codecContext->width = width;
+        codecContext->height = height;
+        codecContext->time_base = AVRational{ 1, 30 };
+        codecContext->pix_fmt = format;
+        codecContext->color_range = format == AV_PIX_FMT_YUV420P || format == AV_PIX_FMT_YUV422P ? AVCOL_RANGE_MPEG
+                                                                                                   : AVCOL_RANGE_JPEG;
+        codecContext->strict_std_compliance = FF_COMPLIANCE_UNOFFICIAL;
+        codecContext->flags |= AV_CODEC_FLAG_QSCALE;
+        codecContext->global_quality = qscale * FF_QP2LAMBDA;
+        codecContext->qmin = qscale;
+        codecContext->qmax = qscale;
+        codecContext->thread_count = 1;
+        if (avcodec_open2(codecContext, codec, nullptr) < 0) {
+            qWarning() << "Failed to open MJPEG encoder for" << width << "x" << height;
+            avcodec_free_context(&codecContext);
+            return false;
+        }
+        encoderWidth = width;
+        encoderHeight = height;
+        encoderFormat = format;
+        encoderQuality = jpegQuality;
+        return true;
+    }
+
+    void release() {
+        avcodec_free_context(&codecContext);
+        avcodec_free_context(&decoderContext);
+        av_packet_free(&packet);
+        av_frame_free(&decodedFrame);
+        av_frame_free(&inputFrame);
+    }
+};
+
+static QByteArray encodeYuvJpeg(const cv::Mat& raw, RawPixelFormat format, int width, int height, int jpegQuality) {
+    thread_local YuvJpegEncoder encoder;
+    thread_local cv::Mat planes[2];
+    thread_local cv::Mat chroma[2];
+    if (format == RawPixelFormat::Mjpeg) {
+        AVFrame* decoded = encoder.decodeMjpeg(raw);
+        return decoded ? encoder.encode(decoded, jpegQuality) : QByteArray();
+    }
+    if (format == RawPixelFormat::Bgr || !raw.isContinuous() ||
+        static_cast<qint64>(raw.total() * raw.elemSize()) < rawFrameSize(format, width, height)) {
+        return QByteArray();
+    }
+    AVFrame* frame = encoder.borrowFrame();
+    if (!frame) {
+        return QByteArray();
+    }
+    uchar* data = const_cast<uchar*>(raw.data);
+    frame->width = width;
+    frame->height = height;
+    frame->data[0] = data;
+    frame->linesize[0] = width;
+    frame->linesize[1] = width / 2;
+    frame->linesize[2] = width / 2;
+    switch (format) {
+    case RawPixelFormat::I420:
+        frame->format = AV_PIX_FMT_YUV420P;
+        frame->data[1] = data + width * height;
+        frame->data[2] = frame->data[1] + width * height / 4;
+        break;
+    case RawPixelFormat::Nv12:
+        frame->format = AV_PIX_FMT_YUV420P;
+        cv::split(cv::Mat(height / 2, width / 2, CV_8UC2, data + width * height), chroma);
+        frame->data[1] = chroma[0].data;
+        frame->data[2] = chroma[1].data;
+        break;
+    case RawPixelFormat::Yuyv:
+    default:
+        frame->format = AV_PIX_FMT_YUV422P;
+        cv::split(cv::Mat(height, width, CV_8UC2, data), planes);
+        cv::split(cv::Mat(height, width / 2, CV_8UC2, planes[1].data), chroma);
+        frame->data[0] = planes[0].data;
+        frame->data[1] = chroma[0].data;
+        frame->data[2] = chroma[1].data;
+        break;
+    }
+    frame->buf[0] = av_buffer_create(data, static_cast<int>(raw.total() * raw.elemSize()), releaseBorrowedFrame,
+                                     nullptr, AV_BUFFER_FLAG_READONLY);
+    QByteArray jpeg = frame->buf[0] ? encoder.encode(frame, jpegQuality) : QByteArray();
+    encoder.returnFrame();
+    return jpeg;
+}
+
+QByteArray rawFrameToJpeg(const cv::Mat& raw, RawPixelFormat format, int width, int height, int quality) {
+    if (format == RawPixelFormat::Mjpeg && quality <= 0) {
+        return QByteArray(reinterpret_cast<const char*>(raw.data), static_cast<int>(raw.total() * raw.elemSize()));
+    }
+    TRACE_SCOPE("raw_to_jpeg");
+    int jpegQuality = quality > 0 ? quality : defaultJpegQuality;
+    QByteArray jpeg = encodeYuvJpeg(raw, format, width, height, jpegQuality);
+    if (!jpeg.isEmpty()) {
+        return jpeg;
+    }
+    thread_local cv::Mat bgr;
+    thread_local std::vector<uchar> buf;
+    if (!rawFrameToBgr(raw, format, width, height, bgr)) {
+        return QByteArray();
+    }
+    if (!cv::imencode(".jpg", bgr, buf, { cv::IMWRITE_JPEG_QUALITY, jpegQuality })) {
+        qWarning() << "Failed to encode JPEG from raw frame";
+        return QByteArray();
+    }
+    return QByteArray(reinterpret_cast<const char*>(buf.data()), static_cast<int>(buf.size()));
+}
@@ -0,0 +1,21 @@
+#pragma once
+
+#include <QByteArray>
+#include <opencv2/core.hpp>
+
+namespace cv {
+class VideoCapture;
+}
+
+enum class RawPixelFormat {
+    Bgr,
+    Yuyv,
+    Nv12,
+    I420,
+    Mjpeg
+};
+
+RawPixelFormat openNativeCapture(cv::VideoCapture& capture);
+bool rawFrameToBgr(const cv::Mat& raw, RawPixelFormat format, int width, int height, cv::Mat& bgr);
+QByteArray rawFrameToJpeg(const cv::Mat& raw, RawPixelFormat format, int width, int height, int quality);
+qint64 rawFrameSize(RawPixelFormat format, int width, int height);
@@ -0,0 +1,149 @@
+#include "recordingindex.h"
+
+#include <QDebug>
+#include <chrono>
+#include <cstring>
+#include <algorithm>
+
+static const char recordingIndexMagic[4] = { 'C', 'I', 'D', 'X' };
+static const quint32 recordingIndexVersion = 2;
+static const quint32 recordingIndexFlushInterval = 64;
+
+QString recordingIndexPath(const QString& recordingPath) {
+    return recordingPath + ".idx";
+}
+
+qint64 currentCaptureTimestampUs() {
+    static const qint64 wallAnchorUs = std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+    static const std::chrono::steady_clock::time_point steadyAnchor = std::chrono::steady_clock::now();
+    return wallAnchorUs + std::chrono::duration_cast<std::chrono::microseconds>(
+                              std::chrono::steady_clock::now() - steadyAnchor).count();
+}
+
+RecordingIndexWriter::~RecordingIndexWriter() {
+    close();
+}
+
+bool RecordingIndexWriter::open(const QString& recordingPath, bool byteOffsets, quint64 initSegmentSize) {
+    close();
+    file.setFileName(recordingIndexPath(recordingPath));
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+        qWarning() << "Failed to open recording index:" << file.fileName();
+        return false;
+    }
+    RecordingIndexHeader header = {};
+    std::memcpy(header.magic, recordingIndexMagic, sizeof(header.magic));
+    header.version = recordingIndexVersion;
+    header.entrySize = sizeof(RecordingIndexEntry);
+    header.flags = byteOffsets ? RecordingIndexByteOffsets : 0;
+    header.initSegmentSize = initSegmentSize;
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    return true;
+}
+
+void RecordingIndexWriter::append(quint32 frameNumber, qint64 timestampUs, quint64 byteOffset, quint32 size, bool keyframe) {
+    if (!file.isOpen()) {
+        return;
+    }
+    RecordingIndexEntry entry = {};
+    entry.frameNumber = frameNumber;
+    entry.flags = keyframe ? RecordingIndexKeyframe : 0;
+    entry.timestampUs = timestampUs;
+    entry.byteOffset = byteOffset;
+    entry.size = size;
+    if (file.write(reinterpret_cast<const char*>(&entry), sizeof(entry)) != sizeof(entry)) {
+        qWarning() << "Failed to write recording index entry to" << file.fileName();
+        return;
+    }
+    if ((frameNumber + 1) % recordingIndexFlushInterval == 0) {
+        file.flush();
+    }
+}
+
+void RecordingIndexWriter::close() {
+    if (file.isOpen()) {
+        file.close();
+    }
+}
+
+RecordingIndex::~RecordingIndex() {
+    close();
+}
+
+bool RecordingIndex::open(const QString& recordingPath) {
+    close();
+    file.setFileName(recordingIndexPath(recordingPath));
+    if (!file.open(QIODevice::ReadOnly)) {
+        return false;
+    }
+    qint64 fileSize = file.size();
+    if (fileSize < static_cast<qint64>(sizeof(RecordingIndexHeader))) {
+        qWarning() << "Recording index is truncated:" << file.fileName();
+        file.close();
+        return false;
+    }
+    mapped = file.map(0, fileSize);
+    if (!mapped) {
+        qWarning() << "Failed to map recording index:" << file.fileName();
+        file.close();
+        return false;
+    }
+    const RecordingIndexHeader* header = reinterpret_cast<const RecordingIndexHeader*>(mapped);
+    if (std::memcmp(header->magic, recordingIndexMagic, sizeof(header->magic)) != 0 ||
+        header->version != recordingIndexVersion ||
+        header->entrySize != sizeof(RecordingIndexEntry)) {
+        qWarning() << "Unsupported recording index format:" << file.fileName();
+        close();
+        return false;
+    }
+    byteOffsets = header->flags & RecordingIndexByteOffsets;
+    initSize = header->initSegmentSize;
+    entries = reinterpret_cast<const RecordingIndexEntry*>(mapped + sizeof(RecordingIndexHeader));
+    entryCount = (fileSize - static_cast<qint64>(sizeof(RecordingIndexHeader))) / sizeof(RecordingIndexEntry);
+    return true;
+}
+
+void RecordingIndex::close() {
+    if (mapped) {
+        file.unmap(mapped);
+        mapped = nullptr;
+    }
+    if (file.isOpen()) {
+        file.close();
+    }
+    entries = nullptr;
+    entryCount = 0;
+    byteOffsets = false;
+    initSize = 0;
+}
+
+qint64 RecordingIndex::findByTimestamp(qint64 timestampUs) const {
+    const RecordingIndexEntry* end = entries + entryCount;
+    const RecordingIndexEntry* found = std::upper_bound(
+        entries, end, timestampUs,
+        [](qint64 value, const RecordingIndexEntry& entry) { return value < entry.timestampUs; });
+    if (found == entries) {
+        return entryCount > 0 ? 0 : -1;
+    }
+    return (found - entries) - 1;
+}
+
+qint64 RecordingIndex::findKeyframeAtOrBefore(qint64 position) const {
+    for (qint64 i = position; i >= 0; --i) {
+        if (entries[i].flags & RecordingIndexKeyframe) {
+            return i;
+        }
+    }
+    return entryCount > 0 ? 0 : -1;
+}
+
+qint64 RecordingIndex::rangeEndAfter(qint64 position) const {
+    quint64 offset = entries[position].byteOffset;
+    for (qint64 i = position + 1; i < entryCount; ++i) {
+        if (entries[i].byteOffset > offset) {
+            return static_cast<qint64>(entries[i].byteOffset);
+        }
+    }
+    return -1;
+}
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <QFile>
+#include <QString>
+#include <QtGlobal>
+
+enum RecordingIndexFlag : quint32 {
+    RecordingIndexKeyframe = 0x1
+};
+
+enum RecordingIndexHeaderFlag : quint32 {
+    RecordingIndexByteOffsets = 0x1
+};
+
+#pragma pack(push, 1)
+struct RecordingIndexHeader {
+    char magic[4];
+    quint32 version;
+    quint32 entrySize;
+    quint32 flags;
+    quint64 initSegmentSize;
+};
+
+struct RecordingIndexEntry {
+    quint32 frameNumber;
+    quint32 flags;
+    qint64 timestampUs;
+    quint64 byteOffset;
+    quint32 size;
+    quint32 reserved;
+};
+#pragma pack(pop)
+
+static_assert(sizeof(RecordingIndexHeader) == 24, "RecordingIndexHeader must stay 24 bytes");
+static_assert(sizeof(RecordingIndexEntry) == 32, "RecordingIndexEntry must stay 32 bytes");
+
+QString recordingIndexPath(const QString& recordingPath);
+qint64 currentCaptureTimestampUs();
+
+class RecordingIndexWriter {
+public:
+    RecordingIndexWriter() = default;
+    ~RecordingIndexWriter();
+
+    bool open(const QString& recordingPath, bool byteOffsets, quint64 initSegmentSize = 0);
+    void append(quint32 frameNumber, qint64 timestampUs, quint64 byteOffset, quint32 size, bool keyframe);
+    void close();
+
+private:
+    QFile file;
+};
+
+class RecordingIndex {
+public:
+    RecordingIndex() = default;
+    ~RecordingIndex();
+
+    bool open(const QString& recordingPath);
+    void close();
+
+    qint64 count() const { return entryCount; }
+    bool hasByteOffsets() const { return byteOffsets; }
+    quint64 initSegmentSize() const { return initSize; }
+    const RecordingIndexEntry& at(qint64 position) const { return entries[position]; }
+
+    qint64 findByTimestamp(qint64 timestampUs) const;
+    qint64 findKeyframeAtOrBefore(qint64 position) const;
+    qint64 rangeEndAfter(qint64 position) const;
+
+private:
+    QFile file;
+    uchar* mapped = nullptr;
+    const RecordingIndexEntry* entries = nullptr;
+    qint64 entryCount = 0;
+    bool byteOffsets = false;
+    quint64 initSize = 0;
+};
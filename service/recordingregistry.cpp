@@ -0,0 +1,44 @@
+#include "recordingregistry.h"
+
+#include <QMap>
+#include <QMutex>
+#include <QFileInfo>
+
+static QMutex activeRecordingsMutex;
+static QMap<QString, qint64> activeRecordingBytes;
+
+static QString recordingKey(const QString& filePath) {
+    return QFileInfo(filePath).absoluteFilePath();
+}
+
+void beginActiveRecording(const QString& filePath) {
+    QMutexLocker locker(&activeRecordingsMutex);
+    activeRecordingBytes.insert(recordingKey(filePath), 0);
+}
+
+void updateActiveRecording(const QString& filePath, qint64 committedBytes) {
+    QMutexLocker locker(&activeRecordingsMutex);
+    QString key = recordingKey(filePath);
+    if (activeRecordingBytes.contains(key)) {
+        activeRecordingBytes.insert(key, committedBytes);
+    }
+}
+
+void endActiveRecording(const QString& filePath) {
+    QMutexLocker locker(&activeRecordingsMutex);
+    activeRecordingBytes.remove(recordingKey(filePath));
+}
+
+qint64 activeRecordingCommittedBytes(const QString& filePath) {
+    QMutexLocker locker(&activeRecordingsMutex);
+    return activeRecordingBytes.value(recordingKey(filePath), -1);
+}
+
+QList<QPair<QString, qint64>> activeRecordings() {
+    QMutexLocker locker(&activeRecordingsMutex);
+    QList<QPair<QString, qint64>> recordings;
+    for (auto it = activeRecordingBytes.cbegin(); it != activeRecordingBytes.cend(); ++it) {
+        recordings.append(qMakePair(it.key(), it.value()));
+    }
+    return recordings;
+}
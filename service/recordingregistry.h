@@ -0,0 +1,11 @@
+#pragma once
+
+#include <QList>
+#include <QPair>
+#include <QString>
+
+void beginActiveRecording(const QString& filePath);
+void updateActiveRecording(const QString& filePath, qint64 committedBytes);
+void endActiveRecording(const QString& filePath);
+qint64 activeRecordingCommittedBytes(const QString& filePath);
+QList<QPair<QString, qint64>> activeRecordings();
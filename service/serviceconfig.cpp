@@ -0,0 +1,386 @@
+#include "serviceconfig.h"
+#include "cameraprocessing.h"
+
+#include <QFile>
+#include <QDebug>
+#include <QMutex>
+#include <QCoreApplication>
+#include <QJsonArray>
+#include <QJsonObject>
+#include <QJsonDocument>
+#include <QHostAddress>
+#include <climits>
+
+static const QStringList cameraModeParameters = { "resolution", "width", "height", "fps", "duration",
+                                                  "format", "container", "audio", "audio_bitrate" };
+
+static QMutex configMutex;
+static ServiceConfig currentConfig;
+static QString currentConfigPath;
+
+static bool parseConfigInt(const QString& value, int minimum, int maximum, int& result) {
+    bool ok = false;
+    int parsed = value.toInt(&ok);
+    if (!ok || parsed < minimum || parsed > maximum) {
+        return false;
+    }
+    result = parsed;
+    return true;
+}
+
+static bool parseConfigBool(const QString& value, bool& result) {
+    QString lower = value.toLower();
+    if (lower == "true" || lower == "1" || lower == "on") {
+        result = true;
+        return true;
+    }
+    if (lower == "false" || lower == "0" || lower == "off") {
+        result = false;
+        return true;
+    }
+    return false;
+}
+
+static QStringList parseConfigList(const QString& value) {
+    QStringList result;
+    for (const QString& item : value.split(',', Qt::SkipEmptyParts)) {
+        result.append(item.trimmed());
+    }
+    return result;
+}
+
+static bool assignConfigValue(ServiceConfig& config, const QString& key, const QString& value, ConfigApply& apply) {
+    int number = 0;
+    apply = ConfigApply::Live;
+    if (key == "listen_address") {
+        if (QHostAddress(value).isNull()) {
+            return false;
+        }
+        config.listenAddress = value;
+        apply = ConfigApply::ServerRestart;
+    } else if (key == "port") {
+        if (!parseConfigInt(value, 1, 65535, number)) {
+            return false;
+        }
+        config.port = static_cast<quint16>(number);
+        apply = ConfigApply::ServerRestart;
+    } else if (key == "epoll") {
+        apply = ConfigApply::Startup;
+        return parseConfigBool(value, config.epoll);
+    } else if (key == "io_threads") {
+        apply = ConfigApply::ServerRestart;
+        return parseConfigInt(value, 0, 256, config.ioThreads);
+    } else if (key == "max_connections") {
+        return parseConfigInt(value, 0, 1000000, config.maxConnections);
+    } else if (key == "idle_timeout_ms") {
+        return parseConfigInt(value, 0, INT_MAX, config.idleTimeoutMs);
+    } else if (key == "usb_ids_path") {
+        config.usbIdsPath = value;
+    } else if (key == "pipeline_affinity") {
+        return parseConfigBool(value, config.pipelineAffinity);
+    } else if (key == "record_duration_s") {
+        return parseConfigInt(value, 1, 24 * 60 * 60, config.recordDurationSeconds);
+    } else if (key == "record_fps") {
+        return parseConfigInt(value, 1, 240, config.recordFps);
+    } else if (key == "preview_fps") {
+        return parseConfigInt(value, 1, 240, config.previewFps);
+    } else if (key == "rtp_mtu") {
+        apply = ConfigApply::NextCapture;
+        return parseConfigInt(value, 256, 65000, config.rtpMtu);
+    } else if (key == "rtp_jpeg_quality") {
+        return parseConfigInt(value, 1, 100, config.rtpJpegQuality);
+    } else if (key == "h264_bitrate") {
+        apply = ConfigApply::NextCapture;
+        return parseConfigInt(value, 1000, INT_MAX, config.h264Bitrate);
+    } else if (key == "h264_gop") {
+        apply = ConfigApply::NextCapture;
+        return parseConfigInt(value, 1, 10000, config.h264Gop);
+    } else if (key == "h264_preset") {
+        apply = ConfigApply::NextCapture;
+        static const QStringList presets = { "", "ultrafast", "superfast", "veryfast", "faster", "fast",
+                                             "medium", "slow", "slower", "veryslow" };
+        if (!presets.contains(value)) {
+            return false;
+        }
+        config.h264Preset = value;
+    } else if (key == "h264_threads") {
+        apply = ConfigApply::NextCapture;
+        return parseConfigInt(value, 0, 256, config.h264Threads);
+    } else if (key == "direct_io") {
+        apply = ConfigApply::NextCapture;
+        return parseConfigBool(value, config.directIo);
+    } else if (key == "audio_ring_ms") {
+        apply = ConfigApply::NextCapture;
+        return parseConfigInt(value, 100, 60000, config.audioRingMs);
+    } else if (key == "v4l2_buffers") {
+        apply = ConfigApply::NextCapture;
+        return parseConfigInt(value, 2, 32, config.v4l2Buffers);
+    } else if (key == "scratch_volumes") {
+        config.scratchVolumes = parseConfigList(value);
+    } else if (key == "volumes") {
+        config.bulkVolumes = parseConfigList(value);
+    } else if (key.startsWith("camera.")) {
+        QStringList parts = key.split('.');
+        bool indexOk = false;
+        int cameraIndex = parts.value(1).toInt(&indexOk);
+        if (parts.size() != 3 || (parts.at(1) != "default" && (!indexOk || cameraIndex < 0)) ||
+            !cameraModeParameters.contains(parts.at(2))) {
+            return false;
+        }
+        if (value.isEmpty()) {
+            config.cameraModes[parts.at(1)].remove(parts.at(2));
+            if (config.cameraModes.value(parts.at(1)).isEmpty()) {
+                config.cameraModes.remove(parts.at(1));
+            }
+        } else {
+            CaptureParameters parameters;
+            QString error;
+            if (!applyCaptureParameter(parameters, parts.at(2), value, error)) {
+                return false;
+            }
+            config.cameraModes[parts.at(1)].insert(parts.at(2), value);
+        }
+        apply = ConfigApply::NextCapture;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+static QString configValue(const ServiceConfig& config, const QString& key) {
+    if (key == "listen_address") {
+        return config.listenAddress;
+    } else if (key == "port") {
+        return QString::number(config.port);
+    } else if (key == "epoll") {
+        return config.epoll ? "true" : "false";
+    } else if (key == "io_threads") {
+        return QString::number(config.ioThreads);
+    } else if (key == "max_connections") {
+        return QString::number(config.maxConnections);
+    } else if (key == "idle_timeout_ms") {
+        return QString::number(config.idleTimeoutMs);
+    } else if (key == "usb_ids_path") {
+        return config.usbIdsPath;
+    } else if (key == "pipeline_affinity") {
+        return config.pipelineAffinity ? "true" : "false";
+    } else if (key == "record_duration_s") {
+        return QString::number(config.recordDurationSeconds);
+    } else if (key == "record_fps") {
+        return QString::number(config.recordFps);
+    } else if (key == "preview_fps") {
+        return QString::number(config.previewFps);
+    } else if (key == "rtp_mtu") {
+        return QString::number(config.rtpMtu);
+    } else if (key == "rtp_jpeg_quality") {
+        return QString::number(config.rtpJpegQuality);
+    } else if (key == "h264_bitrate") {
+        return QString::number(config.h264Bitrate);
+    } else if (key == "h264_gop") {
+        return QString::number(config.h264Gop);
+    } else if (key == "h264_preset") {
+        return config.h264Preset;
+    } else if (key == "h264_threads") {
+        return QString::number(config.h264Threads);
+    } else if (key == "direct_io") {
+        return config.directIo ? "true" : "false";
+    } else if (key == "audio_ring_ms") {
+        return QString::number(config.audioRingMs);
+    } else if (key == "v4l2_buffers") {
+        return QString::number(config.v4l2Buffers);
+    } else if (key == "scratch_volumes") {
+        return config.scratchVolumes.join(',');
+    } else if (key == "volumes") {
+        return config.bulkVolumes.join(',');
+    } else if (key.startsWith("camera.")) {
+        QStringList parts = key.split('.');
+        return config.cameraModes.value(parts.value(1)).value(parts.value(2));
+    }
+    return QString();
+}
+
+static QStringList configKeys(const ServiceConfig& config) {
+    QStringList keys = { "listen_address", "port", "epoll", "io_threads", "max_connections", "idle_timeout_ms",
+                         "usb_ids_path", "pipeline_affinity", "record_duration_s", "record_fps", "preview_fps",
+                         "rtp_mtu", "rtp_jpeg_quality", "h264_bitrate", "h264_gop", "h264_preset",
+                         "h264_threads", "direct_io", "audio_ring_ms", "v4l2_buffers", "scratch_volumes",
+                         "volumes" };
+    for (auto camera = config.cameraModes.constBegin(); camera != config.cameraModes.constEnd(); ++camera) {
+        for (const QString& parameter : camera->keys()) {
+            keys.append(QString("camera.%1.%2").arg(camera.key(), parameter));
+        }
+    }
+    return keys;
+}
+
+static QString jsonValueText(const QJsonValue& value) {
+    if (value.isBool()) {
+        return value.toBool() ? "true" : "false";
+    }
+    if (value.isDouble()) {
+        return QString::number(static_cast<qint64>(value.toDouble()));
+    }
+    if (value.isArray()) {
+        QStringList items;
+        for (const QJsonValue& item : value.toArray()) {
+            items.append(jsonValueText(item));
+        }
+        return items.join(',');
+    }
+    return value.toString();
+}
+
+bool loadServiceConfig(const QString& filePath, QString& error) {
+    QFile file(filePath);
+    if (!file.open(QIODevice::ReadOnly)) {
+        error = "Unable to open config file: " + filePath;
+        return false;
+    }
+    QJsonParseError parseError;
+    QJsonDocument document = QJsonDocument::fromJson(file.readAll(), &parseError);
+    if (!document.isObject()) {
+        error = QString("Invalid config file %1: %2").arg(filePath, parseError.errorString());
+        return false;
+    }
+    ServiceConfig config;
+    QJsonObject root = document.object();
+    for (auto it = root.constBegin(); it != root.constEnd(); ++it) {
+        ConfigApply apply;
+        if (it.key() == "cameras" && it->isObject()) {
+            QJsonObject cameras = it->toObject();
+            for (auto camera = cameras.constBegin(); camera != cameras.constEnd(); ++camera) {
+                QJsonObject parameters = camera->toObject();
+                for (auto parameter = parameters.constBegin(); parameter != parameters.constEnd(); ++parameter) {
+                    QString key = QString("camera.%1.%2").arg(camera.key(), parameter.key());
+                    if (!assignConfigValue(config, key, jsonValueText(parameter.value()), apply)) {
+                        error = QString("Invalid config value for %1 in %2").arg(key, filePath);
+                        return false;
+                    }
+                }
+            }
+            continue;
+        }
+        if (!assignConfigValue(config, it.key(), jsonValueText(it.value()), apply)) {
+            error = QString("Invalid config value for %1 in %2").arg(it.key(), filePath);
+            return false;
+        }
+    }
+    QMutexLocker locker(&configMutex);
+    currentConfig = config;
+    currentConfigPath = filePath;
+    qDebug() << "Loaded service config from" << filePath;
+    return true;
+}
+
+bool saveServiceConfig(const QString& filePath, QString& error) {
+    QMutexLocker locker(&configMutex);
+    QString path = filePath.isEmpty() ? currentConfigPath : filePath;
+    if (path.isEmpty()) {
+        path = QCoreApplication::applicationDirPath() + "/camera-backend.json";
+    }
+    QJsonObject root;
+    QJsonObject cameras;
+    for (const QString& key : configKeys(currentConfig)) {
+        QString value = configValue(currentConfig, key);
+        if (key.startsWith("camera.")) {
+            QStringList parts = key.split('.');
+            QJsonObject camera = cameras.value(parts.at(1)).toObject();
+            camera.insert(parts.at(2), value);
+            cameras.insert(parts.at(1), camera);
+        } else if (key == "scratch_volumes" || key == "volumes") {
+            root.insert(key, QJsonArray::fromStringList(parseConfigList(value)));
+        } else if (value == "true" || value == "false") {
+            root.insert(key, value == "true");
+        } else {
+            bool numeric = false;
+            qint64 number = value.toLongLong(&numeric);
+            root.insert(key, numeric ? QJsonValue(number) : QJsonValue(value));
+        }
+    }
+    if (!cameras.isEmpty()) {
+        root.insert("cameras", cameras);
+    }
+    QFile file(path);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate) ||
+        file.write(QJsonDocument(root).toJson(QJsonDocument::Indented)) < 0) {
+        error = "Unable to write config file: " + path;
+        return false;
+    }
+    currentConfigPath = path;
+    return true;
+}
+
+QString serviceConfigPath() {
+    QMutexLocker locker(&configMutex);
+    return currentConfigPath;
+}
+
+QString serviceUsbIdsPath(const ServiceConfig& config) {
+    return config.usbIdsPath.isEmpty() ? QCoreApplication::applicationDirPath() + "/usb.ids" : config.usbIdsPath;
+}
+
+ServiceConfig serviceConfig() {
+    QMutexLocker locker(&configMutex);
+    return currentConfig;
+}
+
+QStringList serviceConfigKeys() {
+    QMutexLocker locker(&configMutex);
+    return configKeys(currentConfig);
+}
+
+QString serviceConfigValue(const QString& key) {
+    QMutexLocker locker(&configMutex);
+    return configValue(currentConfig, key);
+}
+
+bool setServiceConfigValue(const QString& key, const QString& value, ConfigApply& apply, QString& error) {
+    QMutexLocker locker(&configMutex);
+    ServiceConfig config = currentConfig;
+    if (!assignConfigValue(config, key, value, apply)) {
+        error = QString("Invalid config value for %1: %2").arg(key, value);
+        return false;
+    }
+    currentConfig = config;
+    return true;
+}
+
+bool applyCaptureParameter(CaptureParameters& target, const QString& key, const QString& value, QString& error) {
+    bool ok = true;
+    if (key == "resolution") {
+        QStringList size = value.toLower().split('x');
+        bool heightOk = false;
+        target.width = size.size() == 2 ? size.at(0).toUInt(&ok) : 0;
+        target.height = size.size() == 2 ? size.at(1).toUInt(&heightOk) : 0;
+        ok = ok && heightOk && target.width > 0 && target.height > 0;
+    } else if (key == "width") {
+        target.width = value.toUInt(&ok);
+    } else if (key == "height") {
+        target.height = value.toUInt(&ok);
+    } else if (key == "fps") {
+        target.fps = value.toUInt(&ok);
+        ok = ok && target.fps > 0;
+    } else if (key == "duration") {
+        target.durationSeconds = value.toInt(&ok);
+        ok = ok && target.durationSeconds > 0;
+    } else if (key == "format") {
+        target.pixelFormat = value;
+    } else if (key == "container") {
+        target.container = value.toLower();
+        ok = target.container == "avi" || target.container == "mp4";
+    } else if (key == "audio") {
+        target.audioCodec = value.toLower();
+        ok = target.audioCodec == "pcm" || target.audioCodec == "aac" || target.audioCodec == "none";
+    } else if (key == "audio_bitrate") {
+        target.audioBitrate = value.toUInt(&ok);
+        ok = ok && target.audioBitrate >= 8000;
+    } else {
+        error = "Unknown parameter: " + key;
+        return false;
+    }
+    if (!ok) {
+        error = "Invalid value for " + key + ": " + value;
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <QMap>
+#include <QString>
+#include <QStringList>
+
+struct CaptureParameters;
+
+enum class ConfigApply {
+    Live,
+    NextCapture,
+    ServerRestart,
+    Startup
+};
+
+struct ServiceConfig {
+    QString listenAddress = "127.0.0.1";
+    quint16 port = 12345;
+    bool epoll = false;
+    int ioThreads = 0;
+    int maxConnections = 0;
+    int idleTimeoutMs = 5 * 60 * 1000;
+    QString usbIdsPath;
+    bool pipelineAffinity = true;
+    int recordDurationSeconds = 5;
+    int recordFps = 30;
+    int previewFps = 15;
+    int rtpMtu = 1400;
+    int rtpJpegQuality = 80;
+    int h264Bitrate = 4000000;
+    int h264Gop = 60;
+    QString h264Preset;
+    int h264Threads = 0;
+    bool directIo = false;
+    int audioRingMs = 2000;
+    int v4l2Buffers = 4;
+    QStringList scratchVolumes;
+    QStringList bulkVolumes;
+    QMap<QString, QMap<QString, QString>> cameraModes;
+};
+
+bool loadServiceConfig(const QString& filePath, QString& error);
+bool saveServiceConfig(const QString& filePath, QString& error);
+QString serviceConfigPath();
+QString serviceUsbIdsPath(const ServiceConfig& config);
+ServiceConfig serviceConfig();
+QStringList serviceConfigKeys();
+QString serviceConfigValue(const QString& key);
+bool setServiceConfigValue(const QString& key, const QString& value, ConfigApply& apply, QString& error);
+bool applyCaptureParameter(CaptureParameters& target, const QString& key, const QString& value, QString& error);
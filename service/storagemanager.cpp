@@ -0,0 +1,398 @@
+#include "storagemanager.h"
+#include "recordingindex.h"
+#include "recordingregistry.h"
+
+#include <QDir>
+#include <QSet>
+#include <QHash>
+#include <QFile>
+#include <QDebug>
+#include <QMutex>
+#include <QThread>
+#include <QDateTime>
+#include <QFileInfo>
+#include <QStorageInfo>
+#include <QWaitCondition>
+#include <climits>
+
+struct StorageVolume {
+    QString path;
+    StorageTier tier = StorageTier::Bulk;
+    int activeRecordings = 0;
+};
+
+struct PendingMove {
+    QString filePath;
+    qint64 readyAtMs = 0;
+    int attempts = 0;
+};
+
+static const qint64 minimumFreeBytes = 1LL << 30;
+static const qint64 archiveDelayMs = 60 * 1000;
+static const qint64 retryDelayMs = 30 * 1000;
+static const int maxMoveAttempts = 5;
+
+static QMutex storageMutex;
+static QWaitCondition moverCondition;
+static QList<StorageVolume> volumes;
+static QMultiHash<QString, QString> recordedFiles;
+static QSet<QString> openRecordings;
+static QList<PendingMove> pendingMoves;
+static QThread* moverThread = nullptr;
+static bool moverRunning = false;
+
+static QString normalizedPath(const QString& path) {
+    return QDir::cleanPath(QFileInfo(path).absoluteFilePath());
+}
+
+static int volumeIndexFor(const QString& path) {
+    int selected = -1;
+    for (int i = 0; i < volumes.size(); ++i) {
+        const QString& volumePath = volumes.at(i).path;
+        if ((path == volumePath || path.startsWith(volumePath + '/')) &&
+            (selected < 0 || volumePath.size() > volumes.at(selected).path.size())) {
+            selected = i;
+        }
+    }
+    return selected;
+}
+
+static bool isDefaultSearchDirectory(const QString& directory) {
+    if (directory == normalizedPath(QDir::currentPath())) {
+        return true;
+    }
+    for (const StorageVolume& volume : volumes) {
+        if (volume.path == directory) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static QString openRecordingFor(const QString& path) {
+    for (const QString& openPath : openRecordings) {
+        if (path == openPath || path.startsWith(openPath + '.')) {
+            return openPath;
+        }
+    }
+    return QString();
+}
+
+static void forgetRecordedFile(const QString& path) {
+    QFileInfo fileInfo(path);
+    QString directory = fileInfo.absolutePath();
+    QString name = fileInfo.fileName();
+    while (true) {
+        if (recordedFiles.remove(name, directory) > 0) {
+            return;
+        }
+        int dot = name.lastIndexOf('.');
+        if (dot <= 0) {
+            return;
+        }
+        name.truncate(dot);
+    }
+}
+
+static bool isRecordingFileName(const QString& fileName) {
+    return fileName.startsWith("video_camera_") || fileName.startsWith("timelapse_camera_") ||
+           fileName.startsWith("sync_");
+}
+
+static QString selectVolume(StorageTier tier, qint64 requiredBytes) {
+    QString selected;
+    double bestScore = -1;
+    for (const StorageVolume& volume : volumes) {
+        if (volume.tier != tier) {
+            continue;
+        }
+        qint64 available = QStorageInfo(volume.path).bytesAvailable();
+        if (available < requiredBytes) {
+            continue;
+        }
+        double score = static_cast<double>(available) / (volume.activeRecordings + 1);
+        if (score > bestScore) {
+            bestScore = score;
+            selected = volume.path;
+        }
+    }
+    return selected;
+}
+
+static bool hasTier(StorageTier tier) {
+    for (const StorageVolume& volume : volumes) {
+        if (volume.tier == tier) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void addStorageVolume(const QString& path, StorageTier tier) {
+    QString volumePath = normalizedPath(path);
+    if (!QDir().mkpath(volumePath)) {
+        qWarning() << "Failed to create storage volume directory:" << volumePath;
+        return;
+    }
+    QMutexLocker locker(&storageMutex);
+    StorageVolume volume;
+    volume.path = volumePath;
+    volume.tier = tier;
+    volumes.append(volume);
+    qDebug() << "Storage volume:" << volumePath << (tier == StorageTier::Scratch ? "scratch" : "bulk");
+}
+
+void setStorageVolumes(StorageTier tier, const QStringList& paths) {
+    QStringList volumePaths;
+    for (const QString& path : paths) {
+        QString volumePath = normalizedPath(path);
+        if (!QDir().mkpath(volumePath)) {
+            qWarning() << "Failed to create storage volume directory:" << volumePath;
+            continue;
+        }
+        if (!volumePaths.contains(volumePath)) {
+            volumePaths.append(volumePath);
+        }
+    }
+    QMutexLocker locker(&storageMutex);
+    for (int i = volumes.size() - 1; i >= 0; --i) {
+        const StorageVolume& volume = volumes.at(i);
+        if (volume.tier == tier && !volumePaths.removeOne(volume.path)) {
+            qDebug() << "Storage volume removed:" << volume.path;
+            volumes.removeAt(i);
+        }
+    }
+    for (const QString& volumePath : volumePaths) {
+        StorageVolume volume;
+        volume.path = volumePath;
+        volume.tier = tier;
+        volumes.append(volume);
+        qDebug() << "Storage volume:" << volumePath << (tier == StorageTier::Scratch ? "scratch" : "bulk");
+    }
+}
+
+QList<StorageVolumeStatus> storageVolumes() {
+    QMutexLocker locker(&storageMutex);
+    QList<StorageVolumeStatus> result;
+    for (const StorageVolume& volume : volumes) {
+        StorageVolumeStatus status;
+        status.path = volume.path;
+        status.tier = volume.tier;
+        status.bytesAvailable = QStorageInfo(volume.path).bytesAvailable();
+        status.activeRecordings = volume.activeRecordings;
+        result.append(status);
+    }
+    return result;
+}
+
+QString allocateRecordingPath(const QString& basePath, const QString& fileName) {
+    QMutexLocker locker(&storageMutex);
+    QString directory;
+    if (!basePath.isEmpty()) {
+        directory = normalizedPath(basePath);
+    } else if (!volumes.isEmpty()) {
+        directory = selectVolume(StorageTier::Scratch, minimumFreeBytes);
+        if (directory.isEmpty()) {
+            directory = selectVolume(StorageTier::Bulk, minimumFreeBytes);
+        }
+        if (directory.isEmpty()) {
+            qWarning() << "No storage volume has enough free space, recording to the working directory.";
+        }
+    }
+    if (directory.isEmpty()) {
+        directory = normalizedPath(QDir::currentPath());
+    }
+    if (!QDir().mkpath(directory)) {
+        qWarning() << "Failed to create directory:" << directory;
+    }
+    int index = volumeIndexFor(directory);
+    if (index >= 0) {
+        volumes[index].activeRecordings++;
+    }
+    QString filePath = QDir(directory).filePath(fileName);
+    openRecordings.insert(filePath);
+    if (!recordedFiles.contains(fileName, directory)) {
+        recordedFiles.insert(fileName, directory);
+    }
+    return filePath;
+}
+
+void releaseRecordingPath(const QString& filePath, bool archive) {
+    QString path = normalizedPath(filePath);
+    QMutexLocker locker(&storageMutex);
+    openRecordings.remove(openRecordingFor(path));
+    if (isDefaultSearchDirectory(QFileInfo(path).absolutePath())) {
+        forgetRecordedFile(path);
+    }
+    int index = volumeIndexFor(path);
+    if (index < 0) {
+        return;
+    }
+    volumes[index].activeRecordings = qMax(0, volumes.at(index).activeRecordings - 1);
+    if (!archive || !moverRunning || volumes.at(index).tier != StorageTier::Scratch || !hasTier(StorageTier::Bulk)) {
+        return;
+    }
+    PendingMove move;
+    move.filePath = path;
+    move.readyAtMs = QDateTime::currentMSecsSinceEpoch() + archiveDelayMs;
+    pendingMoves.append(move);
+    moverCondition.wakeOne();
+}
+
+QString locateRecording(const QString& fileName) {
+    QStringList directories;
+    directories.append(QDir::currentPath());
+    {
+        QMutexLocker locker(&storageMutex);
+        for (const StorageVolume& volume : volumes) {
+            directories.append(volume.path);
+        }
+        QString name = fileName;
+        while (true) {
+            QStringList recordedDirectories = recordedFiles.values(name);
+            if (!recordedDirectories.isEmpty()) {
+                directories.append(recordedDirectories);
+                break;
+            }
+            int dot = name.lastIndexOf('.');
+            if (dot <= 0) {
+                break;
+            }
+            name.truncate(dot);
+        }
+    }
+    for (const QString& directory : directories) {
+        QFileInfo fileInfo(QDir(directory), fileName);
+        if (fileInfo.isFile()) {
+            return fileInfo.absoluteFilePath();
+        }
+    }
+    return QString();
+}
+
+static bool moveFile(const QString& source, const QString& target) {
+    QFile::remove(target);
+    if (QFile::rename(source, target)) {
+        return true;
+    }
+    if (!QFile::copy(source, target)) {
+        QFile::remove(target);
+        return false;
+    }
+    if (!QFile::remove(source)) {
+        QFile::remove(target);
+        return false;
+    }
+    return true;
+}
+
+static bool archiveRecording(const QString& filePath) {
+    if (activeRecordingCommittedBytes(filePath) >= 0) {
+        return false;
+    }
+    QString directory;
+    {
+        QMutexLocker locker(&storageMutex);
+        if (!openRecordingFor(filePath).isEmpty()) {
+            return false;
+        }
+        directory = selectVolume(StorageTier::Bulk, QFileInfo(filePath).size() + minimumFreeBytes);
+    }
+    if (directory.isEmpty()) {
+        qWarning() << "No bulk storage volume can hold" << filePath;
+        return false;
+    }
+    QString target = QDir(directory).filePath(QFileInfo(filePath).fileName());
+    if (!moveFile(filePath, target)) {
+        qWarning() << "Failed to move" << filePath << "to" << target;
+        return false;
+    }
+    QString indexPath = recordingIndexPath(filePath);
+    if (QFile::exists(indexPath) && !moveFile(indexPath, recordingIndexPath(target))) {
+        qWarning() << "Failed to move recording index" << indexPath;
+    }
+    {
+        QMutexLocker locker(&storageMutex);
+        forgetRecordedFile(filePath);
+    }
+    qDebug() << "Archived" << filePath << "to" << target;
+    return true;
+}
+
+static void runStorageMover() {
+    QMutexLocker locker(&storageMutex);
+    while (moverRunning) {
+        qint64 now = QDateTime::currentMSecsSinceEpoch();
+        int ready = -1;
+        qint64 nextReadyAtMs = LLONG_MAX;
+        for (int i = 0; i < pendingMoves.size(); ++i) {
+            if (pendingMoves.at(i).readyAtMs <= now) {
+                ready = i;
+                break;
+            }
+            nextReadyAtMs = qMin(nextReadyAtMs, pendingMoves.at(i).readyAtMs);
+        }
+        if (ready < 0) {
+            moverCondition.wait(&storageMutex, nextReadyAtMs == LLONG_MAX ? ULONG_MAX
+                                                                           : static_cast<unsigned long>(nextReadyAtMs - now));
+            continue;
+        }
+        PendingMove move = pendingMoves.takeAt(ready);
+        locker.unlock();
+        bool moved = archiveRecording(move.filePath);
+        locker.relock();
+        if (!moved && QFile::exists(move.filePath)) {
+            if (++move.attempts < maxMoveAttempts) {
+                move.readyAtMs = QDateTime::currentMSecsSinceEpoch() + retryDelayMs;
+                pendingMoves.append(move);
+            } else {
+                qWarning() << "Giving up archiving" << move.filePath;
+            }
+        }
+    }
+}
+
+void startStorageMover() {
+    QMutexLocker locker(&storageMutex);
+    if (moverThread || !hasTier(StorageTier::Scratch) || !hasTier(StorageTier::Bulk)) {
+        return;
+    }
+    for (const StorageVolume& volume : volumes) {
+        if (volume.tier != StorageTier::Scratch) {
+            continue;
+        }
+        for (const QFileInfo& fileInfo : QDir(volume.path).entryInfoList(QDir::Files)) {
+            QString filePath = normalizedPath(fileInfo.absoluteFilePath());
+            if (fileInfo.suffix() == "idx" || !isRecordingFileName(fileInfo.fileName()) ||
+                !openRecordingFor(filePath).isEmpty()) {
+                continue;
+            }
+            PendingMove move;
+            move.filePath = filePath;
+            move.readyAtMs = fileInfo.lastModified().toMSecsSinceEpoch() + archiveDelayMs;
+            pendingMoves.append(move);
+        }
+    }
+    moverRunning = true;
+    moverThread = QThread::create(runStorageMover);
+    moverThread->start(QThread::LowPriority);
+}
+
+void stopStorageMover() {
+    {
+        QMutexLocker locker(&storageMutex);
+        if (!moverThread) {
+            return;
+        }
+        moverRunning = false;
+        moverCondition.wakeAll();
+    }
+    moverThread->wait();
+    delete moverThread;
+    moverThread = nullptr;
+}
+
+int pendingStorageMoves() {
+    QMutexLocker locker(&storageMutex);
+    return pendingMoves.size();
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <QList>
+#include <QString>
+#include <QStringList>
+
+enum class StorageTier {
+    Scratch,
+    Bulk
+};
+
+struct StorageVolumeStatus {
+    QString path;
+    StorageTier tier = StorageTier::Bulk;
+    qint64 bytesAvailable = 0;
+    int activeRecordings = 0;
+};
+
+void addStorageVolume(const QString& path, StorageTier tier);
+void setStorageVolumes(StorageTier tier, const QStringList& paths);
+QList<StorageVolumeStatus> storageVolumes();
+
+QString allocateRecordingPath(const QString& basePath, const QString& fileName);
+void releaseRecordingPath(const QString& filePath, bool archive);
+QString locateRecording(const QString& fileName);
+
+void startStorageMover();
+void stopStorageMover();
+int pendingStorageMoves();
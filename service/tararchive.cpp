@@ -0,0 +1,60 @@
+#include "tararchive.h"
+
+#include <cstring>
+
+static const int tarBlockSize = 512;
+
+static void writeOctal(char* field, int width, qint64 value) {
+    QByteArray digits = QByteArray::number(value, 8).rightJustified(width - 1, '0');
+    memcpy(field, digits.constData(), width - 1);
+    field[width - 1] = '\0';
+}
+
+static void writeNumeric(char* field, int width, qint64 value) {
+    if (value < (Q_INT64_C(1) << (3 * (width - 1)))) {
+        writeOctal(field, width, value);
+        return;
+    }
+    memset(field, 0, width);
+    field[0] = static_cast<char>(0x80);
+    for (int i = width - 1; i > 0 && value > 0; --i) {
+        field[i] = static_cast<char>(value & 0xff);
+        value >>= 8;
+    }
+}
+
+QByteArray tarEntryHeader(const QString& name, qint64 size, qint64 modifiedSeconds) {
+    QByteArray header(tarBlockSize, '\0');
+    char* block = header.data();
+    QByteArray encodedName = name.toUtf8().left(99);
+    memcpy(block, encodedName.constData(), encodedName.size());
+    writeOctal(block + 100, 8, 0644);
+    writeOctal(block + 108, 8, 0);
+    writeOctal(block + 116, 8, 0);
+    writeNumeric(block + 124, 12, size);
+    writeOctal(block + 136, 12, modifiedSeconds);
+    memset(block + 148, ' ', 8);
+    block[156] = '0';
+    memcpy(block + 257, "ustar", 6);
+    memcpy(block + 263, "00", 2);
+
+    quint32 checksum = 0;
+    for (int i = 0; i < tarBlockSize; ++i) {
+        checksum += static_cast<uchar>(block[i]);
+    }
+    writeOctal(block + 148, 7, checksum);
+    block[155] = ' ';
+    return header;
+}
+
+QByteArray tarEntryPadding(qint64 size) {
+    return QByteArray(static_cast<int>((tarBlockSize - size % tarBlockSize) % tarBlockSize), '\0');
+}
+
+QByteArray tarTrailer() {
+    return QByteArray(2 * tarBlockSize, '\0');
+}
+
+qint64 tarEntrySize(qint64 size) {
+    return tarBlockSize + size + (tarBlockSize - size % tarBlockSize) % tarBlockSize;
+}
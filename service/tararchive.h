@@ -0,0 +1,9 @@
+#pragma once
+
+#include <QString>
+#include <QByteArray>
+
+QByteArray tarEntryHeader(const QString& name, qint64 size, qint64 modifiedSeconds);
+QByteArray tarEntryPadding(qint64 size);
+QByteArray tarTrailer();
+qint64 tarEntrySize(qint64 size);
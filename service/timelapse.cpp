@@ -0,0 +1,194 @@
+#include "timelapse.h"
+#include "cameraprocessingsv.h"
+#include "framesync.h"
+#include "h264writer.h"
+#include "pipelinescheduler.h"
+#include "rawframe.h"
+#include "recordingindex.h"
+#include "recordingregistry.h"
+#include "tracing.h"
+
+#include <QFile>
+#include <QDebug>
+#include <QElapsedTimer>
+#include <functional>
+#include <opencv2/opencv.hpp>
+
+static const int timeLapseDeviceFps = 5;
+static const int drainLimitFrames = 8;
+static const qint64 drainFreshFrameNs = 4000000;
+
+TimeLapseCapture::TimeLapseCapture(int cameraIndex, const QString& filePath, const TimeLapseSettings& settings,
+                                   QObject* parent)
+    : QThread(parent), deviceIndex(cameraIndex), outputPath(filePath), timeLapseSettings(settings) {
+}
+
+TimeLapseCapture::~TimeLapseCapture() {
+    stop();
+}
+
+int TimeLapseCapture::cameraIndex() const {
+    return deviceIndex;
+}
+
+QString TimeLapseCapture::filePath() const {
+    return outputPath;
+}
+
+const TimeLapseSettings& TimeLapseCapture::settings() const {
+    return timeLapseSettings;
+}
+
+quint32 TimeLapseCapture::frameCount() const {
+    return capturedFrames;
+}
+
+void TimeLapseCapture::stop() {
+    {
+        QMutexLocker locker(&stopMutex);
+        stopRequested = true;
+        stopCondition.wakeAll();
+    }
+    wait();
+}
+
+bool TimeLapseCapture::waitUntil(qint64 timestampUs) {
+    QMutexLocker locker(&stopMutex);
+    while (!stopRequested) {
+        qint64 remainingUs = timestampUs - currentCaptureTimestampUs();
+        if (remainingUs <= 0) {
+            return true;
+        }
+        TRACE_SCOPE("timelapse_sleep");
+        stopCondition.wait(&stopMutex, static_cast<unsigned long>((remainingUs + 999) / 1000));
+    }
+    return false;
+}
+
+void TimeLapseCapture::run() {
+    bool h264 = timeLapseSettings.format == "h264";
+    bool keepOpen = timeLapseSettings.intervalMs < timeLapseSettings.idleCloseMs;
+    cv::VideoCapture cap;
+    std::function<bool(cv::Mat&, qint64&)> grab;
+    RawPixelFormat format = RawPixelFormat::Bgr;
+    int frameWidth = 0;
+    int frameHeight = 0;
+    bool deviceOpen = false;
+    bool freshlyOpened = false;
+    H264Writer writer;
+    bool writerOpen = false;
+    QFile file(outputPath);
+    RecordingIndexWriter index;
+    if (!h264) {
+        if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+            qWarning() << "Failed to open time-lapse file" << outputPath;
+            return;
+        }
+        index.open(outputPath, true);
+        beginActiveRecording(outputPath);
+    }
+    qDebug() << "Time-lapse started for camera" << deviceIndex << "every" << timeLapseSettings.intervalMs << "ms to"
+             << outputPath << (keepOpen ? "(device kept open)" : "(device closed between frames)");
+    qint64 intervalUs = static_cast<qint64>(timeLapseSettings.intervalMs) * 1000;
+    qint64 nextCaptureUs = currentCaptureTimestampUs();
+    while (waitUntil(nextCaptureUs)) {
+        nextCaptureUs += intervalUs;
+        if (!deviceOpen) {
+            deviceOpen = openFrameSource(deviceIndex, !h264, cap, grab, format, frameWidth, frameHeight,
+                                         timeLapseDeviceFps);
+            if (!deviceOpen) {
+                qWarning() << "Time-lapse could not open camera" << deviceIndex << ", retrying next interval.";
+                continue;
+            }
+            if (cap.isOpened()) {
+                cap.set(cv::CAP_PROP_FPS, timeLapseDeviceFps);
+                cap.set(cv::CAP_PROP_BUFFERSIZE, 1);
+            }
+            freshlyOpened = true;
+        }
+        cv::Mat frame;
+        qint64 deviceTimestampUs = 0;
+        bool grabbed = false;
+        {
+            TRACE_SCOPE("timelapse_grab");
+            PipelineStageTimer grabTimer(PipelineStage::Grab, deviceIndex);
+            int attempts = freshlyOpened ? timeLapseSettings.warmupFrames + 1 : drainLimitFrames;
+            for (int attempt = 0; attempt < attempts; ++attempt) {
+                QElapsedTimer drainTimer;
+                drainTimer.start();
+                grabbed = grab(frame, deviceTimestampUs);
+                if (!grabbed || (!freshlyOpened && drainTimer.nsecsElapsed() >= drainFreshFrameNs)) {
+                    break;
+                }
+            }
+        }
+        freshlyOpened = false;
+        if (!grabbed) {
+            qWarning() << "Time-lapse failed to capture frame from camera" << deviceIndex;
+            grab = nullptr;
+            cap.release();
+            deviceOpen = false;
+            continue;
+        }
+        qint64 captureTimeUs = syncedCaptureTimestampUs(deviceIndex, currentCaptureTimestampUs(), deviceTimestampUs);
+        quint32 frameNumber = capturedFrames;
+        bool written = false;
+        {
+            TRACE_SCOPE("timelapse_encode");
+            PipelineThreadPlacement encodePlacement(PipelineStage::Encode, deviceIndex);
+            PipelineStageTimer encodeTimer(PipelineStage::Encode, deviceIndex);
+            if (h264) {
+                if (!writerOpen) {
+                    H264Settings settings;
+                    settings.container = "fmp4";
+                    settings.bitrate = timeLapseSettings.bitrate;
+                    settings.gopSize = timeLapseSettings.playbackFps;
+                    settings.fragmentFrames = timeLapseSettings.playbackFps;
+                    settings.preset = "veryfast";
+                    settings.threads = 1;
+                    writerOpen = writer.open(outputPath, frameWidth, frameHeight, timeLapseSettings.playbackFps, settings);
+                }
+                written = writerOpen && writer.writeRawFrame(frame, format, captureTimeUs);
+            } else {
+                QByteArray jpeg = rawFrameToJpeg(frame, format, frameWidth, frameHeight, timeLapseSettings.jpegQuality);
+                qint64 offset = file.pos();
+                written = !jpeg.isEmpty() && file.write(jpeg) == jpeg.size() && file.flush();
+                if (written) {
+                    index.append(frameNumber, captureTimeUs, static_cast<quint64>(offset),
+                                 static_cast<quint32>(jpeg.size()), true);
+                    updateActiveRecording(outputPath, file.pos());
+                }
+            }
+        }
+        frame.release();
+        if (written) {
+            capturedFrames++;
+        } else {
+            qWarning() << "Time-lapse failed to write frame" << frameNumber << "from camera" << deviceIndex;
+            if (h264 && !writerOpen) {
+                break;
+            }
+        }
+        if (!keepOpen) {
+            grab = nullptr;
+            cap.release();
+            deviceOpen = false;
+        }
+        qint64 now = currentCaptureTimestampUs();
+        if (nextCaptureUs < now) {
+            nextCaptureUs = now + intervalUs;
+        }
+    }
+    grab = nullptr;
+    cap.release();
+    if (writerOpen) {
+        PipelineThreadPlacement encodePlacement(PipelineStage::Encode, deviceIndex);
+        writer.close();
+    }
+    if (file.isOpen()) {
+        index.close();
+        file.close();
+        endActiveRecording(outputPath);
+    }
+    qDebug() << "Time-lapse stopped for camera" << deviceIndex << "after" << capturedFrames << "frames.";
+}
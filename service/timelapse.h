@@ -0,0 +1,47 @@
+#pragma once
+
+#include <QMutex>
+#include <QString>
+#include <QThread>
+#include <QWaitCondition>
+#include <atomic>
+
+struct TimeLapseSettings {
+    int intervalMs = 5000;
+    QString format = "mjpeg";
+    int jpegQuality = 0;
+    int playbackFps = 30;
+    int bitrate = 1000000;
+    int idleCloseMs = 15000;
+    int warmupFrames = 3;
+};
+
+class TimeLapseCapture : public QThread {
+    Q_OBJECT
+
+public:
+    TimeLapseCapture(int cameraIndex, const QString& filePath, const TimeLapseSettings& settings,
+                     QObject* parent = nullptr);
+    ~TimeLapseCapture();
+
+    int cameraIndex() const;
+    QString filePath() const;
+    const TimeLapseSettings& settings() const;
+    quint32 frameCount() const;
+
+    void stop();
+
+protected:
+    void run() override;
+
+private:
+    int deviceIndex;
+    QString outputPath;
+    TimeLapseSettings timeLapseSettings;
+    std::atomic<quint32> capturedFrames { 0 };
+    QMutex stopMutex;
+    QWaitCondition stopCondition;
+    bool stopRequested = false;
+
+    bool waitUntil(qint64 timestampUs);
+};
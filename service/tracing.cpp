@@ -0,0 +1,154 @@
+#include "tracing.h"
+
+#include <QFile>
+#include <QList>
+#include <QDebug>
+#include <QMutex>
+#include <atomic>
+#include <chrono>
+
+static const quint32 traceBufferCapacity = 16384;
+
+struct TraceEvent {
+    const char* name;
+    qint64 startNs;
+    qint64 durationNs;
+    quint32 threadId;
+};
+
+struct TraceBuffer {
+    TraceEvent events[traceBufferCapacity];
+    std::atomic<quint32> count { 0 };
+    std::atomic<quint32> dropped { 0 };
+    std::atomic<quint64> session { 0 };
+    std::atomic<bool> inUse { false };
+};
+
+struct ThreadTraceState {
+    TraceBuffer* buffer = nullptr;
+    quint32 threadId = 0;
+
+    ~ThreadTraceState() {
+        if (buffer) {
+            buffer->inUse = false;
+        }
+    }
+};
+
+static std::atomic<bool> tracingActive { false };
+static std::atomic<quint64> tracingSession { 0 };
+static std::atomic<quint32> nextTraceThreadId { 1 };
+static QMutex traceBuffersMutex;
+static QList<TraceBuffer*> traceBuffers;
+static thread_local ThreadTraceState threadTraceState;
+
+static qint64 traceClockNs() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static TraceBuffer* acquireTraceBuffer() {
+    QMutexLocker locker(&traceBuffersMutex);
+    for (TraceBuffer* buffer : traceBuffers) {
+        bool expected = false;
+        if (buffer->inUse.compare_exchange_strong(expected, true)) {
+            return buffer;
+        }
+    }
+    TraceBuffer* buffer = new TraceBuffer;
+    buffer->inUse = true;
+    traceBuffers.append(buffer);
+    return buffer;
+}
+
+static void appendTraceEvent(const char* name, qint64 startNs, qint64 endNs) {
+    ThreadTraceState& state = threadTraceState;
+    if (!state.buffer) {
+        state.buffer = acquireTraceBuffer();
+        state.threadId = nextTraceThreadId++;
+    }
+    TraceBuffer* buffer = state.buffer;
+    quint64 session = tracingSession.load(std::memory_order_acquire);
+    if (buffer->session.load(std::memory_order_relaxed) != session) {
+        buffer->count.store(0, std::memory_order_relaxed);
+        buffer->dropped.store(0, std::memory_order_relaxed);
+        buffer->session.store(session, std::memory_order_release);
+    }
+    quint32 index = buffer->count.load(std::memory_order_relaxed);
+    if (index >= traceBufferCapacity) {
+        buffer->dropped.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    buffer->events[index] = { name, startNs, endNs - startNs, state.threadId };
+    buffer->count.store(index + 1, std::memory_order_release);
+}
+
+bool startTracing() {
+#ifdef CAMERA_TRACING
+    tracingSession++;
+    tracingActive = true;
+    return true;
+#else
+    return false;
+#endif
+}
+
+bool isTracingActive() {
+    return tracingActive;
+}
+
+qint64 stopTracing(const QString& filePath) {
+    if (!tracingActive.exchange(false)) {
+        return -1;
+    }
+    QFile file(filePath);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+        qWarning() << "Failed to open trace file" << filePath;
+        return -1;
+    }
+    quint64 session = tracingSession;
+    qint64 written = 0;
+    quint32 dropped = 0;
+    file.write("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+    QMutexLocker locker(&traceBuffersMutex);
+    for (TraceBuffer* buffer : traceBuffers) {
+        if (buffer->session.load(std::memory_order_acquire) != session) {
+            continue;
+        }
+        quint32 count = buffer->count.load(std::memory_order_acquire);
+        dropped += buffer->dropped.load(std::memory_order_relaxed);
+        for (quint32 i = 0; i < count; ++i) {
+            const TraceEvent& event = buffer->events[i];
+            QByteArray line = written > 0 ? ",\n" : "\n";
+            line += "{\"name\":\"";
+            line += event.name;
+            line += "\",\"ph\":\"X\",\"pid\":1,\"tid\":";
+            line += QByteArray::number(event.threadId);
+            line += ",\"ts\":";
+            line += QByteArray::number(event.startNs / 1000.0, 'f', 3);
+            line += ",\"dur\":";
+            line += QByteArray::number(event.durationNs / 1000.0, 'f', 3);
+            line += "}";
+            file.write(line);
+            written++;
+        }
+    }
+    file.write("\n]}\n");
+    file.close();
+    if (dropped > 0) {
+        qWarning() << "Trace buffers overflowed," << dropped << "events were dropped.";
+    }
+    qDebug() << "Trace with" << written << "events written to" << filePath;
+    return written;
+}
+
+TraceScope::TraceScope(const char* name)
+    : eventName(tracingActive.load(std::memory_order_relaxed) ? name : nullptr),
+      startNs(eventName ? traceClockNs() : 0) {
+}
+
+TraceScope::~TraceScope() {
+    if (eventName && tracingActive.load(std::memory_order_relaxed)) {
+        appendTraceEvent(eventName, startNs, traceClockNs());
+    }
+}
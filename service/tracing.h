@@ -0,0 +1,26 @@
+#pragma once
+
+#include <QString>
+#include <QtGlobal>
+
+bool startTracing();
+qint64 stopTracing(const QString& filePath);
+bool isTracingActive();
+
+class TraceScope {
+public:
+    explicit TraceScope(const char* name);
+    ~TraceScope();
+
+private:
+    const char* eventName;
+    qint64 startNs;
+};
+
+#ifdef CAMERA_TRACING
+#define TRACE_CONCAT_INNER(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_INNER(a, b)
+#define TRACE_SCOPE(name) TraceScope TRACE_CONCAT(traceScope, __LINE__)(name)
+#else
+#define TRACE_SCOPE(name) do { } while (false)
+#endif
@@ -0,0 +1,72 @@
+#include "usbids.h"
+
+#include <QFile>
+#include <QMap>
+#include <QPair>
+#include <QDebug>
+#include <QTextStream>
+#include <QReadWriteLock>
+#include <QRegularExpression>
+
+static QMap<QString, QString> vendorMap;
+static QMap<QPair<QString, QString>, QString> deviceMap;
+static QReadWriteLock usbIdsLock;
+
+bool loadUsbIds(const QString &filePath) {
+    QFile file(filePath);
+    if (!file.open(QIODevice::ReadOnly | QIODevice::Text)) {
+        qWarning() << "Failed to open usb.ids file:" << filePath;
+        return false;
+    }
+    QMap<QString, QString> vendors;
+    QMap<QPair<QString, QString>, QString> devices;
+    QTextStream in(&file);
+    QString line;
+    QString currentVendorId;
+    QString currentVendorName;
+    static const QRegularExpression whitespaceRegex("\\s+");
+    while (!in.atEnd()) {
+        line = in.readLine();
+        if (line.trimmed().isEmpty() || line.trimmed().startsWith('#')) {
+            continue;
+        }
+        int tabCount = 0;
+        while (tabCount < line.length() && line[tabCount] == '\t') {
+            tabCount++;
+        }
+        QString trimmedLine = line.mid(tabCount);
+        trimmedLine = trimmedLine.trimmed();
+        if (tabCount == 0) {
+            QStringList parts = trimmedLine.split(whitespaceRegex, Qt::SkipEmptyParts);
+            if (parts.size() >= 2) {
+                currentVendorId = parts.takeFirst().toUpper();
+                currentVendorName = parts.join(' ');
+                vendors.insert(currentVendorId, currentVendorName);
+            }
+        } else if (tabCount == 1 && !currentVendorId.isEmpty()) {
+            QStringList parts = trimmedLine.split(whitespaceRegex, Qt::SkipEmptyParts);
+            if (parts.size() >= 2) {
+                QString deviceId = parts.takeFirst().toUpper();
+                QString deviceName = parts.join(' ');
+                QPair<QString, QString> key(currentVendorId, deviceId);
+                devices.insert(key, deviceName);
+            }
+        }
+    }
+    file.close();
+    QWriteLocker locker(&usbIdsLock);
+    vendorMap.swap(vendors);
+    deviceMap.swap(devices);
+    return true;
+}
+
+QString getVendorNameFromId(const QString &vendorId) {
+    QReadLocker locker(&usbIdsLock);
+    return vendorMap.value(vendorId.toUpper(), QString());
+}
+
+QString getDeviceNameFromIds(const QString &vendorId, const QString &deviceId) {
+    QPair<QString, QString> key(vendorId.toUpper(), deviceId.toUpper());
+    QReadLocker locker(&usbIdsLock);
+    return deviceMap.value(key, QString());
+}
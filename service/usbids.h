@@ -0,0 +1,7 @@
+#pragma once
+
+#include <QString>
+
+bool loadUsbIds(const QString& filePath);
+QString getVendorNameFromId(const QString& vendorId);
+QString getDeviceNameFromIds(const QString& vendorId, const QString& deviceId);
@@ -0,0 +1,570 @@
+#include "v4l2capture.h"
+
+#include <QDir>
+#include <QFile>
+#include <QDebug>
+#include <QFileInfo>
+#include <QJsonArray>
+#include <QJsonObject>
+#include <QJsonDocument>
+#include <algorithm>
+
+#include "usbids.h"
+
+#include <cerrno>
+#include <poll.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/ioctl.h>
+#include <linux/videodev2.h>
+
+static int xioctl(int descriptor, unsigned long request, void* argument) {
+    int status;
+    do {
+        status = ::ioctl(descriptor, request, argument);
+    } while (status < 0 && errno == EINTR);
+    return status;
+}
+
+static int openVideoNode(const QString& path, int flags) {
+    return ::open(QFile::encodeName(path).constData(), flags | O_CLOEXEC);
+}
+
+bool queryV4l2Device(const QString& devicePath, V4l2Device& device) {
+    bool ok = false;
+    int cameraIndex = devicePath.mid(devicePath.lastIndexOf("video") + 5).toInt(&ok);
+    if (!ok) {
+        return false;
+    }
+    int descriptor = openVideoNode(devicePath, O_RDONLY | O_NONBLOCK);
+    if (descriptor < 0) {
+        return false;
+    }
+    v4l2_capability capability = {};
+    bool capture = false;
+    if (xioctl(descriptor, VIDIOC_QUERYCAP, &capability) == 0) {
+        quint32 caps = (capability.capabilities & V4L2_CAP_DEVICE_CAPS) ? capability.device_caps
+                                                                         : capability.capabilities;
+        capture = (caps & V4L2_CAP_VIDEO_CAPTURE) && (caps & V4L2_CAP_STREAMING);
+    }
+    ::close(descriptor);
+    if (!capture) {
+        return false;
+    }
+    device.cameraIndex = cameraIndex;
+    device.path = devicePath;
+    device.name = QString::fromUtf8(reinterpret_cast<const char*>(capability.card));
+    device.busInfo = QString::fromUtf8(reinterpret_cast<const char*>(capability.bus_info));
+    return true;
+}
+
+QList<V4l2Device> enumerateV4l2Devices() {
+    QList<V4l2Device> devices;
+    const QStringList nodes = QDir("/dev").entryList({ "video*" }, QDir::System);
+    for (const QString& node : nodes) {
+        V4l2Device device;
+        if (queryV4l2Device("/dev/" + node, device)) {
+            devices.append(device);
+        }
+    }
+    std::sort(devices.begin(), devices.end(), [](const V4l2Device& a, const V4l2Device& b) {
+        return a.cameraIndex < b.cameraIndex;
+    });
+    return devices;
+}
+
+QList<V4l2Format> enumerateV4l2Formats(const QString& devicePath) {
+    QList<V4l2Format> formats;
+    int descriptor = openVideoNode(devicePath, O_RDONLY | O_NONBLOCK);
+    if (descriptor < 0) {
+        qWarning() << "Failed to open V4L2 device:" << devicePath;
+        return formats;
+    }
+    v4l2_fmtdesc description = {};
+    description.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    for (description.index = 0; xioctl(descriptor, VIDIOC_ENUM_FMT, &description) == 0; ++description.index) {
+        v4l2_frmsizeenum frameSize = {};
+        frameSize.pixel_format = description.pixelformat;
+        for (frameSize.index = 0; xioctl(descriptor, VIDIOC_ENUM_FRAMESIZES, &frameSize) == 0; ++frameSize.index) {
+            V4l2Format format;
+            format.pixelFormat = description.pixelformat;
+            if (frameSize.type == V4L2_FRMSIZE_TYPE_DISCRETE) {
+                format.width = frameSize.discrete.width;
+                format.height = frameSize.discrete.height;
+            } else {
+                format.width = frameSize.stepwise.max_width;
+                format.height = frameSize.stepwise.max_height;
+            }
+            v4l2_frmivalenum interval = {};
+            interval.pixel_format = format.pixelFormat;
+            interval.width = format.width;
+            interval.height = format.height;
+            bool haveInterval = false;
+            for (interval.index = 0; xioctl(descriptor, VIDIOC_ENUM_FRAMEINTERVALS, &interval) == 0; ++interval.index) {
+                const v4l2_fract& period = interval.type == V4L2_FRMIVAL_TYPE_DISCRETE ? interval.discrete
+                                                                                       : interval.stepwise.min;
+                if (period.numerator == 0) {
+                    continue;
+                }
+                format.fpsNumerator = period.denominator;
+                format.fpsDenominator = period.numerator;
+                formats.append(format);
+                haveInterval = true;
+                if (interval.type != V4L2_FRMIVAL_TYPE_DISCRETE) {
+                    break;
+                }
+            }
+            if (!haveInterval) {
+                formats.append(format);
+            }
+            if (frameSize.type != V4L2_FRMSIZE_TYPE_DISCRETE) {
+                break;
+            }
+        }
+    }
+    ::close(descriptor);
+    return formats;
+}
+
+QString v4l2FourccName(quint32 pixelFormat) {
+    char name[5] = { static_cast<char>(pixelFormat & 0xFF), static_cast<char>((pixelFormat >> 8) & 0xFF),
+                     static_cast<char>((pixelFormat >> 16) & 0xFF), static_cast<char>((pixelFormat >> 24) & 0xFF), 0 };
+    return QString::fromLatin1(name);
+}
+
+QString v4l2UsbAttribute(const QString& devicePath, const QString& attribute) {
+    QString node = QFileInfo(devicePath).fileName();
+    QString interfacePath = QFileInfo("/sys/class/video4linux/" + node + "/device").canonicalFilePath();
+    if (interfacePath.isEmpty()) {
+        return QString();
+    }
+    QFile file(QFileInfo(interfacePath).path() + "/" + attribute);
+    if (!file.open(QIODevice::ReadOnly)) {
+        return QString();
+    }
+    return QString::fromUtf8(file.readAll()).trimmed();
+}
+
+QString v4l2StableDeviceId(const V4l2Device& device) {
+    QString vendorId = v4l2UsbAttribute(device.path, "idVendor").toUpper();
+    QString productId = v4l2UsbAttribute(device.path, "idProduct").toUpper();
+    if (vendorId.isEmpty() || productId.isEmpty()) {
+        return "v4l2:" + device.busInfo;
+    }
+    QString serial = v4l2UsbAttribute(device.path, "serial");
+    if (serial.isEmpty()) {
+        serial = device.busInfo;
+    }
+    return QString("%1-%2-%3").arg(vendorId, productId, serial);
+}
+
+static RawPixelFormat rawFormatForPixelFormat(quint32 pixelFormat, bool* supported = nullptr) {
+    if (supported) {
+        *supported = true;
+    }
+    switch (pixelFormat) {
+    case V4L2_PIX_FMT_MJPEG:
+    case V4L2_PIX_FMT_JPEG:
+        return RawPixelFormat::Mjpeg;
+    case V4L2_PIX_FMT_YUYV:
+        return RawPixelFormat::Yuyv;
+    case V4L2_PIX_FMT_NV12:
+        return RawPixelFormat::Nv12;
+    case V4L2_PIX_FMT_YUV420:
+        return RawPixelFormat::I420;
+    case V4L2_PIX_FMT_BGR24:
+        return RawPixelFormat::Bgr;
+    default:
+        if (supported) {
+            *supported = false;
+        }
+        return RawPixelFormat::Bgr;
+    }
+}
+
+static quint32 formatFps(const V4l2Format& format) {
+    return format.fpsDenominator ? (format.fpsNumerator + format.fpsDenominator / 2) / format.fpsDenominator : 0;
+}
+
+bool selectV4l2Format(const QList<V4l2Format>& formats, bool preferCompressed, V4l2Format& selected) {
+    auto preference = [preferCompressed](const V4l2Format& format) {
+        bool compressed = rawFormatForPixelFormat(format.pixelFormat) == RawPixelFormat::Mjpeg;
+        return compressed == preferCompressed ? 1 : 0;
+    };
+    bool found = false;
+    for (const V4l2Format& format : formats) {
+        bool supported = false;
+        rawFormatForPixelFormat(format.pixelFormat, &supported);
+        if (!supported) {
+            continue;
+        }
+        if (found) {
+            bool smooth = formatFps(format) >= 24;
+            bool selectedSmooth = formatFps(selected) >= 24;
+            quint64 pixels = static_cast<quint64>(format.width) * format.height;
+            quint64 selectedPixels = static_cast<quint64>(selected.width) * selected.height;
+            if (smooth != selectedSmooth) {
+                if (!smooth) {
+                    continue;
+                }
+            } else if (pixels != selectedPixels) {
+                if (pixels < selectedPixels) {
+                    continue;
+                }
+            } else if (formatFps(format) != formatFps(selected)) {
+                if (formatFps(format) < formatFps(selected)) {
+                    continue;
+                }
+            } else if (preference(format) <= preference(selected)) {
+                continue;
+            }
+        }
+        selected = format;
+        found = true;
+    }
+    return found;
+}
+
+V4l2BufferAllocator::V4l2BufferAllocator(int descriptor, const QVector<void*>& starts, const QVector<size_t>& lengths)
+    : descriptor(descriptor), starts(starts), lengths(lengths) {
+}
+
+V4l2BufferAllocator::~V4l2BufferAllocator() {
+    for (int i = 0; i < starts.size(); ++i) {
+        ::munmap(starts.at(i), lengths.at(i));
+    }
+}
+
+cv::UMatData* V4l2BufferAllocator::allocate(int dims, const int* sizes, int type, void*, size_t* step,
+                                            cv::AccessFlag, cv::UMatUsageFlags) const {
+    if (pendingIndex < 0) {
+        return nullptr;
+    }
+    size_t total = CV_ELEM_SIZE(type);
+    for (int i = dims - 1; i >= 0; i--) {
+        if (step) {
+            step[i] = total;
+        }
+        total *= sizes[i];
+    }
+    if (total > lengths.at(pendingIndex)) {
+        return nullptr;
+    }
+    cv::UMatData* u = new cv::UMatData(this);
+    u->data = u->origdata = static_cast<uchar*>(starts.at(pendingIndex));
+    u->size = total;
+    u->flags |= cv::UMatData::USER_ALLOCATED;
+    u->userdata = reinterpret_cast<void*>(static_cast<intptr_t>(pendingIndex));
+    return u;
+}
+
+bool V4l2BufferAllocator::allocate(cv::UMatData* data, cv::AccessFlag, cv::UMatUsageFlags) const {
+    return data != nullptr;
+}
+
+void V4l2BufferAllocator::deallocate(cv::UMatData* u) const {
+    if (!u) {
+        return;
+    }
+    int index = static_cast<int>(reinterpret_cast<intptr_t>(u->userdata));
+    delete u;
+    bool destroy = false;
+    {
+        QMutexLocker locker(&mutex);
+        if (!detached) {
+            v4l2_buffer buffer = {};
+            buffer.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+            buffer.memory = V4L2_MEMORY_MMAP;
+            buffer.index = static_cast<quint32>(index);
+            if (xioctl(descriptor, VIDIOC_QBUF, &buffer) < 0) {
+                qWarning() << "Failed to requeue V4L2 buffer" << index;
+            }
+        }
+        outstanding--;
+        destroy = detached && outstanding == 0;
+    }
+    if (destroy) {
+        delete const_cast<V4l2BufferAllocator*>(this);
+    }
+}
+
+cv::Mat V4l2BufferAllocator::wrap(int index, size_t bytesUsed) {
+    cv::Mat frame;
+    frame.allocator = this;
+    QMutexLocker locker(&mutex);
+    pendingIndex = index;
+    try {
+        frame.create(1, static_cast<int>(bytesUsed), CV_8UC1);
+    } catch (const cv::Exception&) {
+        frame.release();
+    }
+    pendingIndex = -1;
+    if (frame.empty() || frame.data != starts.at(index)) {
+        qWarning() << "Failed to wrap V4L2 buffer" << index;
+        frame = cv::Mat();
+        return frame;
+    }
+    outstanding++;
+    return frame;
+}
+
+void V4l2BufferAllocator::detach() {
+    bool destroy = false;
+    {
+        QMutexLocker locker(&mutex);
+        detached = true;
+        destroy = outstanding == 0;
+    }
+    if (destroy) {
+        delete this;
+    }
+}
+
+V4l2Capture::~V4l2Capture() {
+    close();
+}
+
+bool V4l2Capture::open(const QString& devicePath, const V4l2Format& format, int bufferCount) {
+    close();
+    descriptor = openVideoNode(devicePath, O_RDWR | O_NONBLOCK);
+    if (descriptor < 0) {
+        qWarning() << "Failed to open V4L2 device:" << devicePath;
+        return false;
+    }
+
+    v4l2_format videoFormat = {};
+    videoFormat.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    videoFormat.fmt.pix.width = format.width;
+    videoFormat.fmt.pix.height = format.height;
+    videoFormat.fmt.pix.pixelformat = format.pixelFormat;
+    videoFormat.fmt.pix.field = V4L2_FIELD_ANY;
+    if (xioctl(descriptor, VIDIOC_S_FMT, &videoFormat) < 0) {
+        qWarning() << "Failed to set V4L2 format" << v4l2FourccName(format.pixelFormat) << "on" << devicePath;
+        close();
+        return false;
+    }
+    activeFormat = format;
+    activeFormat.width = videoFormat.fmt.pix.width;
+    activeFormat.height = videoFormat.fmt.pix.height;
+    activeFormat.pixelFormat = videoFormat.fmt.pix.pixelformat;
+
+    if (format.fpsNumerator > 0) {
+        v4l2_streamparm parameters = {};
+        parameters.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+        parameters.parm.capture.timeperframe.numerator = format.fpsDenominator;
+        parameters.parm.capture.timeperframe.denominator = format.fpsNumerator;
+        if (xioctl(descriptor, VIDIOC_S_PARM, &parameters) == 0 &&
+            parameters.parm.capture.timeperframe.numerator > 0) {
+            activeFormat.fpsNumerator = parameters.parm.capture.timeperframe.denominator;
+            activeFormat.fpsDenominator = parameters.parm.capture.timeperframe.numerator;
+        }
+    }
+
+    v4l2_requestbuffers request = {};
+    request.count = static_cast<quint32>(qMax(2, bufferCount));
+    request.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    request.memory = V4L2_MEMORY_MMAP;
+    if (xioctl(descriptor, VIDIOC_REQBUFS, &request) < 0 || request.count < 2) {
+        qWarning() << "V4L2 device does not support mmap streaming:" << devicePath;
+        close();
+        return false;
+    }
+
+    QVector<void*> starts;
+    QVector<size_t> lengths;
+    for (quint32 i = 0; i < request.count; ++i) {
+        v4l2_buffer buffer = {};
+        buffer.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+        buffer.memory = V4L2_MEMORY_MMAP;
+        buffer.index = i;
+        void* start = MAP_FAILED;
+        if (xioctl(descriptor, VIDIOC_QUERYBUF, &buffer) == 0) {
+            start = ::mmap(nullptr, buffer.length, PROT_READ | PROT_WRITE, MAP_SHARED, descriptor, buffer.m.offset);
+        }
+        if (start == MAP_FAILED) {
+            qWarning() << "Failed to map V4L2 buffer" << i;
+            for (int j = 0; j < starts.size(); ++j) {
+                ::munmap(starts.at(j), lengths.at(j));
+            }
+            close();
+            return false;
+        }
+        starts.append(start);
+        lengths.append(buffer.length);
+    }
+    allocator = new V4l2BufferAllocator(descriptor, starts, lengths);
+
+    for (quint32 i = 0; i < request.count; ++i) {
+        v4l2_buffer buffer = {};
+        buffer.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+        buffer.memory = V4L2_MEMORY_MMAP;
+        buffer.index = i;
+        if (xioctl(descriptor, VIDIOC_QBUF, &buffer) < 0) {
+            qWarning() << "Failed to queue V4L2 buffer" << i;
+            close();
+            return false;
+        }
+    }
+    v4l2_buf_type type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    if (xioctl(descriptor, VIDIOC_STREAMON, &type) < 0) {
+        qWarning() << "Failed to start V4L2 streaming on" << devicePath;
+        close();
+        return false;
+    }
+    streaming = true;
+    qDebug() << "V4L2 capture opened" << devicePath << v4l2FourccName(activeFormat.pixelFormat)
+             << activeFormat.width << "x" << activeFormat.height << "with" << request.count << "buffers";
+    return true;
+}
+
+cv::Mat V4l2Capture::readSample(int timeoutMs) {
+    if (!streaming) {
+        return cv::Mat();
+    }
+    pollfd request = { descriptor, POLLIN, 0 };
+    int status;
+    do {
+        status = ::poll(&request, 1, timeoutMs);
+    } while (status < 0 && errno == EINTR);
+    if (status <= 0) {
+        qWarning() << "Timed out waiting for V4L2 frame";
+        return cv::Mat();
+    }
+    v4l2_buffer buffer = {};
+    buffer.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    buffer.memory = V4L2_MEMORY_MMAP;
+    if (xioctl(descriptor, VIDIOC_DQBUF, &buffer) < 0) {
+        if (errno != EAGAIN) {
+            qWarning() << "Failed to dequeue V4L2 buffer";
+        }
+        return cv::Mat();
+    }
+    sampleTimestampUs = static_cast<qint64>(buffer.timestamp.tv_sec) * 1000000 + buffer.timestamp.tv_usec;
+    cv::Mat frame = allocator->wrap(static_cast<int>(buffer.index), buffer.bytesused);
+    if (frame.empty()) {
+        xioctl(descriptor, VIDIOC_QBUF, &buffer);
+    }
+    return frame;
+}
+
+void V4l2Capture::close() {
+    if (descriptor < 0) {
+        return;
+    }
+    if (streaming) {
+        v4l2_buf_type type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+        xioctl(descriptor, VIDIOC_STREAMOFF, &type);
+        streaming = false;
+    }
+    if (allocator) {
+        allocator->detach();
+        allocator = nullptr;
+    }
+    ::close(descriptor);
+    descriptor = -1;
+}
+
+bool V4l2Capture::isOpened() const {
+    return streaming;
+}
+
+const V4l2Format& V4l2Capture::format() const {
+    return activeFormat;
+}
+
+RawPixelFormat V4l2Capture::rawFormat() const {
+    return rawFormatForPixelFormat(activeFormat.pixelFormat);
+}
+
+qint64 V4l2Capture::lastTimestampUs() const {
+    return sampleTimestampUs;
+}
+
+bool openV4l2Camera(V4l2Capture& capture, int cameraIndex, bool preferCompressed, int bufferCount, int maxFps) {
+    QString devicePath = QString("/dev/video%1").arg(cameraIndex);
+    V4l2Format format;
+    if (!selectV4l2Format(enumerateV4l2Formats(devicePath), preferCompressed, format)) {
+        return false;
+    }
+    if (maxFps > 0 && (format.fpsNumerator == 0 || formatFps(format) > static_cast<quint32>(maxFps))) {
+        format.fpsNumerator = static_cast<quint32>(maxFps);
+        format.fpsDenominator = 1;
+    }
+    return capture.open(devicePath, format, bufferCount);
+}
+
+QString getV4l2CamerasInfo(bool* complete) {
+    QString info;
+    QList<V4l2Device> devices = enumerateV4l2Devices();
+    if (complete) {
+        *complete = !devices.isEmpty();
+    }
+    for (const V4l2Device& device : devices) {
+        QString vendorID = v4l2UsbAttribute(device.path, "idVendor").toUpper();
+        QString deviceID = v4l2UsbAttribute(device.path, "idProduct").toUpper();
+        QString vendorName = getVendorNameFromId(vendorID);
+        QString deviceProductName = getDeviceNameFromIds(vendorID, deviceID);
+        info += QString("Camera %1:\n").arg(device.cameraIndex);
+        info += QString("  Name: %1\n").arg(device.name);
+        info += QString("  Vendor name: %1\n").arg(vendorName.isEmpty() ? "Unknown" : vendorName);
+        info += QString("  Device name: %1\n").arg(deviceProductName.isEmpty() ? "Unknown" : deviceProductName);
+        info += QString("  Vendor ID: %1\n").arg(vendorID);
+        info += QString("  Device ID: %1\n").arg(deviceID);
+        info += "  Available video codecs:\n";
+        QList<V4l2Format> formats = enumerateV4l2Formats(device.path);
+        if (complete && formats.isEmpty()) {
+            *complete = false;
+        }
+        for (const V4l2Format& format : formats) {
+            info += QString("    %1 %2x%3 @ %4 fps\n").arg(v4l2FourccName(format.pixelFormat))
+                        .arg(format.width).arg(format.height)
+                        .arg(static_cast<double>(format.fpsNumerator) / qMax<quint32>(format.fpsDenominator, 1));
+        }
+        info += "  The associated audio device was not found\n";
+        info += "\n";
+    }
+    if (info.isEmpty()) {
+        info = "No cameras found.\n";
+    }
+    return info;
+}
+
+QByteArray getV4l2CamerasInfoJson(bool* complete) {
+    QJsonArray cameras;
+    QList<V4l2Device> devices = enumerateV4l2Devices();
+    if (complete) {
+        *complete = !devices.isEmpty();
+    }
+    for (const V4l2Device& device : devices) {
+        QString vendorID = v4l2UsbAttribute(device.path, "idVendor").toUpper();
+        QString deviceID = v4l2UsbAttribute(device.path, "idProduct").toUpper();
+        QJsonArray modes;
+        QList<V4l2Format> formats = enumerateV4l2Formats(device.path);
+        if (complete && formats.isEmpty()) {
+            *complete = false;
+        }
+        for (const V4l2Format& format : formats) {
+            QJsonObject entry;
+            entry["format"] = v4l2FourccName(format.pixelFormat);
+            entry["width"] = static_cast<int>(format.width);
+            entry["height"] = static_cast<int>(format.height);
+            entry["fps"] = static_cast<double>(format.fpsNumerator) / qMax<quint32>(format.fpsDenominator, 1);
+            modes.append(entry);
+        }
+        QJsonObject camera;
+        camera["index"] = device.cameraIndex;
+        camera["id"] = v4l2StableDeviceId(device).replace(':', '.');
+        camera["name"] = device.name;
+        camera["vendorId"] = vendorID;
+        camera["productId"] = deviceID;
+        camera["vendorName"] = getVendorNameFromId(vendorID);
+        camera["productName"] = getDeviceNameFromIds(vendorID, deviceID);
+        camera["videoModes"] = modes;
+        camera["audio"] = QJsonValue();
+        cameras.append(camera);
+    }
+    QJsonObject root;
+    root["cameras"] = cameras;
+    return QJsonDocument(root).toJson(QJsonDocument::Compact);
+}
@@ -0,0 +1,85 @@
+#pragma once
+
+#include <QList>
+#include <QByteArray>
+#include <QMutex>
+#include <QString>
+#include <QVector>
+#include <opencv2/core.hpp>
+
+#include "rawframe.h"
+
+struct V4l2Device {
+    int cameraIndex = -1;
+    QString path;
+    QString name;
+    QString busInfo;
+};
+
+struct V4l2Format {
+    quint32 pixelFormat = 0;
+    quint32 width = 0;
+    quint32 height = 0;
+    quint32 fpsNumerator = 0;
+    quint32 fpsDenominator = 1;
+};
+
+bool queryV4l2Device(const QString& devicePath, V4l2Device& device);
+QList<V4l2Device> enumerateV4l2Devices();
+QList<V4l2Format> enumerateV4l2Formats(const QString& devicePath);
+QString v4l2FourccName(quint32 pixelFormat);
+QString v4l2UsbAttribute(const QString& devicePath, const QString& attribute);
+QString v4l2StableDeviceId(const V4l2Device& device);
+bool selectV4l2Format(const QList<V4l2Format>& formats, bool preferCompressed, V4l2Format& selected);
+
+class V4l2BufferAllocator : public cv::MatAllocator {
+public:
+    V4l2BufferAllocator(int descriptor, const QVector<void*>& starts, const QVector<size_t>& lengths);
+
+    cv::UMatData* allocate(int dims, const int* sizes, int type, void* data, size_t* step,
+                           cv::AccessFlag flags, cv::UMatUsageFlags usageFlags) const override;
+    bool allocate(cv::UMatData* data, cv::AccessFlag accessFlags, cv::UMatUsageFlags usageFlags) const override;
+    void deallocate(cv::UMatData* data) const override;
+
+    cv::Mat wrap(int index, size_t bytesUsed);
+    void detach();
+
+private:
+    ~V4l2BufferAllocator() override;
+
+    int descriptor;
+    QVector<void*> starts;
+    QVector<size_t> lengths;
+    mutable QMutex mutex;
+    mutable int outstanding = 0;
+    mutable bool detached = false;
+    mutable int pendingIndex = -1;
+};
+
+class V4l2Capture {
+public:
+    V4l2Capture() = default;
+    ~V4l2Capture();
+
+    bool open(const QString& devicePath, const V4l2Format& format, int bufferCount = 4);
+    cv::Mat readSample(int timeoutMs = 1000);
+    void close();
+
+    bool isOpened() const;
+    const V4l2Format& format() const;
+    RawPixelFormat rawFormat() const;
+    qint64 lastTimestampUs() const;
+
+private:
+    int descriptor = -1;
+    V4l2Format activeFormat;
+    V4l2BufferAllocator* allocator = nullptr;
+    bool streaming = false;
+    qint64 sampleTimestampUs = 0;
+};
+
+bool openV4l2Camera(V4l2Capture& capture, int cameraIndex, bool preferCompressed, int bufferCount = 4,
+                    int maxFps = 0);
+
+QString getV4l2CamerasInfo(bool* complete = nullptr);
+QByteArray getV4l2CamerasInfoJson(bool* complete = nullptr);
@@ -0,0 +1,114 @@
+#!/usr/bin/env python3
+"""Loopback load generator for the camera backend command servers.
+
+Opens many concurrent preview clients against a running backend and reports
+connection success, delivered frame rate and throughput. Run it once against
+the default front-end and once against a backend started with --epoll:
+
+    ./camera-backend --epoll &
+    tools/loopback_bench.py --clients 1000 --camera 0 --fps 5 --seconds 30
+"""
+
+import argparse
+import asyncio
+import statistics
+import time
+
+
+class ClientStats:
+    def __init__(self):
+        self.connected = False
+        self.frames = 0
+        self.bytes = 0
+        self.first_frame_ms = None
+        self.error = None
+
+
+async def run_client(args, stats, start_time):
+    try:
+        reader, writer = await asyncio.wait_for(
+            asyncio.open_connection(args.host, args.port), timeout=args.connect_timeout)
+    except (OSError, asyncio.TimeoutError) as error:
+        stats.error = str(error) or type(error).__name__
+        return
+    stats.connected = True
+    writer.write(f"start_preview {args.camera} {args.fps}\n".encode())
+    await writer.drain()
+    deadline = start_time + args.seconds
+    try:
+        while time.monotonic() < deadline:
+            remaining = deadline - time.monotonic()
+            line = await asyncio.wait_for(reader.readline(), timeout=remaining)
+            if not line:
+                stats.error = "closed by server"
+                break
+            stats.bytes += len(line)
+            if line.startswith(b"FRAME:"):
+                size = int(line.rstrip(b"\n").split(b":")[3])
+                payload = await asyncio.wait_for(reader.readexactly(size), timeout=remaining)
+                stats.bytes += len(payload)
+                stats.frames += 1
+                if stats.first_frame_ms is None:
+                    stats.first_frame_ms = (time.monotonic() - start_time) * 1000
+            elif line.startswith(b"ERROR"):
+                stats.error = line.decode(errors="replace").strip()
+                break
+    except (asyncio.TimeoutError, asyncio.IncompleteReadError, ConnectionError):
+        pass
+    writer.close()
+    try:
+        await writer.wait_closed()
+    except ConnectionError:
+        pass
+
+
+async def run(args):
+    clients = [ClientStats() for _ in range(args.clients)]
+    start_time = time.monotonic()
+    tasks = []
+    for stats in clients:
+        tasks.append(asyncio.create_task(run_client(args, stats, start_time)))
+        if args.ramp_ms:
+            await asyncio.sleep(args.ramp_ms / 1000)
+    await asyncio.gather(*tasks)
+    elapsed = time.monotonic() - start_time
+
+    connected = [stats for stats in clients if stats.connected]
+    receiving = [stats for stats in connected if stats.frames > 0]
+    rates = [stats.frames / args.seconds for stats in receiving]
+    total_bytes = sum(stats.bytes for stats in clients)
+    errors = {}
+    for stats in clients:
+        if stats.error:
+            errors[stats.error] = errors.get(stats.error, 0) + 1
+
+    print(f"clients:          {args.clients}")
+    print(f"connected:        {len(connected)}")
+    print(f"receiving frames: {len(receiving)}")
+    if rates:
+        print(f"fps per client:   min {min(rates):.2f} median {statistics.median(rates):.2f} "
+              f"max {max(rates):.2f} (requested {args.fps})")
+        first_frames = sorted(stats.first_frame_ms for stats in receiving)
+        p99 = first_frames[min(len(first_frames) - 1, int(len(first_frames) * 0.99))]
+        print(f"first frame ms:   median {statistics.median(first_frames):.0f} p99 {p99:.0f}")
+    print(f"throughput:       {total_bytes * 8 / elapsed / 1e6:.1f} Mbit/s over {elapsed:.1f} s")
+    for error, count in sorted(errors.items(), key=lambda item: -item[1]):
+        print(f"error x{count}: {error}")
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("--host", default="127.0.0.1")
+    parser.add_argument("--port", type=int, default=12345)
+    parser.add_argument("--clients", type=int, default=1000)
+    parser.add_argument("--camera", type=int, default=0)
+    parser.add_argument("--fps", type=int, default=5)
+    parser.add_argument("--seconds", type=float, default=30)
+    parser.add_argument("--ramp-ms", type=float, default=1, help="delay between opening clients")
+    parser.add_argument("--connect-timeout", type=float, default=10)
+    args = parser.parse_args()
+    asyncio.run(run(args))
+
+
+if __name__ == "__main__":
+    main()